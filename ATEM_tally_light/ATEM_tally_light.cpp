@@ -9,7 +9,7 @@ float firmware_version = 1.23;
 //
 //
 #define VERSION "dev"
-#define FASTLED_ALLOW_INTERRUPTS 0
+#define FASTLED_ALLOW_INTERRUPTS 1 // Let WiFi interrupts in between LEDs while a frame goes out, FastLED sends the frame again if one held it up too long
 #define DISPLAY_NAME "Tally Light"
 
 // Include libraries:
@@ -57,31 +57,122 @@ CRGB color_led[8] = {CRGB::Black, CRGB::Red, CRGB::Lime, CRGB::Blue, CRGB::Yello
 #define TALLY_FLAG_PROGRAM 1
 #define TALLY_FLAG_PREVIEW 2
 
+#define TALLY_NUMBER_MAX 255 // Highest tally number that can be set, as it's stored in a byte. The switcher decides how many there are
+
 // Define Neopixel status-LED options
 #define NEOPIXEL_STATUS_FIRST 1
 #define NEOPIXEL_STATUS_LAST 2
 #define NEOPIXEL_STATUS_NONE 3
 
+// How the tally server sends tally data to tally lights connected to this one
+#define TALLY_RELAY_UNICAST 0   // One packet per tally light
+#define TALLY_RELAY_MULTICAST 1 // One packet to TALLY_RELAY_MULTICAST_GROUP for all of them, tally lights that miss it get it on their own
+#define TALLY_RELAY_BROADCAST 2 // As multicast, but to the broadcast address of the WiFi network
+#define TALLY_RELAY_MODE TALLY_RELAY_UNICAST
+#define TALLY_RELAY_MULTICAST_GROUP IPAddress(239, 255, 65, 84)
+#define TALLY_RELAY_PORT 9911
+#define TALLY_RELAY_RESERVED_SOURCES 64 // Tally sources the tally server makes room for at startup, so passing on a switcher's tally takes no heap memory after that
+
+// How the tally of the sources in a transition on M/E 1 follows its position (TrPs), set per tally light. Only from a switcher, tally lights don't pass TrPs on
+#define TALLY_TRANSITION_OFF 0               // The tally changes when the switcher's tally does
+#define TALLY_TRANSITION_FADE 1              // The incoming source fades from preview to program and the outgoing one back, as the transition goes
+#define TALLY_TRANSITION_SWEEP 2             // ...or the new color sweeps along each segment
+#define TALLY_TRANSITION_FRAME_INTERVAL 20   // ms between frames of a transition, which are rendered in between the switcher's TrPs
+#define TALLY_TRANSITION_EXTRAPOLATE_MAX 100 // ms the position is moved on from the last TrPs at the rate it last moved, so it stops with a T-bar that does
+
 // FastLED
 #define TALLY_DATA_PIN 13 // D7
+#define LED_SEGMENTS_MAX 8 // Tally segments the strip can be split into, each showing a tally number of its own. As many as a tally light can subscribe to (ATEM_maxSubscribedIndexes)
 
 int tempBrightness;
 int updateColor = 0;
 int numTallyLEDs;
 int numStatusLEDs;
 CRGB *leds;
-CRGB *tallyLEDs;
-CRGB *statusLED;
-bool neopixelsUpdated = false;
+
+// A run of LEDs on the strip that all show the same color
+struct LedSegment
+{
+    CRGB *pixels;    // First LED of the segment in leds
+    uint16_t length; // LEDs in the segment, 0 if it is not on the strip
+    CRGB color;      // Color its LEDs are to show
+    CRGB sweepColor; // ...except for the first sweep of them, which show this one
+    uint16_t sweep;
+    bool dirty;      // The colors have not been written into pixels yet
+    uint8_t tallyNo; // Tally number a tally segment shows
+    uint8_t mode;    // MODE_* a tally segment shows it in
+    uint8_t scale;   // Brightness of a tally segment, 255 for that of the strip
+};
+
+#define LED_SEGMENT_STATUS 0 // The status LED, the tally segments follow
+#define LED_SEGMENT_TALLY 1
+
+LedSegment ledSegments[LED_SEGMENT_TALLY + LED_SEGMENTS_MAX];
+uint8_t numLedSegments = 0;
+uint32_t frameVersion = 1;      // Goes up whenever a segment changes color, starts ahead so the first frame is always shown
+uint32_t shownFrameVersion = 0; // frameVersion of the frame on the strip
+bool tallyUpdated = true;
+bool tallyBySourceUpdated = false; // The tally by source (TlSr) of the active switcher changed and has to be passed on to the tally server
+
+// Tally latency measurement, from reading the datagram with a tally change to FastLED.show() returning with the new color
+#define LATENCY_BUCKETS 12 // The first bucket holds latencies below 250 us, each next one is twice as wide, the last one holds everything from 256 ms up
+
+struct LatencyHistogram
+{
+    const char *name;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+LatencyHistogram latencyDecide = {"receive -> decide"}; // Until getLedColor()/setSTRIP() has set the new color
+LatencyHistogram latencyShow = {"decide -> shown"};     // FastLED.show() of the new color
+LatencyHistogram latencyTotal = {"receive -> shown"};
+bool tallyLatencyReceived = false; // A tally change is on its way to the LEDs
+bool tallyLatencyDecided = false;  // ...and its color has been set on the strip
+unsigned long tallyReceivedAt;     // micros()
+unsigned long tallyDecidedAt;      // micros()
+
+// How long loop() is held up, mostly by sending the LED frame, which takes 30 us per LED
+LatencyHistogram loopStall = {"loop stall"}; // Between two passes of loop(), the longest the switcher and tally server connections go unserviced
+LatencyHistogram ledOutput = {"LED output"}; // FastLED.show() of a frame in loop()
+unsigned long loopAt = 0;                    // micros() the last pass of loop() started
+
+// The transition on M/E 1 of the active switcher, for settings.tallyTransition
+bool transitionActive = false;
+uint16_t transitionPosition;     // 0-9999, as of transitionAt
+unsigned long transitionAt;      // millis() the last TrPs came in
+int32_t transitionRate;          // Position per second it moved at between the last two TrPs
+unsigned long transitionFrameAt; // millis() the last frame of the transition was rendered
+bool transitionFrameDue = false; // The transition moved on and has to be rendered, without a change in the tally itself
 
 // Initialize global variables
 ESP8266WebServer server(80);
-ATEMmin atemSwitcher;
+ATEMmin atemSwitchers[2];                  // Switcher 1 and 2 are connected at the same time, so the tally can fail over without reconnecting
+uint8_t activeSwitcher = 0;                // Index in atemSwitchers of the switcher the tally is taken from
+ATEMmin *atemSwitcher = &atemSwitchers[0]; // The active switcher
+uint32_t switcherFailovers = 0;            // Times the active switcher was lost and the other one took over
+uint32_t switcherFailbacks = 0;            // Times the tally went back to the preferred switcher
+unsigned long lastSwitchoverAt = 0;        // millis() of the last failover or failback
 TallyServer tallyServer;
 ImprovWiFi improv(&Serial);
 
 uint8_t state = STATE_STARTING;
 
+// A tally segment as stored in the settings, 6 bytes
+struct SegmentSettings
+{
+    uint16_t start : 10;     // First LED, 0 for the first LED after the status LED
+    uint16_t mode : 3;       // MODE_*, 0 if the segment is not used
+    uint16_t : 3;
+    uint16_t length : 10;    // LEDs
+    uint16_t brightness : 4; // Of the strip brightness, in steps of 1/15
+    uint16_t : 2;
+    uint8_t tallyNo;         // As Settings::tallyNo
+};
+
 // Define struct for holding tally settings (mostly to simplify EEPROM read and write, in order to persist settings)
 struct Settings
 {
@@ -104,6 +195,8 @@ struct Settings
     int updateURLPort;
     char requestURLs[112] = "";
     bool colorTerminal = false;
+    SegmentSettings segments[LED_SEGMENTS_MAX]; // Without any, all tally LEDs show tallyNo in tallyModeLED1
+    uint8_t tallyTransition;                    // TALLY_TRANSITION_*
 };
 
 Settings settings;
@@ -131,7 +224,7 @@ void update_progress(int cur, int total)
         setSTRIP(LED_GREEN);
     else
         setSTRIP(LED_OFF);
-    FastLED.show();
+    showLEDs();
     updateColor++;
 }
 
@@ -275,20 +368,21 @@ void setup()
             numTallyLEDs = settings.neopixelsAmount - numStatusLEDs;
             if (settings.neopixelStatusLEDOption == NEOPIXEL_STATUS_FIRST)
             {
-                statusLED = leds;
-                tallyLEDs = leds + numStatusLEDs;
+                beginSegment(ledSegments[LED_SEGMENT_STATUS], 0, numStatusLEDs);
+                beginTallySegments(numStatusLEDs);
             }
             else
             { // if last or other value
-                statusLED = leds + numTallyLEDs;
-                tallyLEDs = leds;
+                beginSegment(ledSegments[LED_SEGMENT_STATUS], numTallyLEDs, numStatusLEDs);
+                beginTallySegments(0);
             }
         }
         else
         {
             numTallyLEDs = settings.neopixelsAmount;
             numStatusLEDs = 0;
-            tallyLEDs = leds;
+            beginSegment(ledSegments[LED_SEGMENT_STATUS], 0, 0);
+            beginTallySegments(0);
         }
     }
     else
@@ -302,7 +396,7 @@ void setup()
     FastLED.setBrightness(tempBrightness);
     setSTRIP(LED_OFF);
     setStatusLED(LED_BLUE);
-    FastLED.show();
+    showLEDs();
 
     Serial.println(settings.tallyName);
 
@@ -330,11 +424,33 @@ void setup()
     // Initialize and begin HTTP server for handeling the web interface
     server.on("/", handleRoot);
     server.on("/save", handleSave);
+    server.on("/latency", handleLatency);
+    server.on("/clients", handleClients);
     server.onNotFound(handleNotFound);
     server.begin();
 
+    tallyServer.reserveTallySources(TALLY_RELAY_RESERVED_SOURCES, TALLY_RELAY_RESERVED_SOURCES);
     tallyServer.begin();
 
+    // Tally lights can connect to each other's tally server instead of to the switcher, forming a tree. The chip ID tells
+    // each relay apart in the relay path passed down, so a tally light notices its own tally coming back around a loop
+    uint32_t relayID = ESP.getChipId();
+    tallyServer.setRelayID(relayID);
+    atemSwitchers[0].setRelayID(relayID);
+    atemSwitchers[1].setRelayID(relayID);
+
+    // Only react to the switcher's tally when it actually changes
+    atemSwitchers[0].onTallyChange(switcherTallyChanged<0>);
+    atemSwitchers[0].onTallySourcesChange(switcherTallySourcesChanged<0>);
+    atemSwitchers[0].onTallyBySourceChange(switcherTallyBySourceChanged<0>);
+    atemSwitchers[0].onStreamingStatusChange(switcherStreamingStatusChanged<0>);
+    atemSwitchers[0].onTransitionChange(switcherTransitionChanged<0>);
+    atemSwitchers[1].onTallyChange(switcherTallyChanged<1>);
+    atemSwitchers[1].onTallySourcesChange(switcherTallySourcesChanged<1>);
+    atemSwitchers[1].onTallyBySourceChange(switcherTallyBySourceChanged<1>);
+    atemSwitchers[1].onStreamingStatusChange(switcherStreamingStatusChanged<1>);
+    atemSwitchers[1].onTransitionChange(switcherTransitionChanged<1>);
+
     improv.setDeviceInfo(CHIP_FAMILY, DISPLAY_NAME, VERSION, "Tally Light", "");
     improv.onImprovError(onImprovWiFiErrorCb);
     improv.onImprovConnected(onImprovWiFiConnectedCb);
@@ -383,6 +499,13 @@ bool correctCMD;
 
 void loop()
 {
+    unsigned long loopStartedAt = micros();
+    if (loopAt != 0)
+    {
+        recordLatency(loopStall, loopStartedAt - loopAt);
+    }
+    loopAt = loopStartedAt;
+
     bytesAvailable = Serial.available();
     if (bytesAvailable > 0)
     {
@@ -418,9 +541,12 @@ void loop()
                 Serial.println("* '\u001b[32mip\u001b[37m'/'\u001b[32mip set\u001b[37m' - change IP addresses");
                 Serial.println("* '\u001b[32mwifi set\u001b[37m'/'\u001b[32mwifi\u001b[37m' - change WiFi SSID and password for ESP");
                 Serial.println("* '\u001b[32mtally\u001b[37m' - change Tally number (no. of camera)");
+                Serial.println("* '\u001b[32msegments\u001b[37m' - change LED strip segments showing other cameras");
                 Serial.println("* '\u001b[32mls switcher\u001b[37m'/'\u001b[32mlss\u001b[37m' - show IP addresses of switches");
                 Serial.println("* '\u001b[32mswitcher set ip\u001b[37m' - change switcher IP address");
                 Serial.println("* '\u001b[32mswitcher set active\u001b[37m' - change switcher IP address");
+                Serial.println("* '\u001b[32mlatency\u001b[37m'/'\u001b[32mlatency reset\u001b[37m' - show/reset tally latency and loop stall histograms");
+                Serial.println("* '\u001b[32mclients\u001b[37m' - show round trip time, loss and resends of the tally lights connected to this one");
                 Serial.println("* '\u001b[32mv\u001b[37m'/'\u001b[32mversion\u001b[37m' - check firmware version");
                 Serial.println("* '\u001b[32mup\u001b[37m'/'\u001b[32mupdate\u001b[37m'/'\u001b[32mversion -u\u001b[37m' - check online (and update) firmware");
             }
@@ -438,9 +564,12 @@ void loop()
                 Serial.println("* 'ip'/'ip set' - change IP addresses");
                 Serial.println("* 'wifi set'/'wifi' - change WiFi SSID and password for ESP");
                 Serial.println("* 'tally' - change Tally number (no. of camera)");
+                Serial.println("* 'segments' - change LED strip segments showing other cameras");
                 Serial.println("* 'ls switcher'/'lss' - show IP addresses of switches");
                 Serial.println("* 'switcher set ip' - change switcher IP address");
                 Serial.println("* 'switcher set active' - change switcher IP address");
+                Serial.println("* 'latency'/'latency reset' - show/reset tally latency and loop stall histograms");
+                Serial.println("* 'clients' - show round trip time, loss and resends of the tally lights connected to this one");
                 Serial.println("* 'v'/'version' - check firmware version");
                 Serial.println("* 'up'/'update'/'version -u' - check online (and update) firmware");
             }
@@ -517,7 +646,7 @@ void loop()
         if (readString == "tally" || readString == "tallynumber")
         {
             correctCMD = true;
-            Serial.print("Write Tally Number [1-40]: ");
+            Serial.print((String) "Write Tally Number [1-" + TALLY_NUMBER_MAX + "]: ");
             while (!Serial.available())
             {
                 // waiting for serial data
@@ -529,7 +658,7 @@ void loop()
                 Serial.println("\u001b[33m" + nrStr + "\u001b[37m");
             else
                 Serial.println(nr);
-            if (nr > 0 && nr < 41)
+            if (nr > 0 && nr <= TALLY_NUMBER_MAX)
             {
                 settings.tallyNo = nr - 1;
                 Serial.println("Tally number saved successfully!");
@@ -545,6 +674,41 @@ void loop()
             }
         }
 
+        if (readString == "segments")
+        {
+            correctCMD = true;
+            String segments = getSegmentsString();
+            if (segments.length() == 0)
+            {
+                segments = (String) "none, all LEDs show tally " + (settings.tallyNo + 1);
+            }
+            Serial.println((String) "Segments: " + segments);
+            Serial.print("Write segments [first-last:camera:mode:brightness;...], mode 1 normal, 2 preview stay on, 3 program only, 4 on air, empty for none: ");
+            while (!Serial.available())
+            {
+                // waiting for serial data
+            }
+            String spec = Serial.readStringUntil('\n');
+            spec.trim();
+            if (settings.colorTerminal)
+                Serial.println("\u001b[33m" + spec + "\u001b[37m");
+            else
+                Serial.println(spec);
+            if (parseSegments(spec))
+            {
+                Serial.println("Segments saved successfully!");
+                delay(500);
+                updateSettings();
+            }
+            else
+            {
+                if (settings.colorTerminal)
+                    Serial.println("\u001b[31mInvalid segments!\u001b[37m");
+                else
+                    Serial.println("Invalid segments!");
+            }
+        }
+
         if (readString == "switcher set ip" || readString == "switcher ip set")
         {
             correctCMD = true;
@@ -622,14 +786,12 @@ void loop()
                 Serial.println(nr);
             if (nr > 0 && nr < 3)
             {
-                if (nr == 1)
-                    settings.whichSwicher = false;
-                else
-                    settings.whichSwicher = true;
+                // Both switchers are connected already, so this takes effect without a restart
+                settings.whichSwicher = nr == 2;
+                EEPROM.put(0, settings);
+                EEPROM.commit();
                 Serial.flush();
-                Serial.println(" Changed switcher to " + nr);
-                delay(500);
-                updateSettings();
+                Serial.println((String) "Changed preferred switcher to " + nr);
             }
             else
             {
@@ -645,6 +807,9 @@ void loop()
             correctCMD = true;
             Serial.println((String) "Switcher 1 IP: " + settings.switcherIP1[0] + "." + settings.switcherIP1[1] + "." + settings.switcherIP1[2] + "." + settings.switcherIP1[3]);
             Serial.println((String) "Switcher 2 IP: " + settings.switcherIP2[0] + "." + settings.switcherIP2[1] + "." + settings.switcherIP2[2] + "." + settings.switcherIP2[3]);
+            Serial.println((String) "Preferred: " + (settings.whichSwicher ? 2 : 1) + ", active: " + (activeSwitcher + 1));
+            Serial.println((String) "Failovers: " + switcherFailovers + ", failbacks: " + switcherFailbacks);
+            Serial.println((String) "Reconnects: " + atemSwitcher->getReconnectCount() + ", last took " + atemSwitcher->getTimeToReconnect() + " ms, tally after " + atemSwitcher->getTimeToFirstTally() + " ms");
         }
 
         if (readString == "color")
@@ -895,6 +1060,27 @@ void loop()
             }
         }
 
+        if (readString == "latency")
+        {
+            correctCMD = true;
+            Serial.println();
+            Serial.print(getLatencyReport());
+        }
+
+        if (readString == "clients")
+        {
+            correctCMD = true;
+            Serial.println();
+            Serial.print(getClientsReport());
+        }
+
+        if (readString == "latency reset")
+        {
+            correctCMD = true;
+            resetLatency();
+            Serial.println("Tally latency histograms reset");
+        }
+
         if (readString == "ping")
         {
             correctCMD = true;
@@ -981,6 +1167,12 @@ void loop()
             Serial.println("Gateway IP:          " + WiFi.gatewayIP().toString());
             Serial.println("DNS:                 " + WiFi.dnsIP().toString());
             Serial.println("------------------------");
+
+#if TALLY_RELAY_MODE == TALLY_RELAY_MULTICAST
+            tallyServer.setMulticast(TALLY_RELAY_MULTICAST_GROUP, TALLY_RELAY_PORT);
+#elif TALLY_RELAY_MODE == TALLY_RELAY_BROADCAST
+            tallyServer.setMulticast(WiFi.broadcastIP(), TALLY_RELAY_PORT);
+#endif
             Serial.print(F("Current firmware version: "));
             Serial.println(firmware_version);
             updateSoftware();
@@ -1000,24 +1192,14 @@ void loop()
         // Initialize a connection to the switcher:
         if (firstRun)
         {
-            if (!settings.whichSwicher)
-            {
-                atemSwitcher.begin(settings.switcherIP1);
-            }
-            else
-            {
-                atemSwitcher.begin(settings.switcherIP2);
-            }
-            // atemSwitcher.serialOutput(0xff); //Makes Atem library print debug info
+            beginSwitchers();
+            // atemSwitchers[0].serialOutput(0xff); //Makes Atem library print debug info
             Serial.println("------------------------");
             Serial.println("Connecting to switcher...");
-            if (!settings.whichSwicher)
-            {
-                Serial.println((String) "Switcher IP:         " + settings.switcherIP1[0] + "." + settings.switcherIP1[1] + "." + settings.switcherIP1[2] + "." + settings.switcherIP1[3]);
-            }
-            else
+            Serial.println((String) "Switcher IP:         " + settings.switcherIP1[0] + "." + settings.switcherIP1[1] + "." + settings.switcherIP1[2] + "." + settings.switcherIP1[3] + (settings.whichSwicher ? "" : " (preferred)"));
+            if (switcherConfigured(1))
             {
-                Serial.println((String) "Switcher IP:         " + settings.switcherIP2[0] + "." + settings.switcherIP2[1] + "." + settings.switcherIP2[2] + "." + settings.switcherIP2[3]);
+                Serial.println((String) "Switcher IP:         " + settings.switcherIP2[0] + "." + settings.switcherIP2[1] + "." + settings.switcherIP2[2] + "." + settings.switcherIP2[3] + (settings.whichSwicher ? " (preferred)" : ""));
             }
             firstRun = false;
 
@@ -1028,8 +1210,9 @@ void loop()
                 Serial.print("root:$ ");
             }
         }
-        atemSwitcher.runLoop();
-        if (atemSwitcher.isConnected())
+        runSwitchers();
+        selectSwitcher();
+        if (switcherUsable(activeSwitcher))
         {
             changeState(STATE_RUNNING);
             Serial.println("Connected to switcher");
@@ -1038,33 +1221,102 @@ void loop()
         break;
 
     case STATE_RUNNING:
-        // Handle data exchange and connection to swithcher
-        atemSwitcher.runLoop();
+        if (firstRun)
+        {
+            // Change notifications only report what changes from now on, and the tally server was reset when the connection was lost
+            firstRun = false;
+            syncTally();
+        }
+
+        // Handle data exchange and connection to both switchers. Tally changes come in through tallyChanged() and friends
+        runSwitchers();
 
-        int tallySources = atemSwitcher.getTallyByIndexSources();
-        tallyServer.setTallySources(tallySources);
-        for (int i = 0; i < tallySources; i++)
+        // Fail over to the other switcher if the active one is lost, and back once the preferred one is there again
+        bool wasConnected = atemSwitcher->isConnected();
+        if (selectSwitcher())
         {
-            tallyServer.setTallyFlag(i, atemSwitcher.getTallyByIndexTallyFlags(i));
+            lastSwitchoverAt = millis();
+            if (!wasConnected)
+            {
+                switcherFailovers++;
+                Serial.println((String) "Switcher lost, failed over to switcher " + (activeSwitcher + 1));
+            }
+            else
+            {
+                switcherFailbacks++;
+                Serial.println((String) "Switched back to switcher " + (activeSwitcher + 1));
+            }
+            syncTally();
         }
 
         // Switch state if ATEM connection is lost...
-        if (!atemSwitcher.isConnected())
+        if (!switcherUsable(activeSwitcher))
         { // will return false if the connection was lost
             Serial.println("------------------------");
-            Serial.println("Connection to Switcher lost...");
+            if (atemSwitcher->isRelayLooped())
+            {
+                Serial.println("Tally relayed back to this tally light, or through too many tally lights...");
+            }
+            else
+            {
+                Serial.println("Connection to Switcher lost...");
+            }
             changeState(STATE_CONNECTING_TO_SWITCHER);
 
             // Reset tally server's tally flags, so clients turn off their lights.
             tallyServer.resetTallyFlags();
         }
 
+        // Tally lights connected to this one learn how far the tally came, and take themselves out of a loop
+        syncRelayPath();
+
+        // Tally lights nothing is relayed to only need the tally of their own tally number
+        syncTallySubscription();
+
+        // Pass the tally by source on as a whole. It only changes along with the tally by index, so this is rare
+        if (tallyBySourceUpdated)
+        {
+            tallyBySourceUpdated = false;
+            uint16_t tallyBySourceSources = atemSwitcher->getTallyBySourceSources();
+            tallyServer.setTallyBySourceSources(tallyBySourceSources);
+            for (uint16_t i = 0; i < tallyBySourceSources; i++)
+            {
+                uint16_t videoSource = atemSwitcher->getTallyBySourceVideoSource(i);
+                tallyServer.setTallyBySourceFlag(i, videoSource, atemSwitcher->getTallyBySourceTallyFlags(videoSource));
+            }
+        }
+
         // Handle Tally Server
         tallyServer.runLoop();
 
-        // Set LED and Neopixel colors accordingly
-        int color = getLedColor(settings.tallyModeLED1, settings.tallyNo);
-        setSTRIP(color);
+        // A transition moves on at a frame pace of its own, in between the switcher's transition positions
+        if (transitionActive && millis() - transitionFrameAt >= TALLY_TRANSITION_FRAME_INTERVAL)
+        {
+            transitionFrameDue = true;
+        }
+
+        // Set LED and Neopixel colors accordingly, if the tally changed or a transition moved on
+        if (tallyUpdated || transitionFrameDue)
+        {
+            bool fromTally = tallyUpdated;
+            tallyUpdated = false;
+            transitionFrameDue = false;
+            bool colorChanged = setTallySegments();
+
+            // Only a pass for a tally change counts for its latency, not a frame of a transition
+            if (fromTally && tallyLatencyReceived && !tallyLatencyDecided)
+            {
+                if (colorChanged)
+                {
+                    tallyDecidedAt = micros();
+                    tallyLatencyDecided = true;
+                }
+                else
+                {
+                    tallyLatencyReceived = false; // Nothing to see for this change
+                }
+            }
+        }
         break;
     }
 
@@ -1076,25 +1328,30 @@ void loop()
         changeState(STATE_CONNECTING_TO_WIFI);
 
         // Force atem library to reset connection, in order for status to read correctly on website.
-        if (!settings.whichSwicher)
+        beginSwitchers();
+        atemSwitchers[0].connect();
+        if (switcherConfigured(1))
         {
-            atemSwitcher.begin(settings.switcherIP1);
+            atemSwitchers[1].connect();
         }
-        else
-        {
-            atemSwitcher.begin(settings.switcherIP2);
-        }
-        atemSwitcher.connect();
 
         // Reset tally server's tally flags, They won't get the message, but it'll be reset for when the connectoin is back.
         tallyServer.resetTallyFlags();
+        tallyServer.setUpstreamHops(0);
     }
 
-    // Show strip only on updates
-    if (neopixelsUpdated)
+    // Show strip only when a segment changed color
+    if (showLEDs())
     {
-        FastLED.show();
-        neopixelsUpdated = false;
+        if (tallyLatencyDecided)
+        {
+            unsigned long shownAt = micros();
+            recordLatency(latencyDecide, tallyDecidedAt - tallyReceivedAt);
+            recordLatency(latencyShow, shownAt - tallyDecidedAt);
+            recordLatency(latencyTotal, shownAt - tallyReceivedAt);
+            tallyLatencyReceived = false;
+            tallyLatencyDecided = false;
+        }
     }
 
     // Handle web interface
@@ -1105,6 +1362,7 @@ void loop()
 void changeState(uint8_t stateToChangeTo)
 {
     firstRun = true;
+    transitionActive = false;
     switch (stateToChangeTo)
     {
     case STATE_CONNECTING_TO_WIFI:
@@ -1185,48 +1443,627 @@ void analogWriteWrapper(uint8_t pin, uint8_t value)
     analogWrite(pin, value);
 }
 
-// Set the color of the LED strip, except for the status LED
-void setSTRIP(uint8_t color)
+// Place a segment on the strip. Its LEDs are written on the next frame, as leds starts out uninitialized
+void beginSegment(LedSegment &segment, uint16_t start, uint16_t length)
 {
-    if (numTallyLEDs > 0 && tallyLEDs[0] != color_led[color])
+    segment.pixels = leds + start;
+    segment.length = length;
+    segment.color = CRGB::Black;
+    segment.sweep = 0;
+    segment.dirty = length > 0;
+}
+
+// Set the color of a segment, only marking it for the next frame if the color changed. Returns whether it did
+bool setSegmentColor(LedSegment &segment, const CRGB &color)
+{
+    return setSegmentSweep(segment, color, color, 0);
+}
+
+// Set the colors of a segment with its first sweep LEDs showing sweepColor, only marking it for the next frame if they changed. Returns whether they did
+bool setSegmentSweep(LedSegment &segment, const CRGB &color, const CRGB &sweepColor, uint16_t sweep)
+{
+    if (segment.length == 0)
+    {
+        return false;
+    }
+    if (sweep >= segment.length)
     {
-        for (int i = 0; i < numTallyLEDs; i++)
+        return setSegmentSweep(segment, sweepColor, sweepColor, 0);
+    }
+    if (segment.color == color && segment.sweep == sweep && (sweep == 0 || segment.sweepColor == sweepColor))
+    {
+        return false;
+    }
+    segment.color = color;
+    segment.sweepColor = sweepColor;
+    segment.sweep = sweep;
+    segment.dirty = true;
+    frameVersion++;
+    return true;
+}
+
+// Whether a tally segment from the settings is used, lies on the tally LEDs and doesn't overlap a used one before it
+bool segmentFits(const SegmentSettings *segments, uint8_t index, uint16_t tallyLEDs)
+{
+    const SegmentSettings &segment = segments[index];
+    if (segment.mode < MODE_NORMAL || segment.mode > MODE_ON_AIR || segment.length == 0 || segment.start + segment.length > tallyLEDs)
+    {
+        return false;
+    }
+    for (uint8_t i = 0; i < index; i++)
+    {
+        if (segments[i].mode != 0 && segment.start < segments[i].start + segments[i].length && segments[i].start < segment.start + segment.length)
         {
-            tallyLEDs[i] = color_led[color];
+            return false;
         }
-        neopixelsUpdated = true;
     }
+    return true;
 }
 
-// Set the single status LED (last LED)
-void setStatusLED(uint8_t color)
+// Place the tally segments from the settings on the tally LEDs, which begin at tallyStart on the strip. Segments that don't fit are dropped,
+// and settings from before there were segments read as such. Without any, one segment covers all tally LEDs
+void beginTallySegments(uint16_t tallyStart)
+{
+    numLedSegments = LED_SEGMENT_TALLY;
+    for (uint8_t i = 0; i < LED_SEGMENTS_MAX; i++)
+    {
+        SegmentSettings &segmentSettings = settings.segments[i];
+        if (!segmentFits(settings.segments, i, numTallyLEDs))
+        {
+            segmentSettings.mode = 0;
+            continue;
+        }
+        LedSegment &segment = ledSegments[numLedSegments++];
+        beginSegment(segment, tallyStart + segmentSettings.start, segmentSettings.length);
+        segment.tallyNo = segmentSettings.tallyNo;
+        segment.mode = segmentSettings.mode;
+        segment.scale = segmentSettings.brightness * 17;
+    }
+
+    if (numLedSegments == LED_SEGMENT_TALLY)
+    {
+        LedSegment &segment = ledSegments[numLedSegments++];
+        beginSegment(segment, tallyStart, numTallyLEDs);
+        segment.tallyNo = settings.tallyNo;
+        segment.mode = settings.tallyModeLED1;
+        segment.scale = 255;
+    }
+}
+
+// Set every tally segment to the color of its tally number in its mode, or to where it is in a transition. Returns whether any of them changed
+bool setTallySegments()
+{
+    uint16_t position = 0;
+    if (transitionActive)
+    {
+        position = getTransitionPosition();
+        transitionFrameAt = millis();
+    }
+
+    bool changed = false;
+    for (uint8_t i = LED_SEGMENT_TALLY; i < numLedSegments; i++)
+    {
+        LedSegment &segment = ledSegments[i];
+        CRGB color = color_led[getLedColor(segment.mode, segment.tallyNo)];
+        color.nscale8_video(segment.scale);
+
+        // In a transition, the source coming in is on preview and goes to program, the one going out does the opposite
+        uint8_t tallyFlags = segment.tallyNo < atemSwitcher->getTallyByIndexSources() ? atemSwitcher->getTallyByIndexTallyFlags(segment.tallyNo) : 0;
+        if (!transitionActive || segment.mode == MODE_ON_AIR || !(tallyFlags & (TALLY_FLAG_PROGRAM | TALLY_FLAG_PREVIEW)))
+        {
+            changed |= setSegmentColor(segment, color);
+            continue;
+        }
+        CRGB from = color_led[segment.mode == MODE_PROGRAM_ONLY ? LED_OFF : LED_GREEN];
+        CRGB to = color_led[LED_RED];
+        if (!(tallyFlags & TALLY_FLAG_PREVIEW))
+        {
+            CRGB swap = from;
+            from = to;
+            to = swap;
+        }
+        from.nscale8_video(segment.scale);
+        to.nscale8_video(segment.scale);
+
+        if (settings.tallyTransition == TALLY_TRANSITION_SWEEP)
+        {
+            changed |= setSegmentSweep(segment, from, to, (uint32_t)segment.length * position / 10000);
+        }
+        else
+        {
+            changed |= setSegmentColor(segment, blend(from, to, (uint32_t)position * 256 / 10000));
+        }
+    }
+    return changed;
+}
+
+// Where the transition is now (0-9999): the last position from the switcher, moved on at the rate it last moved
+uint16_t getTransitionPosition()
 {
-    if (numStatusLEDs > 0 && statusLED[0] != color_led[color])
+    unsigned long elapsed = millis() - transitionAt;
+    if (elapsed > TALLY_TRANSITION_EXTRAPOLATE_MAX)
     {
-        for (int i = 0; i < numStatusLEDs; i++)
+        elapsed = TALLY_TRANSITION_EXTRAPOLATE_MAX;
+    }
+    int32_t position = transitionPosition + transitionRate * (int32_t)elapsed / 1000;
+    return position < 0 ? 0 : position > 9999 ? 9999 : position;
+}
+
+// Called by the ATEM library when the transition of an M/E starts, moves on or ends
+void transitionChanged(uint8_t mE, bool inTransition, uint8_t framesRemaining, uint16_t position)
+{
+    if (mE != 0 || settings.tallyTransition == TALLY_TRANSITION_OFF || settings.tallyTransition > TALLY_TRANSITION_SWEEP)
+    {
+        return;
+    }
+
+    unsigned long now = millis();
+    if (inTransition && transitionActive && now != transitionAt)
+    {
+        transitionRate = ((int32_t)position - transitionPosition) * 1000 / (int32_t)(now - transitionAt);
+    }
+    else
+    {
+        transitionRate = 0;
+    }
+    transitionActive = inTransition;
+    transitionPosition = position;
+    transitionAt = now;
+    transitionFrameDue = true;
+}
+
+// Whether a tally segment shows the tally of a tally number
+bool tallyShown(uint16_t tallyIndex)
+{
+    for (uint8_t i = LED_SEGMENT_TALLY; i < numLedSegments; i++)
+    {
+        if (ledSegments[i].mode != MODE_ON_AIR && ledSegments[i].tallyNo == tallyIndex)
+        {
+            return true;
+        }
+    }
+    return numLedSegments <= LED_SEGMENT_TALLY && tallyIndex == settings.tallyNo;
+}
+
+// Whether a tally segment shows the streaming status
+bool onAirShown()
+{
+    for (uint8_t i = LED_SEGMENT_TALLY; i < numLedSegments; i++)
+    {
+        if (ledSegments[i].mode == MODE_ON_AIR)
+        {
+            return true;
+        }
+    }
+    return numLedSegments <= LED_SEGMENT_TALLY && settings.tallyModeLED1 == MODE_ON_AIR;
+}
+
+// Set the tally segments from text like "1-30:1:1:100;31-60:2", see getSegmentsString(). Empty text clears them.
+// Returns false, changing nothing, if it doesn't parse or the segments overlap
+bool parseSegments(const String &spec)
+{
+    SegmentSettings segments[LED_SEGMENTS_MAX] = {};
+    uint8_t count = 0;
+    int from = 0;
+    while (from < (int)spec.length())
+    {
+        int to = spec.indexOf(';', from);
+        if (to < 0)
+        {
+            to = spec.length();
+        }
+        String part = spec.substring(from, to);
+        part.trim();
+        from = to + 1;
+        if (part.length() == 0)
+        {
+            continue;
+        }
+
+        unsigned int first, last, camera, mode = MODE_NORMAL, brightness = 100;
+        if (count == LED_SEGMENTS_MAX || sscanf(part.c_str(), "%u-%u:%u:%u:%u", &first, &last, &camera, &mode, &brightness) < 3 || first < 1 || last < first || last > 1000 || camera < 1 || camera > TALLY_NUMBER_MAX || brightness > 100)
+        {
+            return false;
+        }
+        SegmentSettings &segment = segments[count];
+        segment.start = first - 1;
+        segment.length = last - first + 1;
+        segment.tallyNo = camera - 1;
+        segment.mode = mode;
+        segment.brightness = (brightness * 15 + 50) / 100;
+        if (!segmentFits(segments, count, 1000))
         {
-            statusLED[i] = color_led[color];
-            if (color == LED_ORANGE)
+            return false;
+        }
+        count++;
+    }
+    memcpy(settings.segments, segments, sizeof(segments));
+    return true;
+}
+
+// The tally segments as "first-last:camera:mode:brightness" for each, separated by ';'. LEDs count from 1 after the status LED, brightness is in %
+String getSegmentsString()
+{
+    String spec;
+    for (const SegmentSettings &segment : settings.segments)
+    {
+        if (segment.mode != 0)
+        {
+            if (spec.length() > 0)
             {
-                statusLED[i].fadeToBlackBy(230);
+                spec += ";";
             }
-            else
+            spec += (String)(segment.start + 1) + "-" + (segment.start + segment.length) + ":" + (segment.tallyNo + 1) + ":" + segment.mode + ":" + ((segment.brightness * 100 + 7) / 15);
+        }
+    }
+    return spec;
+}
+
+// Set the color of the LED strip, except for the status LED. Returns whether it changed
+bool setSTRIP(uint8_t color)
+{
+    bool changed = false;
+    for (uint8_t i = LED_SEGMENT_TALLY; i < numLedSegments; i++)
+    {
+        changed |= setSegmentColor(ledSegments[i], color_led[color]);
+    }
+    return changed;
+}
+
+// Set the single status LED (last LED)
+void setStatusLED(uint8_t color)
+{
+    CRGB statusColor = color_led[color];
+    if (color == LED_ORANGE)
+    {
+        statusColor.fadeToBlackBy(230);
+    }
+    setSegmentColor(ledSegments[LED_SEGMENT_STATUS], statusColor);
+}
+
+// Write the segments that changed color into leds, leaving the others alone
+void renderLEDs()
+{
+    for (uint8_t i = 0; i < numLedSegments; i++)
+    {
+        LedSegment &segment = ledSegments[i];
+        if (segment.dirty)
+        {
+            fill_solid(segment.pixels, segment.sweep, segment.sweepColor);
+            fill_solid(segment.pixels + segment.sweep, segment.length - segment.sweep, segment.color);
+            segment.dirty = false;
+        }
+    }
+}
+
+// Set up the connections to both switchers. Switcher 2 is only used if it has an address of its own
+void beginSwitchers()
+{
+    atemSwitchers[0].begin(settings.switcherIP1);
+    atemSwitchers[1].begin(settings.switcherIP2);
+    if (!switcherConfigured(activeSwitcher))
+    {
+        activeSwitcher = 0;
+        atemSwitcher = &atemSwitchers[0];
+    }
+}
+
+// Handle data exchange with both switchers
+void runSwitchers()
+{
+    atemSwitchers[0].runLoop();
+    if (switcherConfigured(1))
+    {
+        atemSwitchers[1].runLoop();
+    }
+}
+
+// Whether a switcher is used: switcher 2 needs an IP address, different from switcher 1's
+bool switcherConfigured(uint8_t switcher)
+{
+    if (switcher == 0)
+    {
+        return true;
+    }
+    return (uint32_t)settings.switcherIP2 != 0 && (uint32_t)settings.switcherIP2 != (uint32_t)settings.switcherIP1;
+}
+
+// Whether the tally can be taken from a switcher: it is connected, and if it is another tally light's tally server,
+// it didn't turn us away for being too far from the switcher, and the tally doesn't come around from this tally light through a loop
+bool switcherUsable(uint8_t switcher)
+{
+    return atemSwitchers[switcher].isConnected() && !atemSwitchers[switcher].isRejected() && !atemSwitchers[switcher].isRelayLooped();
+}
+
+// Pick the switcher to take the tally from: the preferred one once it is connected and initialized,
+// otherwise stay with the active one, unless it was lost and the other one is connected.
+// Returns true if the active switcher changed.
+bool selectSwitcher()
+{
+    uint8_t preferred = settings.whichSwicher ? 1 : 0;
+    uint8_t other = 1 - activeSwitcher;
+    uint8_t next = activeSwitcher;
+
+    if (switcherConfigured(preferred) && switcherUsable(preferred) && atemSwitchers[preferred].hasInitialized())
+    {
+        next = preferred;
+    }
+    else if (!switcherUsable(activeSwitcher) && switcherConfigured(other) && switcherUsable(other))
+    {
+        next = other;
+    }
+
+    if (next == activeSwitcher)
+    {
+        return false;
+    }
+    activeSwitcher = next;
+    atemSwitcher = &atemSwitchers[next];
+    transitionActive = false; // Its end would come from the switcher that is no longer active
+    return true;
+}
+
+// Copy the whole tally of the active switcher to the tally server and LEDs. Needed when change notifications can't be relied on:
+// after (re)connecting, as the tally server was reset, and after a failover, as the other switcher's tally may differ.
+void syncTally()
+{
+    int tallySources = atemSwitcher->getTallyByIndexSources();
+    tallyServer.setTallySources(tallySources);
+    for (int i = 0; i < tallySources; i++)
+    {
+        tallyServer.setTallyFlag(i, atemSwitcher->getTallyByIndexTallyFlags(i));
+    }
+    tallyBySourceUpdated = true;
+    tallyUpdated = true;
+}
+
+// Pass the relays the tally came through on to the tally server, which adds this tally light to the path
+void syncRelayPath()
+{
+    uint8_t hops = switcherUsable(activeSwitcher) ? atemSwitcher->getRelayHops() : 0;
+    for (uint8_t hop = 0; hop < hops; hop++)
+    {
+        tallyServer.setUpstreamRelay(hop, atemSwitcher->getRelayID(hop), atemSwitcher->getRelayDelay(hop));
+    }
+    tallyServer.setUpstreamHops(hops);
+}
+
+// A tally light that no tally lights are connected to subscribes to just the tally of its own tally numbers, so a tally light
+// it gets the tally from only sends that, and only when it changes. Switchers don't know about it and send everything anyway.
+// Once a tally light connects, it takes all tally again to pass it on, which the new one has a round trip later.
+void syncTallySubscription()
+{
+    uint16_t tallyNos[LED_SEGMENTS_MAX];
+    uint8_t count = 0;
+    if (!tallyServer.getClientCount())
+    {
+        for (uint8_t i = LED_SEGMENT_TALLY; i < numLedSegments; i++)
+        {
+            if (ledSegments[i].mode != MODE_ON_AIR && count < LED_SEGMENTS_MAX)
             {
-                statusLED[i].fadeToBlackBy(0);
+                tallyNos[count++] = ledSegments[i].tallyNo;
             }
         }
-        neopixelsUpdated = true;
+        if (count == 0)
+        {
+            tallyNos[count++] = settings.tallyNo;
+        }
+    }
+    atemSwitchers[0].setTallySubscription(tallyNos, count);
+    atemSwitchers[1].setTallySubscription(tallyNos, count);
+}
+
+// Change notifications from switcher 1 and 2. Only those of the active switcher are passed on.
+template <uint8_t switcher>
+void switcherTallyChanged(uint16_t tallyIndex, uint8_t previousTallyFlags, uint8_t tallyFlags)
+{
+    if (switcher == activeSwitcher)
+    {
+        tallyChanged(tallyIndex, previousTallyFlags, tallyFlags);
+    }
+}
+
+template <uint8_t switcher>
+void switcherTallySourcesChanged(uint16_t sources)
+{
+    if (switcher == activeSwitcher)
+    {
+        tallySourcesChanged(sources);
+    }
+}
+
+template <uint8_t switcher>
+void switcherTallyBySourceChanged(uint16_t videoSource, uint8_t previousTallyFlags, uint8_t tallyFlags)
+{
+    if (switcher == activeSwitcher)
+    {
+        tallyBySourceUpdated = true;
+    }
+}
+
+template <uint8_t switcher>
+void switcherStreamingStatusChanged(uint16_t streamingStatusFlags)
+{
+    if (switcher == activeSwitcher)
+    {
+        streamingStatusChanged(streamingStatusFlags);
+    }
+}
+
+template <uint8_t switcher>
+void switcherTransitionChanged(uint8_t mE, bool inTransition, uint8_t framesRemaining, uint16_t position)
+{
+    if (switcher == activeSwitcher)
+    {
+        transitionChanged(mE, inTransition, framesRemaining, position);
     }
 }
 
+// Called by the ATEM library for every tally source whose flags changed
+void tallyChanged(uint16_t tallyIndex, uint8_t previousTallyFlags, uint8_t tallyFlags)
+{
+    tallyServer.setTallyFlag(tallyIndex, tallyFlags);
+    if (tallyShown(tallyIndex))
+    {
+        tallyReceived();
+    }
+}
+
+// Called by the ATEM library when the number of tally sources changed
+void tallySourcesChanged(uint16_t sources)
+{
+    tallyServer.setTallySources(sources);
+    tallyUpdated = true;
+}
+
+// Called by the ATEM library when the streaming status changed
+void streamingStatusChanged(uint16_t streamingStatusFlags)
+{
+    if (onAirShown())
+    {
+        tallyReceived();
+    }
+}
+
+// A change for this tally light has been received, start measuring its latency
+void tallyReceived()
+{
+    tallyUpdated = true;
+    if (!tallyLatencyReceived)
+    { // If changes pile up before they are shown, the oldest counts
+        tallyReceivedAt = atemSwitcher->getPacketReceivedTime();
+        tallyLatencyReceived = true;
+    }
+}
+
+// Add a latency (us) to a histogram
+void recordLatency(LatencyHistogram &histogram, unsigned long latency)
+{
+    uint8_t bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && latency >= (250UL << bucket))
+    {
+        bucket++;
+    }
+    histogram.buckets[bucket]++;
+
+    if (histogram.count == 0 || latency < histogram.min)
+    {
+        histogram.min = latency;
+    }
+    if (latency > histogram.max)
+    {
+        histogram.max = latency;
+    }
+    histogram.sum += latency;
+    histogram.count++;
+}
+
+// Render and send the LED frame to the strip if a segment changed color since the last one, timing how long that holds loop() up. Returns whether it was sent
+bool showLEDs()
+{
+    if (frameVersion == shownFrameVersion)
+    {
+        return false;
+    }
+    renderLEDs();
+
+    unsigned long startedAt = micros();
+    FastLED.show();
+    recordLatency(ledOutput, micros() - startedAt);
+    shownFrameVersion = frameVersion;
+    return true;
+}
+
+// Clear all latency histograms
+void resetLatency()
+{
+    LatencyHistogram *histograms[] = {&latencyDecide, &latencyShow, &latencyTotal, &loopStall, &ledOutput};
+    loopAt = 0;
+    for (LatencyHistogram *histogram : histograms)
+    {
+        histogram->count = histogram->min = histogram->max = 0;
+        histogram->sum = 0;
+        memset(histogram->buckets, 0, sizeof(histogram->buckets));
+    }
+}
+
+// Latency histograms as plain text, for the serial CLI and /latency
+String getLatencyReport()
+{
+    String report = "Tally latency (firmware " + String(firmware_version) + ", " + String(numTallyLEDs) + " LEDs, RSSI " + String(WiFi.RSSI()) + " dBm)\n";
+    LatencyHistogram *histograms[] = {&latencyDecide, &latencyShow, &latencyTotal, &loopStall, &ledOutput};
+    for (LatencyHistogram *histogram : histograms)
+    {
+        report += String(histogram->name) + ": " + String(histogram->count) + (histogram == &loopStall ? " passes" : histogram == &ledOutput ? " frames" : " changes");
+        if (histogram->count > 0)
+        {
+            report += ", mean " + String((uint32_t)(histogram->sum / histogram->count)) + " us, min " + String(histogram->min) + " us, max " + String(histogram->max) + " us";
+        }
+        report += "\n";
+
+        for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        {
+            unsigned long limit = 250UL << (bucket < LATENCY_BUCKETS - 1 ? bucket : bucket - 1);
+            String label = limit < 1000 ? String(limit) + "us" : String(limit / 1000) + "ms";
+            report += String(bucket < LATENCY_BUCKETS - 1 ? "  <" : "  >=") + label + ": " + String(histogram->buckets[bucket]) + "\n";
+        }
+    }
+
+    // Time each tally light relaying the tally took to pass the last change on, from the switcher down to this one
+    uint8_t hops = atemSwitcher->getRelayHops();
+    report += "Relay path: " + String(hops) + " hops" + (atemSwitcher->isRelayLooped() ? " (loop)" : "") + "\n";
+    for (uint8_t hop = 0; hop < hops; hop++)
+    {
+        report += "  relay " + String(atemSwitcher->getRelayID(hop), HEX) + ": " + String(atemSwitcher->getRelayDelay(hop)) + " us\n";
+    }
+    report += "  this tally light (" + String(ESP.getChipId(), HEX) + "): " + String(tallyServer.getRelayDelay()) + " us\n";
+    return report;
+}
+
+// The tally lights connected to the tally server as plain text, for the serial CLI and /clients
+String getClientsReport()
+{
+    String report = "Tally server clients: " + String(tallyServer.getClientCount()) + " of " + String(tallyServer.getMaxClients()) + "\n";
+    for (int index = 0; index < tallyServer.getMaxClients(); index++)
+    {
+        TallyClientStats stats;
+        if (!tallyServer.getClientStats(index, &stats))
+        {
+            continue;
+        }
+
+        report += "  " + stats.ip.toString() + ":" + String(stats.port);
+        if (stats.rtt)
+        {
+            report += ", rtt " + String(stats.rtt / 1000.0, 1) + " +/- " + String(stats.rttVariation / 1000.0, 1) + " ms";
+        }
+        report += ", resend timeout " + String(stats.resendTimeout) + " ms, loss " + String(stats.loss / 10.0, 1) + "%";
+        report += ", sent " + String(stats.packetsSent) + ", resent " + String(stats.resends) + ", asked " + String(stats.resendRequests);
+        if (!stats.initialized)
+        {
+            report += ", connecting";
+        }
+        else if (stats.multicast)
+        {
+            report += ", multicast";
+        }
+        else if (stats.subscribedIndexes)
+        {
+            report += ", subscribed to " + String(stats.subscribedIndexes) + " tally indexes";
+        }
+        report += "\n";
+    }
+    return report;
+}
+
 int getTallyState(uint16_t tallyNo)
 {
-    if (tallyNo >= atemSwitcher.getTallyByIndexSources())
+    if (tallyNo >= atemSwitcher->getTallyByIndexSources())
     { // out of range
         return TALLY_FLAG_OFF;
     }
 
-    uint8_t tallyFlag = atemSwitcher.getTallyByIndexTallyFlags(tallyNo);
+    uint8_t tallyFlag = atemSwitcher->getTallyByIndexTallyFlags(tallyNo);
     // Serial.println(tallyFlag);
     if (tallyFlag & TALLY_FLAG_PROGRAM)
     {
@@ -1246,7 +2083,7 @@ int getLedColor(int tallyMode, int tallyNo)
 {
     if (tallyMode == MODE_ON_AIR)
     {
-        if (atemSwitcher.getStreamStreaming())
+        if (atemSwitcher->getStreamStreaming())
         {
             return LED_RED;
         }
@@ -1325,16 +2162,18 @@ void handleRoot()
     html += WiFi.gatewayIP().toString();
     html += "</td></tr><tr><td><br></td></tr>";
     html += "<tr><td>Status połączenia z ATEM:</td><td colspan=\"2\">";
-    if (atemSwitcher.isRejected())
+    if (atemSwitcher->isRejected())
         html += "Połączenie odrzucone - brak wolnego slotu";
-    else if (atemSwitcher.isConnected())
+    else if (atemSwitcher->isConnected() && atemSwitcher->isRelayLooped())
+        html += "Pętla - tally wraca do tego urządzenia lub przez zbyt wiele urządzeń";
+    else if (atemSwitcher->isConnected())
         html += "Połączono"; // - Wating for initialization";
     else if (WiFi.status() == WL_CONNECTED)
         html += "Rozłączono - brak odpowiedzi od ATEM";
     else
         html += "Rozłączono - oczekiwanie na sieć";
     html += "</td></tr><tr><td>Adres IP ATEM:</td><td colspan=\"2\">";
-    if (!settings.whichSwicher)
+    if (activeSwitcher == 0)
     {
         html += (String)settings.switcherIP1[0] + '.' + settings.switcherIP1[1] + '.' + settings.switcherIP1[2] + '.' + settings.switcherIP1[3];
     }
@@ -1342,11 +2181,34 @@ void handleRoot()
     {
         html += (String)settings.switcherIP2[0] + '.' + settings.switcherIP2[1] + '.' + settings.switcherIP2[2] + '.' + settings.switcherIP2[3];
     }
+    html += (String) " (mikser " + (activeSwitcher + 1) + ")";
+    html += "</td></tr><tr><td>Przełączenia awaryjne:</td><td colspan=\"2\">";
+    html += (String)switcherFailovers + ", powroty: " + switcherFailbacks;
+    if (switcherFailovers + switcherFailbacks > 0)
+    {
+        html += (String) " (ostatnie " + ((millis() - lastSwitchoverAt) / 1000) + " s temu)";
+    }
+    html += "</td></tr><tr><td>Ponowne połączenia:</td><td colspan=\"2\">";
+    html += (String)atemSwitcher->getReconnectCount() + ", tally po " + atemSwitcher->getTimeToFirstTally() + " ms";
+    html += "</td></tr><tr><td>Przekazywanie tally:</td><td colspan=\"2\">";
+    if (atemSwitcher->getRelayHops() == 0)
+    {
+        html += "bezpośrednio z miksera";
+    }
+    else
+    {
+        html += "mikser";
+        for (uint8_t hop = 0; hop < atemSwitcher->getRelayHops(); hop++)
+        {
+            html += " &rarr; " + String(atemSwitcher->getRelayID(hop), HEX) + " (" + atemSwitcher->getRelayDelay(hop) + " us)";
+        }
+    }
+    html += (String) " &rarr; to urządzenie (" + tallyServer.getRelayDelay() + " us)";
 
     html += "</td></tr><tr><td><br></td></tr>";
     html += "<tr class=\"s777777\"style=\"color:#ffffff;font-size:.8em;\"><td colspan=\"3\"><h2>&nbsp;Ustawienia:</h2></td></tr><form action=\"/save\"method=\"post\"><tr><td>Nazwa urządzenia: </td><td><input type=\"text\"size=\"34\"maxlength=\"30\"name=\"tName\"value=\"";
     html += WiFi.hostname();
-    html += "\"required/></td></tr><tr><td>Numer kamery: </td><td><input type=\"number\"size=\"5\"min=\"1\"max=\"41\"name=\"tNo\"value=\"";
+    html += (String) "\"required/></td></tr><tr><td>Numer kamery: </td><td><input type=\"number\"size=\"5\"min=\"1\"max=\"" + TALLY_NUMBER_MAX + "\"name=\"tNo\"value=\"";
     html += (settings.tallyNo + 1);
     html += "\"required/></td></tr><tr style=\"display:none;\" class=\"advanced\"><td>Tally Light mode (LED 1):&nbsp;</td><td><select name=\"tModeLED1\"><option value=\"";
     html += (String)MODE_NORMAL + "\"";
@@ -1398,7 +2260,21 @@ void handleRoot()
         html += "selected";
     html += ">Żadna</option></select></td></tr><tr><td> Jasność ledów: </td><td><input type=\"number\"size=\"5\"min=\"0\"max=\"100\"name=\"neoPxBright\"value=\"";
     html += settings.neopixelBrightness;
-    html += "\"required/>%</td></tr><tr><td><br></td></tr><tr><td>Nazwa sieci (SSID): </td><td><input type =\"text\"size=\"34\"maxlength=\"30\"name=\"ssid\"value=\"";
+    html += "\"required/>%</td></tr><tr style=\"display:none;\" class=\"advanced\"><td>Segmenty ledów:</td><td><input type=\"text\"size=\"34\"maxlength=\"160\"name=\"segments\"placeholder=\"1-30:1:1:100;31-60:2:1:100\"title=\"pierwszy-ostatni led:kamera:tryb:jasność %; ...\"value=\"";
+    html += getSegmentsString();
+    html += "\"/></td></tr><tr style=\"display:none;\" class=\"advanced\"><td>Tally w trakcie przejścia:</td><td><select name=\"tTransition\"><option value=\"";
+    html += (String)TALLY_TRANSITION_OFF + "\"";
+    if (settings.tallyTransition != TALLY_TRANSITION_FADE && settings.tallyTransition != TALLY_TRANSITION_SWEEP)
+        html += "selected";
+    html += ">Zmiana na końcu</option><option value=\"";
+    html += (String)TALLY_TRANSITION_FADE + "\"";
+    if (settings.tallyTransition == TALLY_TRANSITION_FADE)
+        html += "selected";
+    html += ">Przenikanie</option><option value=\"";
+    html += (String)TALLY_TRANSITION_SWEEP + "\"";
+    if (settings.tallyTransition == TALLY_TRANSITION_SWEEP)
+        html += "selected";
+    html += ">Przesuwanie</option></select></td></tr><tr><td><br></td></tr><tr><td>Nazwa sieci (SSID): </td><td><input type =\"text\"size=\"34\"maxlength=\"30\"name=\"ssid\"value=\"";
     html += getSSID();
     html += "\"required/></td></tr><tr><td>Hasło do sieci: </td><td><input type=\"password\"size=\"34\"maxlength=\"30\"name=\"pwd\"pattern=\"^$|.{8,32}\"value=\"";
     if (WiFi.isConnected()) // As a minimum security meassure, to only send the wifi password if it's currently connected to the given network.
@@ -1480,6 +2356,22 @@ void handleSave()
     }
     else
     {
+        if (server.args() == 1 && server.argName(0) == "switcher")
+        { // Just a change of switcher (see sendChangeSwichRequest()). Both switchers are connected already, so no restart is needed
+            settings.whichSwicher = (server.arg(0) == "true");
+            EEPROM.put(0, settings);
+            EEPROM.commit();
+            server.send(200, "text/plain", (String) "Preferred switcher: " + (settings.whichSwicher ? 2 : 1));
+            return;
+        }
+
+        // Check the segments first, so segments that don't parse are rejected with every setting left as it was, as the segments command does
+        if (server.hasArg("segments") && !parseSegments(server.arg("segments")))
+        {
+            server.send(400, "text/html", "<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><meta name=\"viewport\"content=\"width=device-width, initial-scale=1.0\"><title>Tally Light</title><style>#staticIP {accent-color: #07b50c;}.s777777 h1,.s777777 h2 {color: #07b50c;}.fr{float: right}body {display: flex;align-items: center;justify-content: center;width: 100vw;overflow-x: hidden;font-family: \"Arial\", sans-serif;background-color: #242424;color: #fff;table {width: 80%;max-width: 1200px;background-color: #3b3b3b;padding: 20px;margin: 20px;border-radius: 10px;box-shadow: 0 0 10px rgba(0, 0, 0, 0.5);border-radius: 12px;overflow: hidden;border-spacing: 0;padding: 5px 45px;box-sizing: border-box;}tr.s777777 {background-color: transparent;color: #07b50c !important;}tr.cccccc {background-color: transparent;} tr.cccccc p {font-size: 16px;}input[type=\"checkbox\"] {width: 17.5px;aspect-ratio: 1;cursor: pointer;}td {cursor: default;user-select: none;}input {border-radius: 6px;cursor: text;}select {border-radius: 6px;cursor: pointer;}td.fr input {background-color: #07b50c !important; -webkit-appearance: none; accent-color: #07b50c !important;color: white;padding: 7px 17px;cursor: pointer;}* {line-height: 1.2;}@media screen and (max-width: 730px) {body {width: 100vw;margin: 0;padding: 10px;}table {width: 100%;padding: 0 10px;margin: 0;}}</style></head><body style=\"font-family:Verdana;\"><table class=\"s777777\"border=\"0\"width=\"100%\"cellpadding=\"1\"style=\"color:#ffffff;font-size:.8em;\"><tr><td><h1>&nbsp;Tally Light</h1></td></tr><tr><td><h2 style=\"color: white\">Nieprawidłowe segmenty ledów, ustawienia nie zostały zapisane</td></tr></table></body></html>");
+            return;
+        }
+
         String ssid;
         String pwd;
         bool change = false;
@@ -1513,6 +2405,14 @@ void handleSave()
             {
                 settings.neopixelStatusLEDOption = val.toInt();
             }
+            else if (var == "tTransition")
+            {
+                settings.tallyTransition = val.toInt();
+            }
+            else if (var == "segments")
+            {
+                // Taken above
+            }
             else if (var == "neoPxBright")
             {
                 settings.neopixelBrightness = val.toInt();
@@ -1667,6 +2567,18 @@ void handleNotFound()
     server.send(404, "text/html", "<!DOCTYPE html><html><head><meta charset=\"ASCII\"><meta name=\"viewport\"content=\"width=device-width, initial-scale=1.0\"><title>" + (String)DISPLAY_NAME + " setup</title></head><body style=\"font-family:Verdana;\"><table bgcolor=\"#777777\"border=\"0\"width=\"100%\"cellpadding=\"1\"style=\"color:#ffffff;font-size:.8em;\"><tr><td><h1>&nbsp Tally Light setup</h1></td></tr></table><br>404 - Page not found</body></html>");
 }
 
+// Send the tally latency histograms as plain text
+void handleLatency()
+{
+    server.send(200, "text/plain", getLatencyReport());
+}
+
+// Send the tally server clients report as plain text
+void handleClients()
+{
+    server.send(200, "text/plain", getClientsReport());
+}
+
 String getSSID()
 {
     return WiFi.SSID();
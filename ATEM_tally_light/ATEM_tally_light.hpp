@@ -39,16 +39,115 @@ void setLED(uint8_t color, int pinRed, int pinGreen, int pinBlue);
 
 void analogWriteWrapper(uint8_t pin, uint8_t value);
 
-//Set the color of the LED strip, except for the status LED
-void setSTRIP(uint8_t color);
+struct CRGB;
+struct LedSegment;
+
+//Place a segment on the strip, its LEDs are written on the next frame
+void beginSegment(LedSegment &segment, uint16_t start, uint16_t length);
+
+//Set the color of a segment, marking it for the next frame if it changed. Returns whether it did
+bool setSegmentColor(LedSegment &segment, const CRGB &color);
+
+struct SegmentSettings;
+
+//Whether a tally segment from the settings is used, lies on the tally LEDs and doesn't overlap a used one before it
+bool segmentFits(const SegmentSettings *segments, uint8_t index, uint16_t tallyLEDs);
+
+//Place the tally segments from the settings on the tally LEDs, which begin at tallyStart on the strip
+void beginTallySegments(uint16_t tallyStart);
+
+//Set the colors of a segment with its first sweep LEDs showing sweepColor, marking it for the next frame if they changed. Returns whether they did
+bool setSegmentSweep(LedSegment &segment, const CRGB &color, const CRGB &sweepColor, uint16_t sweep);
+
+//Set every tally segment to the color of its tally number in its mode, or to where it is in a transition. Returns whether any of them changed
+bool setTallySegments();
+
+//Where the transition is now (0-9999): the last position from the switcher, moved on at the rate it last moved
+uint16_t getTransitionPosition();
+
+//Whether a tally segment shows the tally of a tally number
+bool tallyShown(uint16_t tallyIndex);
+
+//Whether a tally segment shows the streaming status
+bool onAirShown();
+
+//Set the tally segments from text like "1-30:1:1:100;31-60:2". Returns false, changing nothing, if it doesn't parse
+bool parseSegments(const String &spec);
+
+//The tally segments as "first-last:camera:mode:brightness" for each, separated by ';'
+String getSegmentsString();
+
+//Set the color of the LED strip, except for the status LED. Returns whether it changed
+bool setSTRIP(uint8_t color);
 
 //Set the single status LED (last LED)
 void setStatusLED(uint8_t color);
 
+//Write the segments that changed color into leds
+void renderLEDs();
+
 #ifdef DEBUG_LED_STRIP
 void printLeds();
 #endif
 
+//Set up the connections to both switchers
+void beginSwitchers();
+
+//Handle data exchange with both switchers
+void runSwitchers();
+
+//Whether a switcher (0 or 1) is used
+bool switcherConfigured(uint8_t switcher);
+
+//Whether the tally can be taken from a switcher (0 or 1): connected, and not relayed around a loop
+bool switcherUsable(uint8_t switcher);
+//Pick the switcher to take the tally from, returns true if it changed
+bool selectSwitcher();
+
+//Copy the whole tally of the active switcher to the tally server and LEDs
+void syncTally();
+//Pass the relays the tally came through on to the tally server
+void syncRelayPath();
+void syncTallySubscription();
+
+//Change notifications from switcher 1 and 2, passed on for the active switcher only
+template <uint8_t switcher>
+void switcherTallyChanged(uint16_t tallyIndex, uint8_t previousTallyFlags, uint8_t tallyFlags);
+template <uint8_t switcher>
+void switcherTallySourcesChanged(uint16_t sources);
+template <uint8_t switcher>
+void switcherTallyBySourceChanged(uint16_t videoSource, uint8_t previousTallyFlags, uint8_t tallyFlags);
+template <uint8_t switcher>
+void switcherStreamingStatusChanged(uint16_t streamingStatusFlags);
+template <uint8_t switcher>
+void switcherTransitionChanged(uint8_t mE, bool inTransition, uint8_t framesRemaining, uint16_t position);
+
+//Called by the ATEM library when the tally changes
+void tallyChanged(uint16_t tallyIndex, uint8_t previousTallyFlags, uint8_t tallyFlags);
+void tallySourcesChanged(uint16_t sources);
+void streamingStatusChanged(uint16_t streamingStatusFlags);
+void transitionChanged(uint8_t mE, bool inTransition, uint8_t framesRemaining, uint16_t position);
+
+//A change for this tally light has been received, start measuring its latency
+void tallyReceived();
+
+struct LatencyHistogram;
+
+//Add a latency (us) to a histogram
+void recordLatency(LatencyHistogram &histogram, unsigned long latency);
+
+//Render and send the LED frame to the strip if a segment changed color, timing how long that holds loop() up. Returns whether it was sent
+bool showLEDs();
+
+//Clear all latency histograms
+void resetLatency();
+
+//Latency histograms as plain text, for the serial CLI and /latency
+String getLatencyReport();
+
+//The tally lights connected to the tally server as plain text, for the serial CLI and /clients
+String getClientsReport();
+
 int getTallyState(uint16_t tallyNo);
 
 int getLedColor(int tallyMode, int tallyNo);
@@ -62,6 +161,12 @@ void handleSave();
 //Send 404 to client in case of invalid webpage being requested.
 void handleNotFound();
 
+//Send the tally latency histograms as plain text
+void handleLatency();
+
+//Send the round trip time, loss and resends of each tally server client as plain text
+void handleClients();
+
 String getSSID();
 
 void setWiFi(String ssid, String pwd);
@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+"""
+Generate the ATEM traffic captures used by the replay benchmark.
+
+The captures are synthesized to follow the layout of what a 2 M/E switcher sends a
+client: command names, command sizes and the way commands are packed into datagrams
+match the ATEM protocol, while the payload values are made up. A capture is the
+datagrams back to back, exactly as they arrive from the switcher.
+
+Usage: make_captures.py [output directory]
+"""
+
+import os
+import random
+import struct
+import sys
+
+FLAG_ACK_REQUEST = 0x01
+FLAG_HELLO = 0x02
+
+MAX_DATAGRAM = 1420     # The switcher keeps datagrams below the ethernet MTU
+SESSION_ID = 0x8123
+
+VIDEO_SOURCES = [0] + list(range(1, 21)) + [1000, 2001, 2002, 3010, 3011, 3020, 3021, 4010, 4020, 4030, 4040,
+                                            5010, 5020, 6000, 7001, 7002, 8001, 8002, 8003, 8004, 8005, 8006,
+                                            10010, 10011, 10020, 10021]
+TALLY_SOURCES = 20      # TlIn covers the external inputs
+AUDIO_INPUTS = 24
+
+
+class Capture:
+    def __init__(self):
+        self.data = bytearray()
+        self.packet_id = 0
+
+    def _header(self, flags, length, packet_id):
+        return struct.pack(">BBHHHHH", (flags << 3) | ((length >> 8) & 0x07), length & 0xff,
+                           SESSION_ID, 0, 0, 0, packet_id)
+
+    def hello(self):
+        payload = bytes([2, 0, 0, 0, 0, 0, 0, 0])
+        self.data += struct.pack(">BBHHHHH", (FLAG_HELLO << 3), 20, 0x53AB, 0, 0, 0, 0) + payload
+
+    def empty(self):
+        """12 byte packet, which tells the client the initial payload is done"""
+        self.packet_id += 1
+        self.data += self._header(FLAG_ACK_REQUEST, 12, self.packet_id)
+
+    def commands(self, commands):
+        """Pack the commands into as few datagrams as possible"""
+        datagram = bytearray()
+        for command in commands:
+            if datagram and 12 + len(datagram) + len(command) > MAX_DATAGRAM:
+                self._datagram(datagram)
+                datagram = bytearray()
+            datagram += command
+        if datagram:
+            self._datagram(datagram)
+
+    def _datagram(self, payload):
+        self.packet_id += 1
+        self.data += self._header(FLAG_ACK_REQUEST, 12 + len(payload), self.packet_id) + payload
+
+    def write(self, path):
+        with open(path, "wb") as f:
+            f.write(self.data)
+
+
+def cmd(name, payload=b"", length=None):
+    """A command: 2 byte length, 2 unknown bytes, 4 char name and the payload, padded to length"""
+    payload = bytes(payload)
+    if length is None:
+        length = 8 + len(payload)
+        length += -length % 4
+    payload = payload.ljust(length - 8, b"\0")
+    return struct.pack(">HH4s", length, 0, name.encode()) + payload
+
+
+def filler(rng, name, length):
+    return cmd(name, bytes(rng.randrange(256) for _ in range(length - 8)), length)
+
+
+def tally_flags(program, preview):
+    flags = []
+    for index in range(TALLY_SOURCES):
+        flags.append((1 if index == program else 0) | (2 if index == preview else 0))
+    return flags
+
+
+def tlin(flags):
+    return cmd("TlIn", struct.pack(">H", len(flags)) + bytes(flags))
+
+
+def tlsr(flags):
+    payload = struct.pack(">H", len(VIDEO_SOURCES))
+    for index, source in enumerate(VIDEO_SOURCES):
+        payload += struct.pack(">HB", source, flags[index] if index < len(flags) else 0)
+    return cmd("TlSr", payload)
+
+
+def init_dump(rng, stills=32, cameras=80):
+    c = []
+    c.append(cmd("_ver", struct.pack(">HH", 2, 30)))
+    c.append(cmd("_pin", b"ATEM 2 M/E Production Switcher", 52))
+    c.append(filler(rng, "_top", 36))
+    c.append(filler(rng, "_MeC", 12))
+    c.append(filler(rng, "_MeC", 12))
+    for name, length in (("_mpl", 12), ("_MvC", 12), ("_SSC", 12), ("_TlC", 16), ("_AMC", 12), ("_VMC", 20),
+                         ("_MAC", 12), ("Powr", 12), ("VidM", 12), ("TcLk", 12)):
+        c.append(filler(rng, name, length))
+
+    for source in VIDEO_SOURCES:
+        c.append(cmd("InPr", struct.pack(">H", source) + ("Input %d" % source).encode().ljust(20, b"\0") +
+                     b"In%d" % (source % 100), 44))
+    for multiviewer in range(2):
+        c.append(filler(rng, "MvPr", 12))
+        for window in range(10):
+            c.append(cmd("MvIn", struct.pack(">BBH", multiviewer, window, VIDEO_SOURCES[window + 1])))
+
+    for me in range(2):
+        c.append(cmd("PrgI", struct.pack(">BxH", me, 1 + me)))
+        c.append(cmd("PrvI", struct.pack(">BxH", me, 2 + me)))
+        c.append(filler(rng, "TrSS", 20))
+        c.append(filler(rng, "TrPr", 12))
+        c.append(cmd("TrPs", struct.pack(">BBBxH", me, 0, 25, 0), 16))
+        for name, length in (("TMxP", 12), ("TDpP", 12), ("TWpP", 28), ("TDvP", 28), ("TStP", 32)):
+            c.append(filler(rng, name, length))
+        for keyer in range(4):
+            c.append(cmd("KeOn", struct.pack(">BBB", me, keyer, 0)))
+            for name, length in (("KeBP", 28), ("KeLm", 20), ("KeCk", 20), ("KePt", 32), ("KeDV", 72),
+                                 ("KeFS", 20)):
+                c.append(filler(rng, name, length))
+        c.append(filler(rng, "FtbP", 12))
+        c.append(cmd("FtbS", struct.pack(">BBBB", me, 0, 0, 25)))
+
+    for keyer in range(2):
+        c.append(filler(rng, "DskB", 12))
+        c.append(filler(rng, "DskP", 28))
+        c.append(cmd("DskS", struct.pack(">BBBBB", keyer, 0, 0, 0, 25)))
+
+    for generator in range(2):
+        c.append(filler(rng, "ColV", 16))
+    for channel in range(6):
+        c.append(cmd("AuxS", struct.pack(">BxH", channel, VIDEO_SOURCES[channel + 1])))
+    for player in range(2):
+        c.append(filler(rng, "MPCE", 12))
+    c.append(filler(rng, "MPSp", 12))
+    for still in range(stills):
+        c.append(filler(rng, "MPfe", 56))
+
+    for source in range(AUDIO_INPUTS):
+        c.append(filler(rng, "AMIP", 32))
+    c.append(filler(rng, "AMMO", 16))
+    c.append(filler(rng, "AMmO", 12))
+    for camera in range(cameras):
+        c.append(filler(rng, "CCdP", 32))
+
+    flags = tally_flags(1, 2)
+    c.append(tlin(flags))
+    c.append(tlsr(flags))
+    c.append(cmd("StRS", struct.pack(">H", 1)))
+    c.append(filler(rng, "Time", 20))
+    c.append(cmd("InCm", b"\x01\x00"))
+    return c
+
+
+def cut(program, preview):
+    flags = tally_flags(program, preview)
+    return [cmd("PrvI", struct.pack(">BxH", 0, preview)), cmd("PrgI", struct.pack(">BxH", 0, program)),
+            tlin(flags), tlsr(flags)]
+
+
+def steady_cuts(capture, rng):
+    """Operator cutting between cameras, with the switcher's keep alive packets in between"""
+    program, preview = 1, 2
+    for i in range(200):
+        program, preview = preview, 1 + rng.randrange(8)
+        capture.commands(cut(program, preview))
+        if i % 4 == 3:
+            capture.empty()
+
+
+def auto_transitions(capture, rng):
+    """Auto transitions (mix, 25 frames): a TrPs for every frame, tally changing at start and end"""
+    program, preview = 1, 2
+    frames = 25
+    for i in range(40):
+        capture.commands([cmd("TrPs", struct.pack(">BBBxH", 0, 1, frames, 0), 16),
+                          tlin(tally_flags(program, preview)[:preview] + [3] + tally_flags(program, preview)[preview + 1:])])
+        for frame in range(1, frames):
+            capture.commands([cmd("TrPs", struct.pack(">BBBxH", 0, 1, frames - frame, frame * 10000 // frames), 16)])
+        program, preview = preview, 1 + rng.randrange(8)
+        capture.commands([cmd("TrPs", struct.pack(">BBBxH", 0, 0, frames, 0), 16)] + cut(program, preview))
+        capture.empty()
+
+
+def audio_levels(capture, rng):
+    """Audio level updates, which the switcher sends continuously once a client has asked for them"""
+    for i in range(200):
+        payload = struct.pack(">HH", AUDIO_INPUTS, 0)
+        payload += bytes(rng.randrange(256) for _ in range(16))                    # Master levels and peaks
+        payload += bytes(rng.randrange(256) for _ in range(16))                    # Monitor levels and peaks
+        payload += b"".join(struct.pack(">H", source) for source in range(1, AUDIO_INPUTS + 1))
+        payload += bytes(rng.randrange(256) for _ in range(16 * AUDIO_INPUTS))     # Levels and peaks per input
+        capture.commands([cmd("AMLv", payload)])
+        if i % 10 == 9:
+            capture.empty()
+
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    rng = random.Random(9910)
+
+    capture = Capture()
+    capture.hello()
+    capture.commands(init_dump(rng))
+    capture.empty()
+    capture.write(os.path.join(out, "init_dump.atem"))
+
+    for name, generate in (("steady_cuts", steady_cuts), ("auto_transitions", auto_transitions),
+                           ("audio_levels", audio_levels)):
+        capture = Capture()
+        capture.packet_id = 100     # Continuing a session
+        generate(capture, rng)
+        capture.write(os.path.join(out, name + ".atem"))
+
+    # A big installation: full media pool and camera control for many cameras, which
+    # takes the dump well past what fits in a few dozen datagrams
+    capture = Capture()
+    capture.hello()
+    capture.commands(init_dump(rng, stills=1000, cameras=2400))
+    capture.empty()
+    capture.write(os.path.join(out, "large_init_dump.atem"))
+
+
+if __name__ == "__main__":
+    main()
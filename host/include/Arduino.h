@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Minimal stand-in for the Arduino core, so ATEMbase, ATEMmin and TallyServer
+    compile as a normal host library. Only what those libraries use is provided.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define B1 1
+#define B00000111 7
+
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+
+inline uint16_t word(uint8_t h, uint8_t l) { return (h << 8) | l; }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// There is no separate flash address space on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define strlen_P(s) strlen((s))
+#define strcmp_P(a, b) strcmp((a), (b))
+#define strncmp_P(a, b, n) strncmp((a), (b), (n))
+#define strncpy_P(dest, src, n) strncpy((dest), (src), (n))
+#define pgm_read_byte_near(a) (*(const uint8_t *)(a))
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+
+#include "IPAddress.h"
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    size_t print(const char *str);
+    size_t print(const __FlashStringHelper *str);
+    size_t print(char c);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+    size_t print(const IPAddress &ip);
+
+    size_t println();
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+
+private:
+    size_t _printNumber(unsigned long n, int base);
+};
+
+// Serial output goes to stdout
+class HostSerial : public Print {
+public:
+    void begin(unsigned long baud) { (void)baud; }
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    int available() { return 0; }
+    void flush();
+};
+
+extern HostSerial Serial;
+
+#endif
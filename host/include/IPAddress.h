@@ -0,0 +1,55 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include <stdint.h>
+
+/**
+ * IPv4 address, stored in network byte order like the Arduino core's IPAddress
+ */
+class IPAddress {
+private:
+    union {
+        uint8_t bytes[4];
+        uint32_t dword;
+    } _address;
+
+public:
+    IPAddress() { _address.dword = 0; }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        _address.bytes[0] = a;
+        _address.bytes[1] = b;
+        _address.bytes[2] = c;
+        _address.bytes[3] = d;
+    }
+    IPAddress(uint32_t address) { _address.dword = address; }
+
+    bool fromString(const char *address);
+
+    operator uint32_t() const { return _address.dword; }
+    bool operator==(const IPAddress &addr) const { return _address.dword == addr._address.dword; }
+    bool operator!=(const IPAddress &addr) const { return _address.dword != addr._address.dword; }
+
+    uint8_t operator[](int index) const { return _address.bytes[index]; }
+    uint8_t &operator[](int index) { return _address.bytes[index]; }
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PosixUdp_h
+#define PosixUdp_h
+
+#include "Udp.h"
+
+#define POSIX_UDP_MAX_DATAGRAM 2048    // ATEM packet length is 11 bits
+
+/**
+ * UDP transport on a non-blocking BSD socket, behaving like WiFiUDP:
+ * parsePacket() pulls one datagram into an internal buffer which read() then consumes.
+ */
+class PosixUDP : public UDP {
+private:
+    int _fd;
+
+    uint8_t _rxBuffer[POSIX_UDP_MAX_DATAGRAM];
+    uint16_t _rxLength;
+    uint16_t _rxPointer;
+    IPAddress _remoteIP;
+    uint16_t _remotePort;
+
+    uint8_t _txBuffer[POSIX_UDP_MAX_DATAGRAM];
+    uint16_t _txLength;
+    IPAddress _txIP;
+    uint16_t _txPort;
+
+public:
+    PosixUDP();
+    ~PosixUDP();
+
+    // A socket is never shared: assigning leaves this object closed, like a fresh WiFiUDP
+    PosixUDP(const PosixUDP &other);
+    PosixUDP &operator=(const PosixUDP &other);
+
+    uint8_t begin(uint16_t port);
+    uint8_t beginMulticast(IPAddress ip, uint16_t port);
+    void stop();
+
+    int beginPacket(IPAddress ip, uint16_t port);
+    int endPacket();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    int parsePacket();
+    int available();
+    int read();
+    int read(unsigned char *buffer, size_t len);
+    using UDP::read;
+    void flush();
+
+    IPAddress remoteIP();
+    uint16_t remotePort();
+
+    int fd();
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef QueueUdp_h
+#define QueueUdp_h
+
+#include "Udp.h"
+
+#define QUEUE_UDP_CAPACITY 4096         // Datagrams that can be queued at once
+#define QUEUE_UDP_DATAGRAM_LENGTH 20    // Longest datagram queued, a hello packet
+#define QUEUE_UDP_SENT_LENGTH 32        // Bytes kept of the last datagram sent
+
+/**
+ * UDP transport that hands the program using it datagrams it queued, e.g. to drive a TallyServer
+ * without sockets. Everything written is counted and dropped, except the start of the last datagram.
+ * Nothing is allocated after construction.
+ */
+class QueueUDP : public UDP {
+private:
+    struct Datagram {
+        IPAddress ip;
+        uint16_t port;
+        uint8_t data[QUEUE_UDP_DATAGRAM_LENGTH];
+        uint16_t length;
+    };
+
+    Datagram _queue[QUEUE_UDP_CAPACITY];
+    uint16_t _queued;
+    uint16_t _next;
+    uint16_t _pointer;
+    Datagram *_current;
+
+    uint16_t _sentLength;
+
+public:
+    unsigned long packetsSent;
+    uint8_t lastSent[QUEUE_UDP_SENT_LENGTH];
+
+    QueueUDP();
+
+    bool queue(IPAddress ip, uint16_t port, uint8_t flags, uint16_t length, uint16_t ackID, uint16_t packetID);
+    uint16_t queued();
+
+    uint8_t begin(uint16_t port);
+    void stop();
+
+    int beginPacket(IPAddress ip, uint16_t port);
+    int endPacket();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    int parsePacket();
+    int available();
+    int read();
+    int read(unsigned char *buffer, size_t len);
+    using UDP::read;
+    void flush();
+
+    IPAddress remoteIP();
+    uint16_t remotePort();
+};
+
+#endif
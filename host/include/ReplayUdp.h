@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ReplayUdp_h
+#define ReplayUdp_h
+
+#include "Udp.h"
+
+#define REPLAY_UDP_MAX_PENDING_RESENDS 64
+
+/**
+ * UDP transport that plays back a recorded sequence of ATEM datagrams from memory.
+ *
+ * A capture is the datagrams back to back, exactly as received from the switcher.
+ * No framing is needed, as every ATEM header carries the length of its datagram.
+ * Everything written is counted and dropped, except resend requests: like a switcher,
+ * the requested packet is played again, after the configured resend delay.
+ */
+class ReplayUDP : public UDP {
+private:
+    struct PendingResend {
+        const uint8_t *packet;
+        unsigned long due;
+    };
+
+    const uint8_t *_capture;
+    size_t _captureLength;
+    size_t _capturePointer;
+
+    const uint8_t *_packet;
+    uint16_t _packetLength;
+    uint16_t _packetPointer;
+
+    IPAddress _remoteIP;
+    unsigned long _packetsSent;
+
+    uint8_t _lossPercent;
+    unsigned long _resendDelay;
+    uint8_t _sentHeader[12];
+    uint8_t _sentHeaderLength;
+    unsigned long _packetsLost;
+    unsigned long _resendRequests;
+    unsigned long _packetsResent;
+    PendingResend _pendingResends[REPLAY_UDP_MAX_PENDING_RESENDS];
+    uint8_t _pendingResendCount;
+
+    const uint8_t *_findPacket(uint16_t packetID);
+    void _servePacket(const uint8_t *packet);
+
+public:
+    ReplayUDP();
+
+    void setCapture(const uint8_t *capture, size_t length);
+    void rewind();
+    bool atEnd();
+
+    unsigned long packetsSent();
+
+    void setLoss(uint8_t percent);
+    void setResendDelay(unsigned long ms);
+    unsigned long packetsLost();
+    unsigned long resendRequests();
+    unsigned long packetsResent();
+
+    uint8_t begin(uint16_t port);
+    void stop();
+
+    int beginPacket(IPAddress ip, uint16_t port);
+    int endPacket();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    int parsePacket();
+    int available();
+    int read();
+    int read(unsigned char *buffer, size_t len);
+    using UDP::read;
+    void flush();
+
+    IPAddress remoteIP();
+    uint16_t remotePort();
+};
+
+/**
+ * Helpers for capture files
+ */
+uint8_t *loadCapture(const char *path, size_t *length);
+unsigned long countCapturePackets(const uint8_t *capture, size_t length);
+unsigned long countCaptureCommands(const uint8_t *capture, size_t length);
+
+#endif
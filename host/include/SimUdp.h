@@ -0,0 +1,121 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SimUdp_h
+#define SimUdp_h
+
+#include <deque>
+#include <vector>
+
+#include "Udp.h"
+
+#define SIM_UDP_MAX_DATAGRAM 2048
+
+class SimUDP;
+
+/**
+ * In-memory network of SimUDP endpoints, each with an IP address of its own, so many tally
+ * lights and tally servers can run in one process. Every datagram takes the same one-way
+ * latency to arrive, plus that of the links of its sender and receiver set with setLink(), which
+ * may also lose some. Datagrams to an address and port no endpoint has are dropped.
+ */
+class SimNetwork {
+private:
+    struct Link {
+        IPAddress ip;
+        unsigned long latency;  // us, added to every datagram from and to ip
+        uint8_t loss;           // percent of datagrams from and to ip that get lost
+    };
+
+    std::vector<SimUDP *> _endpoints;
+    std::vector<Link> _links;
+    unsigned long _latency;
+    unsigned long _datagrams;
+    unsigned long _lost;
+    uint32_t _random;
+
+    bool _crossLink(IPAddress ip, unsigned long *latency);
+
+public:
+    SimNetwork();
+
+    void setLatency(unsigned long us);
+    void setLink(IPAddress ip, unsigned long latency, uint8_t loss);
+    unsigned long datagrams();
+    unsigned long lost();
+
+    void attach(SimUDP *endpoint);
+    void detach(SimUDP *endpoint);
+    void send(IPAddress fromIP, uint16_t fromPort, IPAddress toIP, uint16_t toPort, const uint8_t *data, uint16_t length);
+};
+
+/**
+ * UDP transport on a SimNetwork, with the given address
+ */
+class SimUDP : public UDP {
+private:
+    struct Datagram {
+        unsigned long due;  // micros() it arrives
+        IPAddress ip;
+        uint16_t port;
+        std::vector<uint8_t> data;
+    };
+
+    SimNetwork *_network;
+    IPAddress _ip;
+    uint16_t _port;     // 0 when not begun
+
+    std::deque<Datagram> _received;
+    Datagram _current;
+    bool _hasCurrent;
+    uint16_t _pointer;
+
+    IPAddress _sendIP;
+    uint16_t _sendPort;
+    uint8_t _sendBuffer[SIM_UDP_MAX_DATAGRAM];
+    uint16_t _sendLength;
+
+public:
+    SimUDP(SimNetwork *network, IPAddress ip);
+    ~SimUDP();
+
+    IPAddress localIP();
+    uint16_t localPort();
+    void receive(IPAddress fromIP, uint16_t fromPort, const uint8_t *data, uint16_t length, unsigned long due);
+
+    uint8_t begin(uint16_t port);
+    void stop();
+
+    int beginPacket(IPAddress ip, uint16_t port);
+    int endPacket();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    int parsePacket();
+    int available();
+    int read();
+    int read(unsigned char *buffer, size_t len);
+    using UDP::read;
+    void flush();
+
+    IPAddress remoteIP();
+    uint16_t remotePort();
+};
+
+#endif
@@ -0,0 +1,54 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef udp_h
+#define udp_h
+
+#include "Arduino.h"
+
+/**
+ * The transport interface the libraries talk to. On the boards this is the Arduino
+ * core's UDP class (which WiFiUDP and EthernetUDP derive from); the host build
+ * declares the same subset of it here.
+ */
+class UDP {
+public:
+    virtual ~UDP() {}
+
+    virtual uint8_t begin(uint16_t port) = 0;
+    virtual uint8_t beginMulticast(IPAddress ip, uint16_t port) { (void)ip; (void)port; return 0; }
+    virtual void stop() = 0;
+
+    virtual int beginPacket(IPAddress ip, uint16_t port) = 0;
+    virtual int endPacket() = 0;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+
+    virtual int parsePacket() = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int read(unsigned char *buffer, size_t len) = 0;
+    virtual int read(char *buffer, size_t len) { return read((unsigned char *)buffer, len); }
+    virtual void flush() = 0;
+
+    virtual IPAddress remoteIP() = 0;
+    virtual uint16_t remotePort() = 0;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+
+#include <stdio.h>
+#include <time.h>
+
+HostSerial Serial;
+
+static uint64_t _monotonicMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Like on the boards, time starts counting when the program starts
+static const uint64_t _startMicros = _monotonicMicros();
+
+unsigned long millis() {
+    return (unsigned long)((_monotonicMicros() - _startMicros) / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)(_monotonicMicros() - _startMicros);
+}
+
+void delay(unsigned long ms) {
+    timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+long random(long howbig) {
+    if (howbig <= 0) return 0;
+    return ::random() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) return howsmall;
+    return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed) {
+    srandom(seed);
+}
+
+/**************
+ *
+ * Print
+ *
+ **************/
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+}
+
+size_t Print::print(const char *str) {
+    return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::print(const __FlashStringHelper *str) {
+    return print(reinterpret_cast<const char *>(str));
+}
+
+size_t Print::print(char c) {
+    return write((uint8_t)c);
+}
+
+size_t Print::print(int n, int base) {
+    return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base) {
+    if (base == DEC && n < 0) {
+        return print('-') + _printNumber(-(unsigned long)n, base);
+    }
+    return _printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    return _printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return print(buf);
+}
+
+size_t Print::print(const IPAddress &ip) {
+    size_t n = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i) n += print('.');
+        n += print((unsigned int)ip[i]);
+    }
+    return n;
+}
+
+size_t Print::println() {
+    return print('\n');
+}
+
+size_t Print::_printNumber(unsigned long n, int base) {
+    char buf[8 * sizeof(long) + 1];
+    char *str = &buf[sizeof(buf) - 1];
+    *str = '\0';
+
+    if (base < 2) base = DEC;
+    do {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+
+    return print(str);
+}
+
+size_t HostSerial::write(uint8_t c) {
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size) {
+    return fwrite(buffer, 1, size, stdout);
+}
+
+void HostSerial::flush() {
+    fflush(stdout);
+}
+
+/**************
+ *
+ * IPAddress
+ *
+ **************/
+
+/**
+ * Parse a dotted quad like "192.168.10.240". Returns false if it isn't one.
+ */
+bool IPAddress::fromString(const char *address) {
+    uint8_t parsed[4];
+    int octet = 0;
+    int value = -1;
+
+    for (const char *c = address; ; c++) {
+        if (*c >= '0' && *c <= '9') {
+            value = (value < 0 ? 0 : value * 10) + (*c - '0');
+            if (value > 255) return false;
+        } else if (*c == '.' || *c == '\0') {
+            if (value < 0 || octet > 3) return false;
+            parsed[octet++] = value;
+            value = -1;
+            if (*c == '\0') break;
+        } else {
+            return false;
+        }
+    }
+
+    if (octet != 4) return false;
+    for (int i = 0; i < 4; i++) _address.bytes[i] = parsed[i];
+    return true;
+}
@@ -0,0 +1,184 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "PosixUdp.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+PosixUDP::PosixUDP() : _fd(-1), _rxLength(0), _rxPointer(0), _remotePort(0), _txLength(0), _txPort(0) { }
+
+PosixUDP::PosixUDP(const PosixUDP &other) : PosixUDP() {
+    (void)other;
+}
+
+PosixUDP::~PosixUDP() {
+    stop();
+}
+
+PosixUDP &PosixUDP::operator=(const PosixUDP &other) {
+    if (this != &other) stop();
+    return *this;
+}
+
+/**
+ * Open a non-blocking socket bound to the given local port. Returns 1 on success.
+ */
+uint8_t PosixUDP::begin(uint16_t port) {
+    stop();
+
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0) return 0;
+
+    int on = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));   // Also lets several sockets get the same multicasts and broadcasts
+    setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(_fd, (sockaddr *)&addr, sizeof(addr)) < 0 || fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK) < 0) {
+        stop();
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Open a socket bound to the given local port, and join the multicast group ip on it. Returns 1 on success.
+ */
+uint8_t PosixUDP::beginMulticast(IPAddress ip, uint16_t port) {
+    if (!begin(port)) return 0;
+
+    ip_mreq group;
+    group.imr_multiaddr.s_addr = (uint32_t)ip;     // Already in network byte order
+    group.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+void PosixUDP::stop() {
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+    _rxLength = _rxPointer = 0;
+    _txLength = 0;
+}
+
+int PosixUDP::beginPacket(IPAddress ip, uint16_t port) {
+    _txIP = ip;
+    _txPort = port;
+    _txLength = 0;
+    return 1;
+}
+
+size_t PosixUDP::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t PosixUDP::write(const uint8_t *buffer, size_t size) {
+    if (size > (size_t)(POSIX_UDP_MAX_DATAGRAM - _txLength)) size = POSIX_UDP_MAX_DATAGRAM - _txLength;
+    memcpy(_txBuffer + _txLength, buffer, size);
+    _txLength += size;
+    return size;
+}
+
+/**
+ * Send what has been written since beginPacket() as one datagram. Returns 1 on success.
+ */
+int PosixUDP::endPacket() {
+    if (_fd < 0) return 0;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = (uint32_t)_txIP;    // Already in network byte order
+    addr.sin_port = htons(_txPort);
+
+    ssize_t sent = sendto(_fd, _txBuffer, _txLength, 0, (sockaddr *)&addr, sizeof(addr));
+    _txLength = 0;
+    return sent >= 0 ? 1 : 0;
+}
+
+/**
+ * Receive the next datagram, discarding whatever was left of the previous one.
+ * Returns its size, or 0 if nothing is waiting.
+ */
+int PosixUDP::parsePacket() {
+    _rxLength = _rxPointer = 0;
+    if (_fd < 0) return 0;
+
+    sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    ssize_t received = recvfrom(_fd, _rxBuffer, POSIX_UDP_MAX_DATAGRAM, 0, (sockaddr *)&addr, &addrLen);
+    if (received <= 0) return 0;
+
+    _rxLength = received;
+    _remoteIP = IPAddress((uint32_t)addr.sin_addr.s_addr);
+    _remotePort = ntohs(addr.sin_port);
+    return _rxLength;
+}
+
+int PosixUDP::available() {
+    return _rxLength - _rxPointer;
+}
+
+int PosixUDP::read() {
+    if (_rxPointer >= _rxLength) return -1;
+    return _rxBuffer[_rxPointer++];
+}
+
+int PosixUDP::read(unsigned char *buffer, size_t len) {
+    size_t remaining = _rxLength - _rxPointer;
+    if (len > remaining) len = remaining;
+    memcpy(buffer, _rxBuffer + _rxPointer, len);
+    _rxPointer += len;
+    return len;
+}
+
+/**
+ * Discard the rest of the current datagram
+ */
+void PosixUDP::flush() {
+    _rxPointer = _rxLength;
+}
+
+IPAddress PosixUDP::remoteIP() {
+    return _remoteIP;
+}
+
+uint16_t PosixUDP::remotePort() {
+    return _remotePort;
+}
+
+/**
+ * The underlying socket, for callers that want to poll() on it. -1 if not open.
+ */
+int PosixUDP::fd() {
+    return _fd;
+}
@@ -0,0 +1,127 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "QueueUdp.h"
+
+QueueUDP::QueueUDP() : _queued(0), _next(0), _pointer(0), _current(NULL), _sentLength(0), packetsSent(0) {
+    memset(lastSent, 0, sizeof(lastSent));
+}
+
+/**
+ * Queue a datagram with an ATEM header, as if it came from ip and port. The session ID is the one
+ * ATEMbase starts with. Returns false if the queue is full, or length doesn't fit.
+ */
+bool QueueUDP::queue(IPAddress ip, uint16_t port, uint8_t flags, uint16_t length, uint16_t ackID, uint16_t packetID) {
+    if (_queued >= QUEUE_UDP_CAPACITY || length < 12 || length > QUEUE_UDP_DATAGRAM_LENGTH) return false;
+
+    Datagram *datagram = &_queue[_queued++];
+    memset(datagram->data, 0, sizeof(datagram->data));
+    datagram->ip = ip;
+    datagram->port = port;
+    datagram->data[0] = flags | (length >> 8);
+    datagram->data[1] = length;
+    datagram->data[2] = 0x53;
+    datagram->data[3] = 0xAB;
+    datagram->data[4] = ackID >> 8;
+    datagram->data[5] = ackID;
+    datagram->data[10] = packetID >> 8;
+    datagram->data[11] = packetID;
+    datagram->length = length;
+    return true;
+}
+
+/**
+ * Number of datagrams queued that weren't handed out yet
+ */
+uint16_t QueueUDP::queued() {
+    return _queued - _next;
+}
+
+uint8_t QueueUDP::begin(uint16_t port) {
+    (void)port;
+    return 1;
+}
+
+void QueueUDP::stop() { }
+
+int QueueUDP::beginPacket(IPAddress ip, uint16_t port) {
+    (void)ip;
+    (void)port;
+    _sentLength = 0;
+    return 1;
+}
+
+int QueueUDP::endPacket() {
+    packetsSent++;
+    return 1;
+}
+
+size_t QueueUDP::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t QueueUDP::write(const uint8_t *buffer, size_t size) {
+    if (_sentLength < QUEUE_UDP_SENT_LENGTH) {
+        size_t kept = size < (size_t)(QUEUE_UDP_SENT_LENGTH - _sentLength) ? size : QUEUE_UDP_SENT_LENGTH - _sentLength;
+        memcpy(lastSent + _sentLength, buffer, kept);
+        _sentLength += kept;
+    }
+    return size;
+}
+
+/**
+ * Hand out the next datagram queued. When all were, the queue is emptied and 0 returned.
+ */
+int QueueUDP::parsePacket() {
+    if (_next >= _queued) {
+        _queued = _next = 0;
+        _current = NULL;
+        return 0;
+    }
+    _current = &_queue[_next++];
+    _pointer = 0;
+    return _current->length;
+}
+
+int QueueUDP::available() {
+    return _current ? _current->length - _pointer : 0;
+}
+
+int QueueUDP::read() {
+    return available() ? _current->data[_pointer++] : -1;
+}
+
+int QueueUDP::read(unsigned char *buffer, size_t len) {
+    if (len > (size_t)available()) len = available();
+    if (len) memcpy(buffer, _current->data + _pointer, len);
+    _pointer += len;
+    return len;
+}
+
+void QueueUDP::flush() {
+    if (_current) _pointer = _current->length;
+}
+
+IPAddress QueueUDP::remoteIP() {
+    return _current->ip;
+}
+
+uint16_t QueueUDP::remotePort() {
+    return _current->port;
+}
@@ -0,0 +1,264 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ReplayUdp.h"
+
+#include <stdio.h>
+
+// Length of an ATEM datagram, from its header
+static uint16_t _datagramLength(const uint8_t *header) {
+    return ((header[0] & 0x07) << 8) | header[1];
+}
+
+ReplayUDP::ReplayUDP() : _capture(NULL), _captureLength(0), _capturePointer(0), _packet(NULL), _packetLength(0), _packetPointer(0), _remoteIP(127, 0, 0, 1), _packetsSent(0),
+    _lossPercent(0), _resendDelay(0), _sentHeaderLength(0), _packetsLost(0), _resendRequests(0), _packetsResent(0), _pendingResendCount(0) { }
+
+/**
+ * Set the capture to play back. The data is not copied and must stay valid.
+ */
+void ReplayUDP::setCapture(const uint8_t *capture, size_t length) {
+    _capture = capture;
+    _captureLength = length;
+    rewind();
+}
+
+/**
+ * Start playing the capture from the beginning again
+ */
+void ReplayUDP::rewind() {
+    _capturePointer = 0;
+    _packet = NULL;
+    _packetLength = _packetPointer = 0;
+    _pendingResendCount = 0;
+}
+
+bool ReplayUDP::atEnd() {
+    return _capturePointer >= _captureLength && !_pendingResendCount;
+}
+
+unsigned long ReplayUDP::packetsSent() {
+    return _packetsSent;
+}
+
+/**
+ * Drop the given percentage of the capture's datagrams that carry commands, as a lossy
+ * network would. Dropped datagrams are only played again if the client asks for them.
+ */
+void ReplayUDP::setLoss(uint8_t percent) {
+    _lossPercent = percent;
+}
+
+/**
+ * How long after a resend request the requested datagram arrives, i.e. the round trip time
+ */
+void ReplayUDP::setResendDelay(unsigned long ms) {
+    _resendDelay = ms;
+}
+
+unsigned long ReplayUDP::packetsLost() {
+    return _packetsLost;
+}
+
+unsigned long ReplayUDP::resendRequests() {
+    return _resendRequests;
+}
+
+unsigned long ReplayUDP::packetsResent() {
+    return _packetsResent;
+}
+
+uint8_t ReplayUDP::begin(uint16_t port) {
+    (void)port;
+    return 1;
+}
+
+void ReplayUDP::stop() { }
+
+int ReplayUDP::beginPacket(IPAddress ip, uint16_t port) {
+    (void)ip;
+    (void)port;
+    _sentHeaderLength = 0;
+    return 1;
+}
+
+/**
+ * Count the packet, and queue the requested datagram if it was a resend request
+ */
+int ReplayUDP::endPacket() {
+    _packetsSent++;
+
+    if (_sentHeaderLength == 12 && ((_sentHeader[0] >> 3) & 0x08)) {    // Request next after
+        _resendRequests++;
+        const uint8_t *packet = _findPacket(((_sentHeader[6] << 8) | _sentHeader[7]) + 1);
+        if (packet && _pendingResendCount < REPLAY_UDP_MAX_PENDING_RESENDS) {
+            _pendingResends[_pendingResendCount].packet = packet;
+            _pendingResends[_pendingResendCount].due = millis() + _resendDelay;
+            _pendingResendCount++;
+        }
+    }
+    return 1;
+}
+
+size_t ReplayUDP::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t ReplayUDP::write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size && _sentHeaderLength < 12; i++) _sentHeader[_sentHeaderLength++] = buffer[i];
+    return size;
+}
+
+/**
+ * Move on to the next datagram: a resend that is due, or else the next one in the capture.
+ * Returns its size, or 0 if there is nothing to receive right now.
+ */
+int ReplayUDP::parsePacket() {
+    _packet = NULL;
+    _packetLength = _packetPointer = 0;
+
+    for (uint8_t i = 0; i < _pendingResendCount; i++) {
+        if ((long)(millis() - _pendingResends[i].due) >= 0) {
+            _servePacket(_pendingResends[i].packet);
+            _pendingResends[i] = _pendingResends[--_pendingResendCount];
+            _packetsResent++;
+            return _packetLength;
+        }
+    }
+
+    while (_captureLength - _capturePointer >= 12) {
+        const uint8_t *packet = _capture + _capturePointer;
+        uint16_t length = _datagramLength(packet);
+        if (length < 12 || length > _captureLength - _capturePointer) break;    // Corrupt capture - stop here
+        _capturePointer += length;
+
+        bool hello = (packet[0] >> 3) & 0x02;
+        if (!hello && length > 12 && _lossPercent && random(100) < _lossPercent) {    // Lost on the way
+            _packetsLost++;
+            continue;
+        }
+
+        _servePacket(packet);
+        return _packetLength;
+    }
+
+    _capturePointer = _captureLength;
+    return 0;
+}
+
+int ReplayUDP::available() {
+    return _packetLength - _packetPointer;
+}
+
+int ReplayUDP::read() {
+    if (_packetPointer >= _packetLength) return -1;
+    return _packet[_packetPointer++];
+}
+
+int ReplayUDP::read(unsigned char *buffer, size_t len) {
+    size_t remaining = _packetLength - _packetPointer;
+    if (len > remaining) len = remaining;
+    memcpy(buffer, _packet + _packetPointer, len);
+    _packetPointer += len;
+    return len;
+}
+
+void ReplayUDP::flush() {
+    _packetPointer = _packetLength;
+}
+
+void ReplayUDP::_servePacket(const uint8_t *packet) {
+    _packet = packet;
+    _packetLength = _datagramLength(packet);
+    _packetPointer = 0;
+}
+
+/**
+ * Find the datagram with the given remote packet ID in the capture
+ */
+const uint8_t *ReplayUDP::_findPacket(uint16_t packetID) {
+    for (size_t pointer = 0; _captureLength - pointer >= 12; ) {
+        const uint8_t *packet = _capture + pointer;
+        uint16_t length = _datagramLength(packet);
+        if (length < 12 || length > _captureLength - pointer) break;
+        if (((packet[10] << 8) | packet[11]) == packetID && !((packet[0] >> 3) & 0x02)) return packet;
+        pointer += length;
+    }
+    return NULL;
+}
+
+IPAddress ReplayUDP::remoteIP() {
+    return _remoteIP;
+}
+
+uint16_t ReplayUDP::remotePort() {
+    return 9910;
+}
+
+/**
+ * Read a whole capture file into memory. Returns NULL if it can't be read.
+ */
+uint8_t *loadCapture(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *capture = size > 0 ? (uint8_t *)malloc(size) : NULL;
+    if (capture && fread(capture, 1, size, file) != (size_t)size) {
+        free(capture);
+        capture = NULL;
+    }
+    fclose(file);
+
+    *length = capture ? size : 0;
+    return capture;
+}
+
+unsigned long countCapturePackets(const uint8_t *capture, size_t length) {
+    unsigned long packets = 0;
+    for (size_t pointer = 0; length - pointer >= 12; packets++) {
+        uint16_t packetLength = _datagramLength(capture + pointer);
+        if (packetLength < 12 || packetLength > length - pointer) break;
+        pointer += packetLength;
+    }
+    return packets;
+}
+
+/**
+ * Count the commands in all datagrams that carry a payload, skipping hello packets
+ */
+unsigned long countCaptureCommands(const uint8_t *capture, size_t length) {
+    unsigned long commands = 0;
+    for (size_t pointer = 0; length - pointer >= 12; ) {
+        uint16_t packetLength = _datagramLength(capture + pointer);
+        if (packetLength < 12 || packetLength > length - pointer) break;
+
+        if (!((capture[pointer] >> 3) & 0x02)) {    // Not a hello packet
+            for (uint16_t cmdPointer = 12; cmdPointer + 8 <= packetLength; commands++) {
+                uint16_t cmdLength = (capture[pointer + cmdPointer] << 8) | capture[pointer + cmdPointer + 1];
+                if (cmdLength <= 8) break;
+                cmdPointer += cmdLength;
+            }
+        }
+        pointer += packetLength;
+    }
+    return commands;
+}
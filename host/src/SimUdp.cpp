@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "SimUdp.h"
+
+SimNetwork::SimNetwork() : _latency(0), _datagrams(0), _lost(0), _random(1) { }
+
+/**
+ * Set the one-way latency (us) of every datagram
+ */
+void SimNetwork::setLatency(unsigned long us) {
+    _latency = us;
+}
+
+/**
+ * Give the endpoint with address ip a link of its own, that adds latency (us) to every datagram
+ * from and to it and loses loss percent of them. Losses are pseudo-random, but the same every run.
+ */
+void SimNetwork::setLink(IPAddress ip, unsigned long latency, uint8_t loss) {
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (_links[i].ip == ip) {
+            _links[i].latency = latency;
+            _links[i].loss = loss;
+            return;
+        }
+    }
+    Link link;
+    link.ip = ip;
+    link.latency = latency;
+    link.loss = loss;
+    _links.push_back(link);
+}
+
+/**
+ * Number of datagrams sent on the network, delivered or not
+ */
+unsigned long SimNetwork::datagrams() {
+    return _datagrams;
+}
+
+/**
+ * Number of datagrams lost on the links set with setLink()
+ */
+unsigned long SimNetwork::lost() {
+    return _lost;
+}
+
+/**
+ * Add the latency of the link of ip to latency, returning false if the datagram gets lost on it
+ */
+bool SimNetwork::_crossLink(IPAddress ip, unsigned long *latency) {
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (_links[i].ip != ip) continue;
+        *latency += _links[i].latency;
+        if (!_links[i].loss) return true;
+        _random = _random * 1103515245 + 12345;
+        return (_random >> 16) % 100 >= _links[i].loss;
+    }
+    return true;
+}
+
+void SimNetwork::attach(SimUDP *endpoint) {
+    _endpoints.push_back(endpoint);
+}
+
+void SimNetwork::detach(SimUDP *endpoint) {
+    for (size_t i = 0; i < _endpoints.size(); i++) {
+        if (_endpoints[i] == endpoint) {
+            _endpoints.erase(_endpoints.begin() + i);
+            return;
+        }
+    }
+}
+
+/**
+ * Hand a datagram to the endpoint with address toIP bound to toPort, if there is one
+ */
+void SimNetwork::send(IPAddress fromIP, uint16_t fromPort, IPAddress toIP, uint16_t toPort, const uint8_t *data, uint16_t length) {
+    _datagrams++;
+    unsigned long latency = _latency;
+    if (!_crossLink(fromIP, &latency) || !_crossLink(toIP, &latency)) {
+        _lost++;
+        return;
+    }
+    for (size_t i = 0; i < _endpoints.size(); i++) {
+        if (_endpoints[i]->localIP() == toIP && _endpoints[i]->localPort() == toPort) {
+            _endpoints[i]->receive(fromIP, fromPort, data, length, micros() + latency);
+            return;
+        }
+    }
+}
+
+SimUDP::SimUDP(SimNetwork *network, IPAddress ip) : _network(network), _ip(ip), _port(0), _hasCurrent(false), _pointer(0), _sendPort(0), _sendLength(0) {
+    _network->attach(this);
+}
+
+SimUDP::~SimUDP() {
+    _network->detach(this);
+}
+
+IPAddress SimUDP::localIP() {
+    return _ip;
+}
+
+uint16_t SimUDP::localPort() {
+    return _port;
+}
+
+/**
+ * Queue a datagram from the network, to be returned by parsePacket() once it's due
+ */
+void SimUDP::receive(IPAddress fromIP, uint16_t fromPort, const uint8_t *data, uint16_t length, unsigned long due) {
+    Datagram datagram;
+    datagram.due = due;
+    datagram.ip = fromIP;
+    datagram.port = fromPort;
+    datagram.data.assign(data, data + length);
+    std::deque<Datagram>::iterator position = _received.end();
+    while (position != _received.begin() && (long)((position - 1)->due - due) > 0) position--;
+    _received.insert(position, datagram);
+}
+
+uint8_t SimUDP::begin(uint16_t port) {
+    _port = port;
+    _received.clear();
+    _hasCurrent = false;
+    return 1;
+}
+
+void SimUDP::stop() {
+    _port = 0;
+    _received.clear();
+    _hasCurrent = false;
+}
+
+int SimUDP::beginPacket(IPAddress ip, uint16_t port) {
+    _sendIP = ip;
+    _sendPort = port;
+    _sendLength = 0;
+    return 1;
+}
+
+int SimUDP::endPacket() {
+    _network->send(_ip, _port, _sendIP, _sendPort, _sendBuffer, _sendLength);
+    return 1;
+}
+
+size_t SimUDP::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t SimUDP::write(const uint8_t *buffer, size_t size) {
+    if (size > (size_t)(SIM_UDP_MAX_DATAGRAM - _sendLength)) size = SIM_UDP_MAX_DATAGRAM - _sendLength;
+    memcpy(_sendBuffer + _sendLength, buffer, size);
+    _sendLength += size;
+    return size;
+}
+
+/**
+ * Take the next datagram that has arrived. Datagrams arrive in the order they were sent, unless links with different latencies reorder them.
+ */
+int SimUDP::parsePacket() {
+    _hasCurrent = false;
+    if (_received.empty() || (long)(micros() - _received.front().due) < 0) return 0;
+
+    _current = _received.front();
+    _received.pop_front();
+    _hasCurrent = true;
+    _pointer = 0;
+    return _current.data.size();
+}
+
+int SimUDP::available() {
+    return _hasCurrent ? _current.data.size() - _pointer : 0;
+}
+
+int SimUDP::read() {
+    return available() ? _current.data[_pointer++] : -1;
+}
+
+int SimUDP::read(unsigned char *buffer, size_t len) {
+    if (len > (size_t)available()) len = available();
+    if (len) memcpy(buffer, &_current.data[_pointer], len);
+    _pointer += len;
+    return len;
+}
+
+void SimUDP::flush() {
+    if (_hasCurrent) _pointer = _current.data.size();
+}
+
+IPAddress SimUDP::remoteIP() {
+    return _current.ip;
+}
+
+uint16_t SimUDP::remotePort() {
+    return _current.port;
+}
@@ -0,0 +1,109 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Play an initial state dump over a lossy link and report how long it takes ATEMbase
+    to get all of it, i.e. until hasInitialized(). Lost datagrams are only played again
+    when ATEMbase asks for them, and arrive one round trip time after the request.
+
+    Usage: atem_init_loss [-l loss %] [-d round trip ms] [-r runs] <capture>
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <ATEMmin.h>
+#include <ReplayUdp.h>
+
+#define INIT_LOSS_TIMEOUT 10000     // ms, before a run counts as failed
+
+int main(int argc, char **argv) {
+    unsigned long loss = 5;
+    unsigned long roundTrip = 10;
+    unsigned long runs = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:d:r:")) != -1) {
+        switch (opt) {
+            case 'l': loss = strtoul(optarg, NULL, 10); break;
+            case 'd': roundTrip = strtoul(optarg, NULL, 10); break;
+            case 'r': runs = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "Usage: %s [-l loss %%] [-d round trip ms] [-r runs] <capture>\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc || loss > 100 || !runs) {
+        fprintf(stderr, "Usage: %s [-l loss %%] [-d round trip ms] [-r runs] <capture>\n", argv[0]);
+        return 2;
+    }
+
+    size_t length;
+    uint8_t *capture = loadCapture(argv[optind], &length);
+    if (!capture) {
+        fprintf(stderr, "Unable to read capture %s\n", argv[optind]);
+        return 1;
+    }
+
+    randomSeed(9910);
+
+    unsigned long completed = 0;
+    unsigned long totalLost = 0, totalRequests = 0, totalResent = 0;
+    double totalMs = 0, maxMs = 0;
+
+    for (unsigned long run = 0; run < runs; run++) {
+        ReplayUDP replay;
+        replay.setCapture(capture, length);
+        replay.setLoss(loss);
+        replay.setResendDelay(roundTrip);
+
+        ATEMmin atemSwitcher;
+        atemSwitcher.setTransport(&replay);
+        atemSwitcher.begin(IPAddress(127, 0, 0, 1));
+
+        unsigned long start = micros();
+        do {    // hasInitialized() is only valid once runLoop() has connected
+            atemSwitcher.runLoop();
+            usleep(100);
+        } while (!atemSwitcher.hasInitialized() && (micros() - start) / 1000 < INIT_LOSS_TIMEOUT);
+
+        if (atemSwitcher.hasInitialized()) {
+            double ms = (micros() - start) / 1000.0;
+            completed++;
+            totalMs += ms;
+            if (ms > maxMs) maxMs = ms;
+        }
+        totalLost += replay.packetsLost();
+        totalRequests += replay.resendRequests();
+        totalResent += replay.packetsResent();
+    }
+
+    printf("%s: %lu packets, %lu%% loss, %lu ms round trip, %lu runs\n", argv[optind],
+           countCapturePackets(capture, length), loss, roundTrip, runs);
+    printf("  initialized:       %lu of %lu\n", completed, runs);
+    if (completed) {
+        printf("  time to init:      %.1f ms mean, %.1f ms max\n", totalMs / completed, maxMs);
+    }
+    printf("  packets lost:      %.1f per run\n", (double)totalLost / runs);
+    printf("  resend requests:   %.1f per run\n", (double)totalRequests / runs);
+    printf("  packets resent:    %.1f per run\n", (double)totalResent / runs);
+
+    free(capture);
+    return completed == runs ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Connect to an ATEM switcher (or a tally server) and report how long the
+    handshake and the initial state dump take.
+
+    Usage: atem_probe <switcher ip> [timeout ms]
+           atem_probe --local [timeout ms]
+
+    --local runs a TallyServer in the same process as a stand-in switcher and
+    connects to it over the loopback interface.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <ATEMmin.h>
+#include <TallyServer.h>
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <switcher ip>|--local [timeout ms]\n", argv[0]);
+        return 2;
+    }
+
+    bool local = !strcmp(argv[1], "--local");
+    unsigned long timeout = argc > 2 ? strtoul(argv[2], NULL, 10) : 5000;
+
+    IPAddress switcherIP;
+    if (local) {
+        switcherIP = IPAddress(127, 0, 0, 1);
+    } else if (!switcherIP.fromString(argv[1])) {
+        fprintf(stderr, "Invalid IP address: %s\n", argv[1]);
+        return 2;
+    }
+
+    TallyServer tallyServer;
+    if (local) {
+        tallyServer.begin();
+        tallyServer.resetTallyFlags();
+        tallyServer.setTallySources(8);
+        tallyServer.setTallyFlag(0, 1);
+        tallyServer.setTallyFlag(1, 2);
+        tallyServer.setTallyBySourceSources(2);
+        tallyServer.setTallyBySourceFlag(0, 1, 1);
+        tallyServer.setTallyBySourceFlag(1, 1000, 2);
+    }
+
+    randomSeed(getpid());
+
+    ATEMmin atemSwitcher;
+    atemSwitcher.begin(switcherIP);
+
+    unsigned long start = micros();
+    unsigned long connectedAt = 0;
+    unsigned long initializedAt = 0;
+
+    while (!initializedAt && millis() - start / 1000 < timeout) {
+        if (local) tallyServer.runLoop();
+        atemSwitcher.runLoop();
+
+        if (!connectedAt && atemSwitcher.isConnected()) connectedAt = micros();
+        if (!initializedAt && atemSwitcher.hasInitialized()) initializedAt = micros();
+
+        usleep(100);
+    }
+
+    if (!connectedAt) {
+        printf("No answer from %u.%u.%u.%u within %lu ms\n", switcherIP[0], switcherIP[1], switcherIP[2], switcherIP[3], timeout);
+        return 1;
+    }
+
+    if (atemSwitcher.isRejected()) {
+        printf("Connection rejected - no empty spot\n");
+        return 1;
+    }
+
+    printf("Connected:   %.3f ms\n", (connectedAt - start) / 1000.0);
+    if (!initializedAt) {
+        printf("Initialized: timed out after %lu ms\n", timeout);
+        return 1;
+    }
+    printf("Initialized: %.3f ms\n", (initializedAt - start) / 1000.0);
+
+    uint16_t sources = atemSwitcher.getTallyByIndexSources();
+    printf("Tally sources: %u\n", sources);
+    for (uint16_t i = 0; i < sources; i++) {
+        printf("  %2u: %u\n", i + 1, atemSwitcher.getTallyByIndexTallyFlags(i));
+    }
+    sources = atemSwitcher.getTallyBySourceSources();
+    printf("Tally by source: %u\n", sources);
+    for (uint16_t i = 0; i < sources; i++) {
+        uint16_t videoSource = atemSwitcher.getTallyBySourceVideoSource(i);
+        printf("  %5u: %u\n", videoSource, atemSwitcher.getTallyBySourceTallyFlags(videoSource));
+    }
+
+    return 0;
+}
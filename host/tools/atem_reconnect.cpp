@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Take the switcher away from a connected ATEMmin for a while and report how long it
+    takes to notice, to get a new session and to get tally again. The switcher is a
+    TallyServer in the same process on 127.0.0.1, which is stopped for the outage.
+    With -b, begin() is called again once the session is found dead, as the tally light sketch does.
+
+    Usage: atem_reconnect [-b] [-o outage ms] [-t liveness timeout ms] [-r runs]
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <ATEMmin.h>
+#include <TallyServer.h>
+
+#define RECONNECT_TIMEOUT 30000     // ms, before a run counts as failed
+
+static TallyServer tallyServer;
+static ATEMmin atemSwitcher;
+
+// Run both ends until the condition holds or the timeout passes
+template <typename Condition>
+static bool runUntil(Condition condition, unsigned long timeout, bool serverUp) {
+    unsigned long start = millis();
+    while (!condition()) {
+        if (millis() - start >= timeout) return false;
+        if (serverUp) tallyServer.runLoop();
+        atemSwitcher.runLoop();
+        usleep(100);
+    }
+    return true;
+}
+
+static void startServer() {
+    tallyServer.begin();
+    tallyServer.resetTallyFlags();
+    tallyServer.setTallySources(8);
+    tallyServer.setTallyFlag(0, 1);
+}
+
+int main(int argc, char **argv) {
+    unsigned long outage = 3000;
+    unsigned long liveness = ATEM_livenessTimeout;
+    unsigned long runs = 5;
+    bool rebegin = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bo:t:r:")) != -1) {
+        switch (opt) {
+            case 'o': outage = strtoul(optarg, NULL, 10); break;
+            case 't': liveness = strtoul(optarg, NULL, 10); break;
+            case 'r': runs = strtoul(optarg, NULL, 10); break;
+            case 'b': rebegin = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-b] [-o outage ms] [-t liveness timeout ms] [-r runs]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (!runs || liveness > 0xFFFF) {
+        fprintf(stderr, "Usage: %s [-b] [-o outage ms] [-t liveness timeout ms] [-r runs]\n", argv[0]);
+        return 2;
+    }
+
+    randomSeed(getpid());
+
+    startServer();
+    atemSwitcher.begin(IPAddress(127, 0, 0, 1));
+    atemSwitcher.setLivenessTimeout(liveness);
+    if (!runUntil([] { return atemSwitcher.hasInitialized(); }, RECONNECT_TIMEOUT, true)) {
+        fprintf(stderr, "Unable to connect to the local tally server\n");
+        return 1;
+    }
+
+    printf("%lu ms outage, %lu ms liveness timeout, %lu runs%s\n", outage, liveness, runs, rebegin ? ", begin() again on reconnect" : "");
+    printf("%4s %12s %14s %16s %20s %11s\n", "run", "detected ms", "reconnect ms", "first tally ms", "after restart ms", "reconnects");
+
+    unsigned long completed = 0;
+    for (unsigned long run = 1; run <= runs; run++) {
+        uint16_t reconnects = atemSwitcher.getReconnectCount();
+
+        // Let the session settle, then take the switcher away
+        runUntil([] { return false; }, 500, true);
+        tallyServer.end();
+        unsigned long stoppedAt = millis();
+
+        bool detected = runUntil([&] { return atemSwitcher.getReconnectCount() != reconnects; }, outage, false);
+        unsigned long detectedAt = millis();
+        if (!detected) runUntil([&] { return atemSwitcher.getReconnectCount() != reconnects; }, RECONNECT_TIMEOUT, false);
+        if (rebegin) {
+            atemSwitcher.begin(IPAddress(127, 0, 0, 1));
+            atemSwitcher.setLivenessTimeout(liveness);
+        }
+        else runUntil([] { return false; }, outage - (detectedAt - stoppedAt), false);
+
+        startServer();
+        unsigned long restartedAt = millis();
+        tallyServer.setTallyFlag(0, run & 1 ? 2 : 1);     // Something new to show
+
+        if (!runUntil([] { return atemSwitcher.hasInitialized(); }, RECONNECT_TIMEOUT, true)) {
+            printf("%4lu  no tally within %d ms\n", run, RECONNECT_TIMEOUT);
+            continue;
+        }
+        completed++;
+        printf("%4lu %12lu %14lu %16lu %20lu %11u\n", run, (detected ? detectedAt : millis()) - stoppedAt,
+               atemSwitcher.getTimeToReconnect(), atemSwitcher.getTimeToFirstTally(), millis() - restartedAt, atemSwitcher.getReconnectCount());
+        if (atemSwitcher.getReconnectCount() != reconnects + 1) completed--;
+    }
+
+    return completed == runs ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Feed recorded ATEM traffic through ATEMbase::runLoop() and ATEMmin's command
+    parsing, and report the cost per packet, per command and the heap allocations made.
+
+    Usage: atem_replay_bench [-n iterations] <capture> [<capture> ...]
+*/
+
+#include <new>
+#include <stdio.h>
+#include <time.h>
+
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#else
+#define BENCH_HAS_TSC 0
+#endif
+
+#include <ATEMmin.h>
+#include <ReplayUdp.h>
+
+// Every heap allocation in the process goes through here, so the libraries' are counted too
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+void operator delete(void *p) noexcept {
+    free(p);
+}
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t cycles() {
+    #if BENCH_HAS_TSC
+    return __rdtsc();
+    #else
+    return 0;
+    #endif
+}
+
+static int benchCapture(const char *path, unsigned long iterations) {
+    size_t length;
+    uint8_t *capture = loadCapture(path, &length);
+    if (!capture) {
+        fprintf(stderr, "Unable to read capture %s\n", path);
+        return 1;
+    }
+
+    unsigned long packets = countCapturePackets(capture, length);
+    unsigned long commands = countCaptureCommands(capture, length);
+
+    ReplayUDP replay;
+    replay.setCapture(capture, length);
+
+    ATEMmin atemSwitcher;
+    atemSwitcher.setTransport(&replay);
+    atemSwitcher.begin(IPAddress(127, 0, 0, 1));
+
+    atemSwitcher.runLoop();     // Warm up: connect and play the capture once
+
+    unsigned long startAllocations = allocations;
+    uint64_t startNs = nowNs();
+    uint64_t startCycles = cycles();
+    for (unsigned long i = 0; i < iterations; i++) {
+        replay.rewind();
+        atemSwitcher.runLoop();
+    }
+    uint64_t elapsedCycles = cycles() - startCycles;
+    uint64_t elapsedNs = nowNs() - startNs;
+    unsigned long elapsedAllocations = allocations - startAllocations;
+
+    double totalPackets = (double)packets * iterations;
+    double totalCommands = (double)commands * iterations;
+    printf("%-32s %7lu %8lu %10.1f %11.1f", path, packets, commands, elapsedNs / totalPackets,
+           commands ? elapsedNs / totalCommands : 0.0);
+    if (BENCH_HAS_TSC) printf(" %12.1f", commands ? elapsedCycles / totalCommands : 0.0);
+    printf(" %10.2f\n", (double)elapsedAllocations / iterations);
+
+    free(capture);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned long iterations = 1000;
+    int first = 1;
+
+    if (argc > 2 && !strcmp(argv[1], "-n")) {
+        iterations = strtoul(argv[2], NULL, 10);
+        first = 3;
+    }
+
+    if (first >= argc) {
+        fprintf(stderr, "Usage: %s [-n iterations] <capture> [<capture> ...]\n", argv[0]);
+        return 2;
+    }
+
+    printf("%-32s %7s %8s %10s %11s", "capture", "packets", "commands", "ns/packet", "ns/command");
+    if (BENCH_HAS_TSC) printf(" %12s", "cycles/cmd");
+    printf(" %10s\n", "allocs/run");
+
+    int result = 0;
+    for (int i = first; i < argc; i++) result |= benchCapture(argv[i], iterations);
+    return result;
+}
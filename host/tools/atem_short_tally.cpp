@@ -0,0 +1,138 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Play an initial state dump, then TlIn and TlSr commands cut short or claiming more
+    sources than they hold, as a broken switcher or a hostile tally server could send them,
+    and check ATEMmin only takes the sources that were actually in the command.
+    Build the host tools with CXXFLAGS="-O1 -g -fsanitize=address" to also catch memory errors.
+
+    Usage: atem_short_tally <initial state dump capture>
+*/
+
+#include <stdio.h>
+
+#include <ATEMmin.h>
+#include <ReplayUdp.h>
+
+#define SESSION_ID 0x8123   // As in captures/make_captures.py
+
+struct ShortCommand {
+    const char *name;
+    uint16_t length;        // Command length, the 8 byte command header included
+    uint16_t claimedSources;
+    uint16_t expectedSources;
+};
+
+// Commands of just the 8 byte header are skipped by ATEMbase, so each one here has at least a byte of data
+static const ShortCommand shortCommands[] = {
+    {"TlIn", 9, 20, 0},         // Half of the number of sources
+    {"TlIn", 10, 20, 0},
+    {"TlIn", 14, 65535, 4},     // Far more sources than there are flags
+    {"TlIn", 30, 20, 20},       // Whole again
+    {"TlSr", 9, 3, 0},
+    {"TlSr", 12, 65535, 0},     // Not one whole source
+    {"TlSr", 16, 65535, 2},
+    {"TlSr", 20, 3, 3},
+};
+
+// Packet ID of the last datagram in a capture
+static uint16_t lastPacketID(const uint8_t *capture, size_t length) {
+    uint16_t packetID = 0;
+    for (size_t pointer = 0; pointer + 12 <= length; ) {
+        uint16_t datagramLength = ((capture[pointer] & 0x07) << 8) | capture[pointer + 1];
+        packetID = (capture[pointer + 10] << 8) | capture[pointer + 11];
+        if (datagramLength < 12) break;
+        pointer += datagramLength;
+    }
+    return packetID;
+}
+
+// One datagram with the command, the number of sources it claims, and as many flags (TlIn) or sources (TlSr) as fit
+static size_t buildDatagram(uint8_t *datagram, uint16_t packetID, const ShortCommand &command) {
+    uint16_t length = 12 + command.length;
+    memset(datagram, 0, length);
+    datagram[0] = (0x01 << 3) | ((length >> 8) & 0x07);    // Ack request
+    datagram[1] = length;
+    datagram[2] = SESSION_ID >> 8;
+    datagram[3] = SESSION_ID & 0xFF;
+    datagram[10] = packetID >> 8;
+    datagram[11] = packetID;
+
+    uint8_t *cmd = datagram + 12;
+    cmd[0] = command.length >> 8;
+    cmd[1] = command.length;
+    memcpy(cmd + 4, command.name, 4);
+    uint8_t *data = cmd + 8;
+    uint16_t dataLength = command.length - 8;
+    if (dataLength > 0) data[0] = command.claimedSources >> 8;
+    if (dataLength > 1) data[1] = command.claimedSources;
+    for (uint16_t i = 2; i < dataLength; i++) {
+        data[i] = strcmp(command.name, "TlSr") ? 1 : ((i - 2) % 3 == 1 ? i : (i - 2) % 3 == 2 ? 2 : 0);   // Flags, or source low byte and flags
+    }
+    return length;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <initial state dump capture>\n", argv[0]);
+        return 2;
+    }
+
+    size_t length;
+    uint8_t *capture = loadCapture(argv[1], &length);
+    if (!capture) {
+        fprintf(stderr, "Unable to read capture %s\n", argv[1]);
+        return 2;
+    }
+
+    ReplayUDP replay;
+    replay.setCapture(capture, length);
+    ATEMmin atemSwitcher;
+    atemSwitcher.setTransport(&replay);
+    atemSwitcher.begin(IPAddress(127, 0, 0, 1));
+    while (!replay.atEnd()) atemSwitcher.runLoop();
+    if (!atemSwitcher.hasInitialized()) {
+        fprintf(stderr, "The capture didn't initialize the session\n");
+        return 1;
+    }
+
+    printf("%-6s %8s %8s %8s %8s\n", "cmd", "length", "claimed", "sources", "result");
+    int failed = 0;
+    uint16_t packetID = lastPacketID(capture, length);
+    for (const ShortCommand &command : shortCommands) {
+        uint8_t datagram[12 + 64];
+        size_t datagramLength = buildDatagram(datagram, ++packetID, command);
+        replay.setCapture(datagram, datagramLength);
+        while (!replay.atEnd()) atemSwitcher.runLoop();
+
+        bool tallyByIndex = !strcmp(command.name, "TlIn");
+        uint16_t sources = tallyByIndex ? atemSwitcher.getTallyByIndexSources() : atemSwitcher.getTallyBySourceSources();
+        bool ok = sources == command.expectedSources;
+        for (uint16_t i = 0; i < sources && ok; i++) {
+            // Every source taken has to be readable, and hold what was sent
+            ok = tallyByIndex ? atemSwitcher.getTallyByIndexTallyFlags(i) == 1 : atemSwitcher.getTallyBySourceTallyFlags(atemSwitcher.getTallyBySourceVideoSource(i)) == 2;
+        }
+        failed += !ok;
+        printf("%-6s %8u %8u %8u %8s\n", command.name, command.length, command.claimedSources, sources, ok ? "ok" : "FAILED");
+    }
+
+    free(capture);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,328 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Load a tally server (a tally light relaying the tally, or a TallyServer in this process) with
+    a number of ATEMmin clients over real sockets, each with a socket of its own, and report
+    percentiles of the handshake time and of the time each tally change took to reach each client,
+    and the datagrams the clients received, lost and got resent. Times are taken when a client read
+    the datagram (ATEMbase::getPacketReceivedTime()), so they don't depend on how long it takes to
+    run all clients once.
+
+    Usage: tally_load [-c clients] [-u updates] [-i interval ms] [-s sources] [-w wait ms] --local
+           tally_load [-c clients] [-u updates] [-i interval ms] [-s sources] [-w wait ms] --serve relay-ip
+           tally_load [-c clients] [-u updates] [-i interval ms] [-w wait ms] relay-ip
+
+    --local runs a TallyServer in this process on 127.0.0.1, and changes its tally.
+    --serve also runs a TallyServer, as the switcher of the relay: point the relay's switcher IP at
+    this host. Changes take the path switcher -> relay -> clients, and are timed from being set.
+    With just relay-ip the changes come from the relay's own switcher, so they're timed from the first
+    client that got them, and the tool listens for as long as the updates would have taken.
+*/
+
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include <ATEMmin.h>
+#include <TallyServer.h>
+
+#define LOAD_RECENT_CHANGES 64   // Tally states remembered, to time the clients that get them later
+
+/**
+ * PosixUDP on a port of its own, that watches the headers of the datagrams it receives:
+ * how many there were, how many reliable packets never arrived, and how many were resent on request.
+ */
+class MeterUDP : public PosixUDP {
+private:
+    uint8_t _header[12];
+    uint16_t _headerLength;
+    bool _hasLastPacketID;
+    uint16_t _lastPacketID;
+
+    void _readHeader(const uint8_t *data, size_t length) {
+        while (length && _headerLength < 12) {
+            _header[_headerLength++] = *data++;
+            length--;
+            if (_headerLength < 12) continue;
+
+            received++;
+            uint8_t flags = _header[0] >> 3;
+            uint16_t packetID = ((_header[10] << 8) | _header[11]) & 0x7FFF;
+            if (flags & ATEM_headerCmd_HelloPacket) {
+                _hasLastPacketID = false;   // New session
+            } else if (flags & ATEM_headerCmd_Resend) {
+                resent++;
+            } else if (flags & ATEM_headerCmd_AckRequest) {
+                uint16_t gap = (packetID - _lastPacketID) & 0x7FFF;
+                if (_hasLastPacketID && gap > 1 && gap < 0x4000) lost += gap - 1;
+                if (!_hasLastPacketID || (gap && gap < 0x4000)) _lastPacketID = packetID;
+                _hasLastPacketID = true;
+            }
+        }
+    }
+
+public:
+    unsigned long received;
+    unsigned long lost;
+    unsigned long resent;
+
+    MeterUDP() : _headerLength(0), _hasLastPacketID(false), _lastPacketID(0), received(0), lost(0), resent(0) { }
+
+    // Many clients take random ports that would clash, so let the system pick a free one
+    uint8_t begin(uint16_t port) {
+        return PosixUDP::begin(0);
+    }
+
+    int parsePacket() {
+        _headerLength = 0;
+        return PosixUDP::parsePacket();
+    }
+
+    int read() {
+        int c = PosixUDP::read();
+        if (c >= 0) {
+            uint8_t byte = c;
+            _readHeader(&byte, 1);
+        }
+        return c;
+    }
+
+    int read(unsigned char *buffer, size_t len) {
+        int length = PosixUDP::read(buffer, len);
+        if (length > 0) _readHeader(buffer, length);
+        return length;
+    }
+    using PosixUDP::read;
+};
+
+struct RecentChange {
+    uint32_t signature;
+    unsigned long at;   // micros() it was set, or the first client got it
+};
+
+/**
+ * Hash of tally by index flags, to tell tally states apart
+ */
+static uint32_t tallySignature(const uint8_t *flags, uint16_t sources) {
+    uint32_t hash = 2166136261u ^ sources;
+    for (uint16_t i = 0; i < sources; i++) hash = (hash ^ flags[i]) * 16777619u;
+    return hash;
+}
+
+static uint32_t clientSignature(ATEMmin &client) {
+    uint8_t flags[256];
+    uint16_t sources = client.getTallyByIndexSources();
+    if (sources > sizeof(flags)) sources = sizeof(flags);
+    for (uint16_t i = 0; i < sources; i++) flags[i] = client.getTallyByIndexTallyFlags(i);
+    return tallySignature(flags, sources);
+}
+
+/**
+ * Set program on source program and preview on the next one, returning the signature clients will have
+ */
+static uint32_t setTally(TallyServer &tallyServer, int sources, int program) {
+    uint8_t flags[256];
+    for (int i = 0; i < sources; i++) {
+        flags[i] = i == program ? 1 : i == (program + 1) % sources ? 2 : 0;
+        tallyServer.setTallyFlag(i, flags[i]);
+    }
+    return tallySignature(flags, sources);
+}
+
+/**
+ * Wait up to 1 ms for a datagram on any of the sockets, then run everything once
+ */
+static void runOnce(TallyServer *tallyServer, PosixUDP *serverUdp, ATEMmin *clients, MeterUDP *clientUdp, int count, std::vector<pollfd> &fds) {
+    fds.clear();
+    for (int i = 0; i < count; i++) {
+        if (clientUdp[i].fd() < 0) continue;
+        pollfd fd = { clientUdp[i].fd(), POLLIN, 0 };
+        fds.push_back(fd);
+    }
+    if (tallyServer && serverUdp->fd() >= 0) {
+        pollfd fd = { serverUdp->fd(), POLLIN, 0 };
+        fds.push_back(fd);
+    }
+    poll(&fds[0], fds.size(), 1);
+
+    if (tallyServer) tallyServer->runLoop();
+    for (int i = 0; i < count; i++) clients[i].runLoop();
+}
+
+static void printPercentiles(const char *name, std::vector<unsigned long> &samples) {
+    if (samples.empty()) {
+        printf("%-14s %8d %10s %10s %10s %10s\n", name, 0, "-", "-", "-", "-");
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    printf("%-14s %8lu %10.2f %10.2f %10.2f %10.2f\n", name, (unsigned long)n, samples[n * 50 / 100] / 1000.0, samples[n * 90 / 100] / 1000.0, samples[n * 99 / 100] / 1000.0, samples[n - 1] / 1000.0);
+}
+
+int main(int argc, char **argv) {
+    int count = 100;
+    int updates = 20;
+    unsigned long interval = 500;
+    int sources = 8;
+    unsigned long wait = 5000;
+    bool local = false;
+    bool serve = false;
+    IPAddress relayIP(127, 0, 0, 1);
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (!strcmp(argv[arg], "--local")) local = true;
+        else if (!strcmp(argv[arg], "--serve")) serve = true;
+        else if (arg + 1 >= argc) break;
+        else if (!strcmp(argv[arg], "-c")) count = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "-u")) updates = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "-i")) interval = strtoul(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "-s")) sources = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "-w")) wait = strtoul(argv[++arg], NULL, 10);
+        else break;
+    }
+    if ((local ? arg != argc || serve : arg + 1 != argc || !relayIP.fromString(argv[arg])) || count < 1 || updates < 1 || sources < 2 || sources > 256) {
+        fprintf(stderr, "Usage: %s [-c clients] [-u updates] [-i interval ms] [-s sources] [-w wait ms] --local|[--serve] relay-ip\n", argv[0]);
+        return 2;
+    }
+    bool driving = local || serve;
+
+    randomSeed(getpid());
+
+    // The tally server changing the tally: the one under test, or the switcher of the relay under test
+    PosixUDP serverUdp;
+    TallyServer *tallyServer = NULL;
+    if (driving) {
+        tallyServer = new TallyServer();
+        tallyServer->setTransport(&serverUdp);
+        tallyServer->begin(local ? count : 4);
+        tallyServer->setTallySources(sources);
+        setTally(*tallyServer, sources, 0);
+    }
+
+    MeterUDP *clientUdp = new MeterUDP[count];
+    ATEMmin *clients = new ATEMmin[count];
+    std::vector<pollfd> fds;
+
+    // Handshake: all clients say hello at once
+    std::vector<unsigned long> connectTimes;
+    std::vector<unsigned long> initializeTimes;
+    std::vector<bool> connected(count, false);
+    std::vector<bool> initialized(count, false);
+    unsigned long start = micros();
+    for (int i = 0; i < count; i++) {
+        clients[i].setTransport(&clientUdp[i]);
+        clients[i].begin(relayIP);
+    }
+    while ((int)initializeTimes.size() < count && micros() - start < wait * 1000) {
+        runOnce(tallyServer, &serverUdp, clients, clientUdp, count, fds);
+        for (int i = 0; i < count; i++) {
+            if (!connected[i] && clients[i].isConnected() && !clients[i].isRejected()) {
+                connected[i] = true;
+                connectTimes.push_back(clients[i].getPacketReceivedTime() - start);
+            }
+            if (!initialized[i] && clients[i].hasInitialized() && !clients[i].isRejected()) {
+                initialized[i] = true;
+                initializeTimes.push_back(clients[i].getPacketReceivedTime() - start);
+            }
+        }
+    }
+    int rejected = 0;
+    for (int i = 0; i < count; i++) rejected += clients[i].isRejected();
+
+    // Fan-out: time every tally state a client gets from when it was set, or from the first client that got it
+    std::vector<unsigned long> fanOutTimes;
+    std::vector<uint32_t> signatures(count);
+    for (int i = 0; i < count; i++) signatures[i] = clientSignature(clients[i]);
+    RecentChange recent[LOAD_RECENT_CHANGES];
+    int recentCount = 0;
+    int changes = 0;
+    unsigned long receivedBefore = 0;
+    for (int i = 0; i < count; i++) receivedBefore += clientUdp[i].received;
+
+    for (int update = 1; driving ? update <= updates : update == 1; update++) {
+        unsigned long changedAt = micros();
+        if (driving) {
+            recent[recentCount++ % LOAD_RECENT_CHANGES] = (RecentChange){ setTally(*tallyServer, sources, update % sources), changedAt };
+            changes++;
+        }
+        unsigned long duration = driving ? interval : interval * updates;
+        while (micros() - changedAt < duration * 1000) {
+            runOnce(tallyServer, &serverUdp, clients, clientUdp, count, fds);
+            for (int i = 0; i < count; i++) {
+                if (!initialized[i]) continue;
+                uint32_t signature = clientSignature(clients[i]);
+                if (signature == signatures[i]) continue;
+                signatures[i] = signature;
+
+                int found = -1;
+                for (int j = 0; j < recentCount && j < LOAD_RECENT_CHANGES; j++) {
+                    if (recent[j].signature == signature) found = j;
+                }
+                if (found < 0) {
+                    if (driving) continue;   // Not a state this tool set
+                    found = recentCount++ % LOAD_RECENT_CHANGES;
+                    recent[found] = (RecentChange){ signature, clients[i].getPacketReceivedTime() };
+                    changes++;
+                }
+                fanOutTimes.push_back(clients[i].getPacketReceivedTime() - recent[found].at);
+            }
+        }
+    }
+
+    unsigned long received = 0;
+    unsigned long lost = 0;
+    unsigned long resent = 0;
+    for (int i = 0; i < count; i++) {
+        received += clientUdp[i].received;
+        lost += clientUdp[i].lost;
+        resent += clientUdp[i].resent;
+    }
+    received -= receivedBefore;
+
+    printf("%d clients on %u.%u.%u.%u%s: %d connected, %d initialized, %d rejected\n", count, relayIP[0], relayIP[1], relayIP[2], relayIP[3],
+           local ? " (local)" : serve ? " (served by this host)" : "", (int)connectTimes.size(), (int)initializeTimes.size(), rejected);
+    printf("%-14s %8s %10s %10s %10s %10s\n", "ms", "n", "p50", "p90", "p99", "max");
+    printPercentiles("hello", connectTimes);
+    printPercentiles("initialized", initializeTimes);
+    printPercentiles("fan-out", fanOutTimes);
+    unsigned long expected = (unsigned long)changes * initializeTimes.size();
+    printf("changes %d, reached %lu of %lu\n", changes, (unsigned long)fanOutTimes.size(), expected);
+    printf("datagrams received %lu, lost %lu (%.2f%%), resent on request %lu\n", received, lost, received + lost ? 100.0 * lost / (received + lost) : 0.0, resent);
+
+    if (local) {
+        unsigned long resends = 0;
+        unsigned long resendRequests = 0;
+        for (int index = 0; index < tallyServer->getMaxClients(); index++) {
+            TallyClientStats stats;
+            if (!tallyServer->getClientStats(index, &stats)) continue;
+            resends += stats.resends;
+            resendRequests += stats.resendRequests;
+        }
+        printf("server resends %lu after a timeout, %lu on request\n", resends, resendRequests);
+    }
+
+    delete[] clients;
+    delete[] clientUdp;
+    delete tallyServer;
+    return (int)initializeTimes.size() == count && (!driving || fanOutTimes.size() == expected) ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Connect a number of ATEMmin clients to a TallyServer over real sockets, change the tally
+    a number of times, and report how many packets and bytes the server sent per change and how
+    many clients got all of it, with tally data sent per client and by multicast or broadcast.
+    Every change moves program and preview on, in the tally by index and by source, as a cut does.
+
+    The clients connect to server-ip, which has to be an address of this host on the network
+    the multicasts go out on, as clients only take multicasts from the server they are connected to.
+
+    Usage: tally_multicast [-c clients] [-u updates] [-s sources] server-ip [multicast-or-broadcast-ip]
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <ATEMmin.h>
+#include <TallyServer.h>
+
+#define MULTICAST_PORT 9911
+
+/**
+ * PosixUDP that counts the packets and bytes it sends
+ */
+class CountingUDP : public PosixUDP {
+public:
+    unsigned long packetsSent;
+    unsigned long bytesSent;
+
+    CountingUDP() : packetsSent(0), bytesSent(0) { }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+        bytesSent += size;
+        return PosixUDP::write(buffer, size);
+    }
+    using PosixUDP::write;
+
+    int endPacket() {
+        packetsSent++;
+        return PosixUDP::endPacket();
+    }
+};
+
+/**
+ * Set program on source program and preview on the next one, in the tally by index and by source
+ */
+static void setTally(TallyServer &tallyServer, int sources, int program) {
+    for (int i = 0; i < sources; i++) {
+        uint8_t flags = i == program ? 1 : i == (program + 1) % sources ? 2 : 0;
+        tallyServer.setTallyFlag(i, flags);
+        tallyServer.setTallyBySourceFlag(i, i + 1, flags);
+    }
+}
+
+/**
+ * Whether the client has the tally set by setTally()
+ */
+static bool hasTally(ATEMmin &client, int sources, int program) {
+    if (client.getTallyByIndexSources() != sources || client.getTallyBySourceSources() != sources) return false;
+    for (int i = 0; i < sources; i++) {
+        uint8_t flags = i == program ? 1 : i == (program + 1) % sources ? 2 : 0;
+        if (client.getTallyByIndexTallyFlags(i) != flags || client.getTallyBySourceTallyFlags(i + 1) != flags) return false;
+    }
+    return true;
+}
+
+static void runFor(TallyServer &tallyServer, ATEMmin *clients, int count, unsigned long ms) {
+    unsigned long start = millis();
+    while (millis() - start < ms) {
+        tallyServer.runLoop();
+        for (int i = 0; i < count; i++) clients[i].runLoop();
+        usleep(100);
+    }
+}
+
+static int run(IPAddress serverIP, bool multicast, IPAddress multicastIP, int count, int updates, int sources) {
+    CountingUDP udp;
+    TallyServer tallyServer;
+    tallyServer.setTransport(&udp);
+    tallyServer.begin(count);
+    tallyServer.setTallySources(sources);
+    tallyServer.setTallyBySourceSources(sources);
+    setTally(tallyServer, sources, 0);
+    if (multicast) tallyServer.setMulticast(multicastIP, MULTICAST_PORT);
+
+    ATEMmin *clients = new ATEMmin[count];
+    for (int i = 0; i < count; i++) clients[i].begin(serverIP);
+    runFor(tallyServer, clients, count, 500);
+
+    // The first change is sent to every client on its own still, as they only acknowledge multicasts from then on
+    unsigned long packets = 0;
+    unsigned long bytes = 0;
+    int updated = 0;
+    for (int update = 0; update <= updates; update++) {
+        int program = (update + 1) % sources;
+        unsigned long packetsBefore = udp.packetsSent;
+        unsigned long bytesBefore = udp.bytesSent;
+        setTally(tallyServer, sources, program);
+        runFor(tallyServer, clients, count, 100);
+
+        if (update == 0) continue;
+        packets += udp.packetsSent - packetsBefore;
+        bytes += udp.bytesSent - bytesBefore;
+        for (int i = 0; i < count; i++) updated += hasTally(clients[i], sources, program);
+    }
+    delete[] clients;
+
+    printf("%-10s %8d %8d %8d %16.2f %16.1f %16.2f\n", multicast ? "multicast" : "unicast", count, sources, updates, (double)packets / updates, (double)bytes / updates, (double)updated / updates);
+    return updated == count * updates ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int count = 10;
+    int updates = 20;
+    int sources = 20;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (!strcmp(argv[arg], "-c")) count = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-u")) updates = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-s")) sources = atoi(argv[arg + 1]);
+    }
+
+    IPAddress serverIP;
+    IPAddress multicastIP(239, 255, 65, 84);
+    if (arg >= argc || !serverIP.fromString(argv[arg]) || (arg + 1 < argc && !multicastIP.fromString(argv[arg + 1])) || count < 1 || updates < 1 || sources < 2) {
+        fprintf(stderr, "Usage: %s [-c clients] [-u updates] [-s sources] server-ip [multicast-or-broadcast-ip]\n", argv[0]);
+        return 2;
+    }
+
+    printf("%-10s %8s %8s %8s %16s %16s %16s\n", "mode", "clients", "sources", "updates", "packets/update", "bytes/update", "clients/update");
+    int result = run(serverIP, false, multicastIP, count, updates, sources);
+    result |= run(serverIP, true, multicastIP, count, updates, sources);
+    return result;
+}
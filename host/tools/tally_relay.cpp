@@ -0,0 +1,320 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Run a tree of tally lights relaying the tally to each other on a simulated network, as the
+    sketch does: every tally light takes the tally from its upstream (the switcher, or another
+    tally light's TallyServer) and serves it on with its own TallyServer. The switcher is a
+    TallyServer without a relay ID, as a switcher doesn't send the relay path.
+
+    Reports per level of the tree the hops the tally lights see, how long a change took to reach
+    them, and how much of that the relays above them reported as their own delay. Then checks that
+    a tally light failing over to one of its own descendants notices the loop and goes dark instead
+    of showing stale tally, and that a chain longer than TALLY_SERVER_MAX_HOPS relays is cut off.
+
+    Usage: tally_relay [-d depth] [-f fan-out] [-u updates] [-l link latency us]
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <ATEMmin.h>
+#include <SimUdp.h>
+#include <TallyServer.h>
+
+#define RELAY_SOURCES 8
+
+/**
+ * A tally light: a client of up to two upstreams, the first one that can be used taking
+ * precedence, and a TallyServer for the tally lights downstream
+ */
+struct Relay {
+    SimUDP clientUdp[2];
+    SimUDP serverUdp;
+    ATEMmin upstream[2];
+    uint8_t upstreams;
+    uint8_t active;
+    bool usable;
+    TallyServer server;
+    int level;
+    unsigned long receivedAt;   // micros() the last tally change got here, 0 if it didn't yet
+
+    Relay(SimNetwork *network, IPAddress ip, uint32_t relayID, int maxClients)
+        : clientUdp{SimUDP(network, ip), SimUDP(network, ip)}, serverUdp(network, ip), upstreams(0), active(0), usable(false), level(0), receivedAt(0) {
+        server.setTransport(&serverUdp);
+        server.begin(maxClients);
+        server.setRelayID(relayID);
+        for (int i = 0; i < 2; i++) {
+            upstream[i].setTransport(&clientUdp[i]);
+            upstream[i].setRelayID(relayID);
+        }
+    }
+
+    void addUpstream(IPAddress ip) {
+        upstream[upstreams++].begin(ip);
+    }
+};
+
+static Relay *currentRelay;    // Relay whose upstream is being run, for the change notifications
+static uint8_t currentUpstream;
+
+static void tallyChanged(uint16_t tallyIndex, uint8_t previousTallyFlags, uint8_t tallyFlags) {
+    if (!currentRelay->usable || currentUpstream != currentRelay->active) return;
+    currentRelay->server.setTallyFlag(tallyIndex, tallyFlags);
+    if (!currentRelay->receivedAt) currentRelay->receivedAt = micros();
+}
+
+static void tallySourcesChanged(uint16_t sources) {
+    if (!currentRelay->usable || currentUpstream != currentRelay->active) return;
+    currentRelay->server.setTallySources(sources);
+}
+
+static bool upstreamUsable(Relay *relay, uint8_t i) {
+    return relay->upstream[i].isConnected() && !relay->upstream[i].isRejected() && !relay->upstream[i].isRelayLooped();
+}
+
+/**
+ * What the sketch's loop() does for the tally: run the upstreams, pick one, pass the tally and
+ * the relay path on, and only serve tally lights downstream while there's tally to give them
+ */
+static void runRelay(Relay *relay) {
+    currentRelay = relay;
+    for (currentUpstream = 0; currentUpstream < relay->upstreams; currentUpstream++) relay->upstream[currentUpstream].runLoop();
+
+    uint8_t active = relay->active;
+    for (uint8_t i = relay->upstreams; i-- > 0; ) {
+        if (upstreamUsable(relay, i)) active = i;
+    }
+    bool usable = upstreamUsable(relay, active);
+    if (usable && (!relay->usable || active != relay->active)) {
+        ATEMmin &atem = relay->upstream[active];
+        relay->server.setTallySources(atem.getTallyByIndexSources());
+        for (uint16_t i = 0; i < atem.getTallyByIndexSources(); i++) relay->server.setTallyFlag(i, atem.getTallyByIndexTallyFlags(i));
+    } else if (!usable && relay->usable) {
+        relay->server.resetTallyFlags();
+    }
+    relay->active = active;
+    relay->usable = usable;
+
+    ATEMmin &atem = relay->upstream[active];
+    uint8_t hops = usable ? atem.getRelayHops() : 0;
+    for (uint8_t hop = 0; hop < hops; hop++) relay->server.setUpstreamRelay(hop, atem.getRelayID(hop), atem.getRelayDelay(hop));
+    relay->server.setUpstreamHops(hops);
+
+    if (usable) relay->server.runLoop();
+}
+
+static IPAddress relayIP(int relay) {
+    return IPAddress(10, 0, (relay + 2) >> 8, (relay + 2) & 0xFF);
+}
+
+static void runFor(TallyServer *switcher, Relay **relays, int count, unsigned long ms) {
+    unsigned long start = millis();
+    while (millis() - start < ms) {
+        if (switcher) switcher->runLoop();
+        for (int i = 0; i < count; i++) runRelay(relays[i]);
+        usleep(50);
+    }
+}
+
+static void setProgram(TallyServer &switcher, int program) {
+    for (int i = 0; i < RELAY_SOURCES; i++) switcher.setTallyFlag(i, i == program ? 1 : 0);
+}
+
+static Relay *newRelay(SimNetwork *network, int index, int maxClients) {
+    Relay *relay = new Relay(network, relayIP(index), index + 1, maxClients);
+    relay->upstream[0].onTallyChange(tallyChanged);
+    relay->upstream[1].onTallyChange(tallyChanged);
+    relay->upstream[0].onTallySourcesChange(tallySourcesChanged);
+    relay->upstream[1].onTallySourcesChange(tallySourcesChanged);
+    return relay;
+}
+
+/**
+ * A tree of depth levels, every relay serving fanOut relays on the next level
+ */
+static int runTree(SimNetwork &network, int depth, int fanOut, int updates) {
+    IPAddress switcherIP(10, 0, 0, 1);
+    SimUDP switcherUdp(&network, switcherIP);
+    TallyServer switcher;
+    switcher.setTransport(&switcherUdp);
+    switcher.begin(fanOut);
+    switcher.setTallySources(RELAY_SOURCES);
+    setProgram(switcher, 0);
+
+    int count = 0;
+    for (int level = 1, width = fanOut; level <= depth; level++, width *= fanOut) count += width;
+    Relay **relays = new Relay *[count];
+    for (int i = 0, level = 1, first = 0, width = fanOut; i < count; i++) {
+        if (i == first + width) {
+            first += width;
+            width *= fanOut;
+            level++;
+        }
+        relays[i] = newRelay(&network, i, fanOut);
+        relays[i]->level = level;
+        relays[i]->addUpstream(level == 1 ? switcherIP : relayIP((i - fanOut) / fanOut));
+    }
+    runFor(&switcher, relays, count, 3000);
+
+    // Per level: tally lights that got each change, the time it took, and the delay the relays above reported for it
+    double received[TALLY_SERVER_MAX_HOPS + 2] = {0};
+    double latency[TALLY_SERVER_MAX_HOPS + 2] = {0};
+    double reported[TALLY_SERVER_MAX_HOPS + 2] = {0};
+    unsigned long maxLatency[TALLY_SERVER_MAX_HOPS + 2] = {0};
+    int hopsSeen[TALLY_SERVER_MAX_HOPS + 2];
+    int relaysAt[TALLY_SERVER_MAX_HOPS + 2] = {0};
+    for (int level = 0; level < TALLY_SERVER_MAX_HOPS + 2; level++) hopsSeen[level] = -1;
+
+    for (int update = 1; update <= updates; update++) {
+        for (int i = 0; i < count; i++) relays[i]->receivedAt = 0;
+        unsigned long changedAt = micros();
+        setProgram(switcher, update % RELAY_SOURCES);
+        runFor(&switcher, relays, count, 200);
+
+        for (int i = 0; i < count; i++) {
+            Relay *relay = relays[i];
+            ATEMmin &atem = relay->upstream[relay->active];
+            if (!relay->receivedAt || atem.getTallyByIndexTallyFlags(update % RELAY_SOURCES) != 1) continue;
+            unsigned long took = relay->receivedAt - changedAt;
+            received[relay->level]++;
+            latency[relay->level] += took;
+            if (took > maxLatency[relay->level]) maxLatency[relay->level] = took;
+            for (uint8_t hop = 0; hop < atem.getRelayHops(); hop++) reported[relay->level] += atem.getRelayDelay(hop);
+            hopsSeen[relay->level] = atem.getRelayHops();
+        }
+    }
+    for (int i = 0; i < count; i++) relaysAt[relays[i]->level]++;
+
+    printf("%6s %8s %6s %14s %12s %12s %16s\n", "level", "relays", "hops", "changes/relay", "mean us", "max us", "relays us/change");
+    int result = 0;
+    for (int level = 1; level <= depth && level < TALLY_SERVER_MAX_HOPS + 2; level++) {
+        double changes = received[level] ? received[level] : 1;
+        printf("%6d %8d %6d %14.2f %12.0f %12lu %16.0f\n", level, relaysAt[level], hopsSeen[level], received[level] / relaysAt[level], latency[level] / changes, maxLatency[level], reported[level] / changes);
+        if (received[level] != (double)relaysAt[level] * updates || hopsSeen[level] != level - 1) result = 1;
+    }
+    printf("switcher sessions: %d for %d tally lights, %lu datagrams\n\n", fanOut, count, network.datagrams());
+
+    for (int i = 0; i < count; i++) delete relays[i];
+    delete[] relays;
+    return result;
+}
+
+/**
+ * Relay A takes the tally from the switcher, relay B from A. A fails over to B when the switcher
+ * goes away, which would pass A's last tally around between them for good
+ */
+static int runFailoverLoop(SimNetwork &network) {
+    IPAddress switcherIP(10, 0, 0, 1);
+    SimUDP switcherUdp(&network, switcherIP);
+    TallyServer switcher;
+    switcher.setTransport(&switcherUdp);
+    switcher.begin(1);
+    switcher.setTallySources(RELAY_SOURCES);
+    setProgram(switcher, 3);
+
+    Relay *relays[2] = {newRelay(&network, 0, 2), newRelay(&network, 1, 2)};
+    relays[0]->addUpstream(switcherIP);
+    relays[0]->addUpstream(relayIP(1));
+    relays[1]->addUpstream(relayIP(0));
+    runFor(&switcher, relays, 2, 3000);
+    bool before = relays[1]->usable && relays[1]->upstream[0].getTallyByIndexTallyFlags(3) == 1;
+
+    switcher.end();
+    unsigned long start = millis();
+    unsigned long darkAfter = 0;
+    while (millis() - start < 10000) {
+        runFor(NULL, relays, 2, 10);
+        if (!relays[0]->usable && !relays[1]->usable) {
+            darkAfter = millis() - start;
+            break;
+        }
+    }
+    bool looped = relays[0]->upstream[1].isRelayLooped();
+    printf("failover to a descendant: tally before %s, %s after %lu ms, loop seen by relay A: %s\n",
+           before ? "yes" : "no", darkAfter ? "both dark" : "still lit", darkAfter, looped ? "yes" : "no");
+
+    delete relays[0];
+    delete relays[1];
+    return before && darkAfter ? 0 : 1;
+}
+
+/**
+ * A chain of relays longer than the path may be: the ones past it must not get tally
+ */
+static int runChain(SimNetwork &network) {
+    IPAddress switcherIP(10, 0, 0, 1);
+    SimUDP switcherUdp(&network, switcherIP);
+    TallyServer switcher;
+    switcher.setTransport(&switcherUdp);
+    switcher.begin(1);
+    switcher.setTallySources(RELAY_SOURCES);
+    setProgram(switcher, 5);
+
+    const int count = TALLY_SERVER_MAX_HOPS + 3;
+    Relay *relays[count];
+    for (int i = 0; i < count; i++) {
+        relays[i] = newRelay(&network, i, 1);
+        relays[i]->addUpstream(i == 0 ? switcherIP : relayIP(i - 1));
+    }
+    runFor(&switcher, relays, count, 4000 + 400 * count);
+
+    int deepest = 0;
+    while (deepest < count && relays[deepest]->usable && relays[deepest]->upstream[0].getTallyByIndexTallyFlags(5) == 1) deepest++;
+    printf("chain of %d: tally reaches %d tally lights (max %d relays between switcher and tally light), last one sees %d hops\n",
+           count, deepest, TALLY_SERVER_MAX_HOPS, deepest ? relays[deepest - 1]->upstream[0].getRelayHops() : 0);
+
+    bool cutOff = true;
+    for (int i = deepest; i < count; i++) cutOff = cutOff && !relays[i]->usable;
+    for (int i = 0; i < count; i++) delete relays[i];
+    return deepest == TALLY_SERVER_MAX_HOPS + 1 && cutOff ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int depth = 3;
+    int fanOut = 4;
+    int updates = 20;
+    unsigned long linkLatency = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:f:u:l:")) != -1) {
+        switch (opt) {
+            case 'd': depth = atoi(optarg); break;
+            case 'f': fanOut = atoi(optarg); break;
+            case 'u': updates = atoi(optarg); break;
+            case 'l': linkLatency = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "Usage: %s [-d depth] [-f fan-out] [-u updates] [-l link latency us]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (depth < 1 || depth > TALLY_SERVER_MAX_HOPS + 1 || fanOut < 1 || updates < 1) {
+        fprintf(stderr, "Usage: %s [-d depth] [-f fan-out] [-u updates] [-l link latency us]\n", argv[0]);
+        return 2;
+    }
+
+    randomSeed(getpid());
+    SimNetwork network;
+    network.setLatency(linkLatency);
+
+    int result = runTree(network, depth, fanOut, updates);
+    result |= runFailoverLoop(network);
+    result |= runChain(network);
+    return result;
+}
@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Connect three ATEMmin clients to a TallyServer on a simulated network: one on a healthy link,
+    one on a link that loses a lot and one on a slow link. Change the tally a number of times and
+    report per client how long it took to get each change (on average and at worst), how often the
+    server resent to it and the resend timeout it ended up with (TallyServer::getClientStats()).
+    First with the resend timeout fixed at the old 250 ms, then derived from each client's round trip time.
+
+    Usage: tally_resend [-u updates] [-l loss-percent]
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <ATEMmin.h>
+#include <SimUdp.h>
+#include <TallyServer.h>
+
+#define CLIENTS 3
+#define SOURCES 8
+#define UPDATE_INTERVAL 1000    // ms between changes, so each one settles first
+
+static const char *linkNames[CLIENTS] = { "healthy", "lossy", "slow" };
+
+static void setTally(TallyServer &tallyServer, int program) {
+    for (int i = 0; i < SOURCES; i++) tallyServer.setTallyFlag(i, i == program ? 1 : 0);
+}
+
+static void runOnce(TallyServer &tallyServer, ATEMmin *clients) {
+    tallyServer.runLoop();
+    for (int i = 0; i < CLIENTS; i++) clients[i].runLoop();
+    usleep(100);
+}
+
+static int run(bool adaptive, int updates, uint8_t loss) {
+    SimNetwork network;
+    network.setLatency(500);
+    IPAddress serverIP(10, 0, 0, 1);
+    SimUDP serverUdp(&network, serverIP);
+    TallyServer tallyServer;
+    tallyServer.setTransport(&serverUdp);
+    if (!adaptive) tallyServer.setResendTimeoutLimits(TALLY_SERVER_RESEND_TIMEOUT, TALLY_SERVER_RESEND_TIMEOUT);
+    tallyServer.begin(CLIENTS);
+    tallyServer.setTallySources(SOURCES);
+    setTally(tallyServer, 0);
+
+    IPAddress clientIPs[CLIENTS] = { IPAddress(10, 0, 1, 1), IPAddress(10, 0, 1, 2), IPAddress(10, 0, 1, 3) };
+    network.setLink(clientIPs[0], 1000, loss / 4);
+    network.setLink(clientIPs[1], 5000, loss);
+    network.setLink(clientIPs[2], 150000, loss / 4);
+
+    SimUDP *clientUdp[CLIENTS];
+    ATEMmin *clients = new ATEMmin[CLIENTS];
+    for (int i = 0; i < CLIENTS; i++) {
+        clientUdp[i] = new SimUDP(&network, clientIPs[i]);
+        clients[i].setTransport(clientUdp[i]);
+        clients[i].begin(serverIP);
+    }
+    unsigned long start = millis();
+    while (millis() - start < 3000) runOnce(tallyServer, clients);
+
+    unsigned long total[CLIENTS] = { 0 };
+    unsigned long worst[CLIENTS] = { 0 };
+    int missed[CLIENTS] = { 0 };
+    TallyClientStats before[CLIENTS];
+    for (int i = 0; i < CLIENTS; i++) before[i] = TallyClientStats();
+    for (int index = 0; index < tallyServer.getMaxClients(); index++) {
+        TallyClientStats stats;
+        if (!tallyServer.getClientStats(index, &stats)) continue;
+        for (int i = 0; i < CLIENTS; i++) if (stats.ip == clientIPs[i]) before[i] = stats;
+    }
+
+    for (int update = 1; update <= updates; update++) {
+        int program = update % SOURCES;
+        setTally(tallyServer, program);
+        unsigned long changed = millis();
+        bool done[CLIENTS] = { false };
+        while (millis() - changed < UPDATE_INTERVAL) {
+            runOnce(tallyServer, clients);
+            for (int i = 0; i < CLIENTS; i++) {
+                if (done[i] || clients[i].getTallyByIndexTallyFlags(program) != 1) continue;
+                done[i] = true;
+                unsigned long took = millis() - changed;
+                total[i] += took;
+                if (took > worst[i]) worst[i] = took;
+            }
+        }
+        for (int i = 0; i < CLIENTS; i++) missed[i] += !done[i];
+    }
+
+    int result = 0;
+    for (int index = 0; index < tallyServer.getMaxClients(); index++) {
+        TallyClientStats stats;
+        if (!tallyServer.getClientStats(index, &stats)) continue;
+        for (int i = 0; i < CLIENTS; i++) {
+            if (stats.ip != clientIPs[i]) continue;
+            int got = updates - missed[i];
+            printf("%-9s %-8s %8.1f %8lu %6d %6lu %6lu %6lu %8.1f %8.1f %8u\n", adaptive ? "adaptive" : "fixed", linkNames[i], got ? (double)total[i] / got : 0.0, worst[i], missed[i],
+                   (unsigned long)(stats.packetsSent - before[i].packetsSent), (unsigned long)(stats.resends - before[i].resends), (unsigned long)(stats.resendRequests - before[i].resendRequests),
+                   stats.rtt / 1000.0, stats.loss / 10.0, stats.resendTimeout);
+            result |= missed[i] != 0;
+        }
+    }
+
+    delete[] clients;
+    for (int i = 0; i < CLIENTS; i++) delete clientUdp[i];
+    return result;
+}
+
+int main(int argc, char **argv) {
+    int updates = 30;
+    int loss = 20;
+
+    for (int arg = 1; arg + 1 < argc; arg += 2) {
+        if (!strcmp(argv[arg], "-u")) updates = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-l")) loss = atoi(argv[arg + 1]);
+    }
+    if (updates < 1 || loss < 0 || loss > 90) {
+        fprintf(stderr, "Usage: %s [-u updates] [-l loss-percent]\n", argv[0]);
+        return 2;
+    }
+
+    printf("%-9s %-8s %8s %8s %6s %6s %6s %6s %8s %8s %8s\n", "timeout", "link", "avg ms", "worst ms", "missed", "sent", "resent", "asked", "rtt ms", "loss %", "rto ms");
+    int result = run(false, updates, loss);
+    result |= run(true, updates, loss);
+    return result;
+}
@@ -0,0 +1,161 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Connect a number of simulated tally lights to a TallyServer and report what it costs
+    the server to handle a datagram from one of them, as the number of clients grows, what
+    a runLoop() costs when no datagrams came in and no client is due for a keepalive, and what
+    sending a tally change costs per client. The simulated tally lights don't acknowledge tally
+    versions, so every change sends them all tally data, of BENCH_FAN_OUT_SOURCES sources.
+    Then they stop acknowledging anything, and what resending the tally data costs per resend.
+    Datagrams are fed straight into the server's transport, so no sockets are involved.
+
+    Usage: tally_server_bench [-n datagrams] [clients ...]
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#include <TallyServer.h>
+#include <QueueUdp.h>
+
+#define BENCH_BATCH QUEUE_UDP_CAPACITY  // Datagrams handled per TallyServer::runLoop()
+#define BENCH_IDLE_LOOPS 100000
+#define BENCH_FAN_OUT_SOURCES 40        // Tally by index and tally by source sources, as a big switcher has
+#define BENCH_FAN_OUT_CHANGES 200000    // Divided by the number of clients
+#define BENCH_RESEND_TIME 300           // Time (ms) the clients don't acknowledge anything
+#define BENCH_RESEND_TIMEOUT 10         // Resend timeout (ms) meanwhile
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static IPAddress clientIP(int client) {
+    return IPAddress(10, 0, client >> 8, client & 0xFF);
+}
+
+static int benchClients(int clients, unsigned long datagrams) {
+    QueueUDP udp;
+    TallyServer tallyServer;
+    tallyServer.setTransport(&udp);
+    tallyServer.begin(clients);
+    tallyServer.setTallySources(8);
+    tallyServer.setTallyFlag(0, 1);
+    tallyServer.runLoop();
+
+    // Handshake: hello, then the ack of the server's hello. The server answers with the tally data (packet ID 1) and an ack request (2)
+    for (int first = 0; first < clients; first += BENCH_BATCH / 2) {
+        for (int i = first; i < clients && i < first + BENCH_BATCH / 2; i++) {
+            udp.queue(clientIP(i), 50100 + i, TALLY_SERVER_FLAG_HELLO, 20, 0, 0);
+            udp.queue(clientIP(i), 50100 + i, TALLY_SERVER_FLAG_ACK, 12, 0, 0);
+        }
+        tallyServer.runLoop();
+    }
+    unsigned long handshakeSent = udp.packetsSent;
+    if (handshakeSent < (unsigned long)clients * 3) {
+        fprintf(stderr, "%d clients: only %lu handshake packets sent\n", clients, handshakeSent);
+        return 1;
+    }
+
+    // Every client acknowledges the server's packets and asks for an ack in turn, as a connected tally light does
+    uint16_t packetID = 1;
+    int client = 0;
+    unsigned long handled = 0;
+    uint64_t start = nowNs();
+    while (handled < datagrams) {
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            udp.queue(clientIP(client), 50100 + client, TALLY_SERVER_FLAG_ACK | TALLY_SERVER_FLAG_ACK_REQUEST, 12, 2, packetID);
+            if (++client == clients) {
+                client = 0;
+                packetID++;
+            }
+        }
+        tallyServer.runLoop();
+        handled += BENCH_BATCH;
+    }
+    uint64_t elapsed = nowNs() - start;
+
+    // All clients were just heard from, so none is due for a keepalive yet
+    start = nowNs();
+    for (int i = 0; i < BENCH_IDLE_LOOPS; i++) tallyServer.runLoop();
+    uint64_t idleElapsed = nowNs() - start;
+    unsigned long answers = udp.packetsSent - handshakeSent;
+
+    // Tally changes, sent to every client. Nothing is acknowledged, so resends are held off for the length of it
+    tallyServer.setResendTimeoutLimits(60000, 60000);
+    tallyServer.setTallySources(BENCH_FAN_OUT_SOURCES);
+    tallyServer.setTallyBySourceSources(BENCH_FAN_OUT_SOURCES);
+    for (int i = 0; i < BENCH_FAN_OUT_SOURCES; i++) tallyServer.setTallyBySourceFlag(i, i + 1, 0);
+    tallyServer.runLoop();
+    int changes = BENCH_FAN_OUT_CHANGES / clients;
+    unsigned long fanOutSent = udp.packetsSent;
+    start = nowNs();
+    for (int i = 0; i < changes; i++) {
+        tallyServer.setTallyFlag(i % BENCH_FAN_OUT_SOURCES, 0);
+        tallyServer.setTallyFlag((i + 1) % BENCH_FAN_OUT_SOURCES, 1);
+        tallyServer.runLoop();
+    }
+    uint64_t fanOutElapsed = nowNs() - start;
+    fanOutSent = udp.packetsSent - fanOutSent;
+    if (fanOutSent != (unsigned long)changes * clients) {
+        fprintf(stderr, "%d clients: %lu packets sent for %d changes\n", clients, fanOutSent, changes);
+        return 1;
+    }
+
+    // Resends of the tally data to clients that don't acknowledge it: the median over the runLoop() calls that sent something
+    tallyServer.setResendTimeoutLimits(BENCH_RESEND_TIMEOUT, BENCH_RESEND_TIMEOUT);
+    std::vector<double> resendCosts;
+    start = nowNs();
+    while (nowNs() - start < BENCH_RESEND_TIME * 1000000ULL) {
+        unsigned long before = udp.packetsSent;
+        uint64_t loopStart = nowNs();
+        tallyServer.runLoop();
+        uint64_t loopElapsed = nowNs() - loopStart;
+        if (udp.packetsSent != before) resendCosts.push_back((double)loopElapsed / (udp.packetsSent - before));
+    }
+    std::nth_element(resendCosts.begin(), resendCosts.begin() + resendCosts.size() / 2, resendCosts.end());
+
+    printf("%8d %12.1f %10lu %12.1f %14.1f %11.1f\n", clients, (double)elapsed / handled, answers, (double)idleElapsed / BENCH_IDLE_LOOPS, (double)fanOutElapsed / fanOutSent, resendCosts.empty() ? 0.0 : resendCosts[resendCosts.size() / 2]);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned long datagrams = 2000000;
+    int first = 1;
+
+    if (argc > 2 && !strcmp(argv[1], "-n")) {
+        datagrams = strtoul(argv[2], NULL, 10);
+        first = 3;
+    }
+
+    printf("%8s %12s %10s %12s %14s %11s\n", "clients", "ns/datagram", "answers", "ns/idle loop", "ns/client/cut", "ns/resend");
+
+    int result = 0;
+    if (first >= argc) {
+        const int defaultClients[] = { 5, 20, 100, 300, 1000 };
+        for (unsigned i = 0; i < sizeof(defaultClients) / sizeof(defaultClients[0]); i++) result |= benchClients(defaultClients[i], datagrams);
+    } else {
+        for (int i = first; i < argc; i++) result |= benchClients(atoi(argv[i]), datagrams);
+    }
+    return result;
+}
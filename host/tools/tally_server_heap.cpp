@@ -0,0 +1,168 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Check that a TallyServer takes no heap memory once it has begun. Its clients connect, a flood
+    of tally lights from other addresses that don't fit says hello and is turned away, the tally
+    changes, the number of sources changes within what was reserved, and the clients time out and
+    connect again, all while every malloc(), calloc(), realloc() and free() in the process is counted.
+    Datagrams are fed straight into the server's transport, so no sockets are involved.
+
+    Exits with 1 if anything was allocated or freed after begin().
+
+    Usage: tally_server_heap [-c clients] [-n hellos]
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <TallyServer.h>
+#include <QueueUdp.h>
+
+#define HEAP_SOURCES 20             // Sources set after begin()
+#define HEAP_RESERVED_SOURCES 64    // Sources reserved before begin()
+#define HEAP_CLIENT_TIMEOUT 20      // ms, short so the clients can be made to time out
+#define HEAP_RECONNECT_EVERY 8      // Rounds between the clients timing out and connecting again
+
+// Every heap operation in the process goes through here, operator new included, as it calls malloc()
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+extern "C" void __libc_free(void *p);
+
+static unsigned long heapOperations = 0;
+
+extern "C" void *malloc(size_t size) {
+    heapOperations++;
+    return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t count, size_t size) {
+    heapOperations++;
+    return __libc_calloc(count, size);
+}
+extern "C" void *realloc(void *p, size_t size) {
+    heapOperations++;
+    return __libc_realloc(p, size);
+}
+extern "C" void free(void *p) {
+    if (p) heapOperations++;
+    __libc_free(p);
+}
+
+static QueueUDP udp; // Too big for the stack
+
+static IPAddress clientIP(int client) {
+    return IPAddress(10, 0, client >> 8, client & 0xFF);
+}
+
+/**
+ * Hello, then the ack of the server's hello, from each client. The server answers with the tally data (packet ID 1) and an ack request (2)
+ */
+static void connectClients(TallyServer &tallyServer, int clients) {
+    for (int i = 0; i < clients; i++) {
+        udp.queue(clientIP(i), 50100 + i, TALLY_SERVER_FLAG_HELLO, 20, 0, 0);
+        udp.queue(clientIP(i), 50100 + i, TALLY_SERVER_FLAG_ACK, 12, 0, 0);
+    }
+    tallyServer.runLoop();
+}
+
+/**
+ * Set program on source program and preview on the next one, in the tally by index and by source
+ */
+static void setTally(TallyServer &tallyServer, int sources, int program) {
+    for (int i = 0; i < sources; i++) {
+        uint8_t flags = i == program ? 1 : i == (program + 1) % sources ? 2 : 0;
+        tallyServer.setTallyFlag(i, flags);
+        tallyServer.setTallyBySourceFlag(i, i + 1, flags);
+    }
+}
+
+int main(int argc, char **argv) {
+    int clients = TALLY_SERVER_DEFAULT_MAX_CLIENTS;
+    unsigned long hellos = 100000;
+
+    for (int arg = 1; arg + 1 < argc; arg += 2) {
+        if (!strcmp(argv[arg], "-c")) clients = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-n")) hellos = strtoul(argv[arg + 1], NULL, 10);
+    }
+    if (clients < 1 || clients > QUEUE_UDP_CAPACITY / 2) {
+        fprintf(stderr, "Usage: %s [-c clients] [-n hellos]\n", argv[0]);
+        return 2;
+    }
+    printf("%8s %10s %10s %10s %10s %16s %16s\n", "clients", "hellos", "rejected", "updates", "reconnects", "heap ops/begin", "heap ops/after");
+
+    unsigned long startupOperations = heapOperations;
+    TallyServer *tallyServer = new TallyServer(clients);
+    tallyServer->setTransport(&udp);
+    tallyServer->reserveTallySources(HEAP_RESERVED_SOURCES, HEAP_RESERVED_SOURCES);
+    tallyServer->setClientTimeout(HEAP_CLIENT_TIMEOUT);
+    tallyServer->begin();
+    startupOperations = heapOperations - startupOperations;
+
+    unsigned long start = heapOperations;
+    int sources = HEAP_SOURCES;
+    tallyServer->setTallySources(sources);
+    tallyServer->setTallyBySourceSources(sources);
+    setTally(*tallyServer, sources, 0);
+    connectClients(*tallyServer, clients);
+
+    unsigned long sent = 0;
+    unsigned long rejected = 0;
+    unsigned long updates = 0;
+    unsigned long reconnects = 0;
+    uint16_t packetID = 1;
+    for (unsigned long hello = 0, round = 1; hello < hellos; round++) {
+        // The flood: hellos from addresses that weren't seen before, all turned away as the server is full
+        uint16_t batch = 0;
+        for (; batch < QUEUE_UDP_CAPACITY && hello < hellos; batch++, hello++) {
+            udp.queue(IPAddress(10, 1 + (hello >> 16), hello >> 8, hello), 40000 + (hello & 0x3FFF), TALLY_SERVER_FLAG_HELLO, 20, 0, 0);
+        }
+        sent = udp.packetsSent;
+        tallyServer->runLoop();
+        if (udp.packetsSent - sent == batch && udp.lastSent[12] == TALLY_SERVER_CONNECTION_REJECTED) rejected += batch;
+
+        // The clients keep their sessions up while the tally changes, within the sources reserved
+        packetID++;
+        for (int i = 0; i < clients; i++) udp.queue(clientIP(i), 50100 + i, TALLY_SERVER_FLAG_ACK | TALLY_SERVER_FLAG_ACK_REQUEST, 12, 0, packetID);
+        if (round % 2 == 0) {
+            sources = sources == HEAP_SOURCES ? HEAP_RESERVED_SOURCES : HEAP_SOURCES;
+            tallyServer->setTallySources(sources);
+            tallyServer->setTallyBySourceSources(sources);
+        }
+        setTally(*tallyServer, sources, round % sources);
+        tallyServer->runLoop();
+        updates++;
+
+        // Every so often they all go quiet, time out, and connect again
+        if (round % HEAP_RECONNECT_EVERY == 0) {
+            usleep((HEAP_CLIENT_TIMEOUT + 5) * 1000);
+            tallyServer->runLoop();
+            connectClients(*tallyServer, clients);
+            packetID = 1;
+            reconnects++;
+        }
+    }
+    tallyServer->end();
+    unsigned long afterOperations = heapOperations - start;
+
+    delete tallyServer;
+
+    printf("%8d %10lu %10lu %10lu %10lu %16lu %16lu\n", clients, hellos, rejected, updates, reconnects, startupOperations, afterOperations);
+    return afterOperations == 0 && rejected == hellos ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/*
+Copyright (C) 2023 Aron N. Het Lam, aronhetlam@gmail.com
+
+This file is a part of the host (Linux) build of the ATEM tally light libraries.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Connect a number of ATEMmin clients to a TallyServer on a simulated network, each with a tally
+    number of its own, cut to the next of the sources a number of times, and report the packets and
+    bytes the server sent per cut, how many datagrams each client had to wake up for per cut, and how
+    many clients had the right tally for their own tally number. First with all clients getting all
+    tally data, then with each one subscribed to its own tally number (ATEMbase::setTallySubscription()).
+
+    Usage: tally_subscribe [-c clients] [-u updates] [-s sources]
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <ATEMmin.h>
+#include <SimUdp.h>
+#include <TallyServer.h>
+
+/**
+ * SimUDP that counts the datagrams it sends and receives, and the bytes it sends
+ */
+class CountingUDP : public SimUDP {
+public:
+    unsigned long packetsSent;
+    unsigned long bytesSent;
+    unsigned long packetsReceived;
+
+    CountingUDP(SimNetwork *network, IPAddress ip) : SimUDP(network, ip), packetsSent(0), bytesSent(0), packetsReceived(0) { }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+        bytesSent += size;
+        return SimUDP::write(buffer, size);
+    }
+    using SimUDP::write;
+
+    int endPacket() {
+        packetsSent++;
+        return SimUDP::endPacket();
+    }
+
+    int parsePacket() {
+        int size = SimUDP::parsePacket();
+        if (size > 0) packetsReceived++;
+        return size;
+    }
+};
+
+/**
+ * Set program on source program and preview on the next one
+ */
+static void setTally(TallyServer &tallyServer, int sources, int program) {
+    for (int i = 0; i < sources; i++) tallyServer.setTallyFlag(i, i == program ? 1 : i == (program + 1) % sources ? 2 : 0);
+}
+
+static void runFor(TallyServer &tallyServer, ATEMmin *clients, int count, unsigned long ms) {
+    unsigned long start = millis();
+    while (millis() - start < ms) {
+        tallyServer.runLoop();
+        for (int i = 0; i < count; i++) clients[i].runLoop();
+        usleep(100);
+    }
+}
+
+static int run(bool subscribe, int count, int updates, int sources) {
+    SimNetwork network;
+    network.setLatency(500);
+    IPAddress serverIP(10, 0, 0, 1);
+    CountingUDP serverUdp(&network, serverIP);
+    TallyServer tallyServer;
+    tallyServer.setTransport(&serverUdp);
+    tallyServer.begin(count);
+    tallyServer.setTallySources(sources);
+    setTally(tallyServer, sources, 0);
+
+    CountingUDP **clientUdp = new CountingUDP *[count];
+    ATEMmin *clients = new ATEMmin[count];
+    for (int i = 0; i < count; i++) {
+        clientUdp[i] = new CountingUDP(&network, IPAddress(10, 0, 1 + (i >> 8), i & 0xFF));
+        clients[i].setTransport(clientUdp[i]);
+        clients[i].begin(serverIP);
+        uint16_t tallyNo = i % sources;
+        if (subscribe) clients[i].setTallySubscription(&tallyNo, 1);
+    }
+    runFor(tallyServer, clients, count, 500);
+
+    int confirmed = 0;
+    for (int i = 0; i < count; i++) confirmed += subscribe && clients[i].isTallySubscriptionConfirmed();
+
+    unsigned long packets = serverUdp.packetsSent;
+    unsigned long bytes = serverUdp.bytesSent;
+    unsigned long wakeupsBefore = 0;
+    for (int i = 0; i < count; i++) wakeupsBefore += clientUdp[i]->packetsReceived;
+    int right = 0;
+    for (int update = 1; update <= updates; update++) {
+        int program = update % sources;
+        setTally(tallyServer, sources, program);
+        runFor(tallyServer, clients, count, 50);
+
+        for (int i = 0; i < count; i++) {
+            int tallyNo = i % sources;
+            right += clients[i].getTallyByIndexTallyFlags(tallyNo) == (tallyNo == program ? 1 : tallyNo == (program + 1) % sources ? 2 : 0);
+        }
+    }
+    packets = serverUdp.packetsSent - packets;
+    bytes = serverUdp.bytesSent - bytes;
+    unsigned long wakeups = 0;
+    for (int i = 0; i < count; i++) wakeups += clientUdp[i]->packetsReceived;
+    wakeups -= wakeupsBefore;
+
+    delete[] clients;
+    for (int i = 0; i < count; i++) delete clientUdp[i];
+    delete[] clientUdp;
+
+    printf("%-11s %8d %8d %8d %10d %16.2f %16.1f %16.2f %16.2f\n", subscribe ? "subscribed" : "all", count, sources, updates, confirmed,
+           (double)packets / updates, (double)bytes / updates, (double)wakeups / count / updates, (double)right / updates);
+    return right == count * updates && (!subscribe || confirmed == count) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int count = 20;
+    int updates = 40;
+    int sources = 20;
+
+    for (int arg = 1; arg + 1 < argc; arg += 2) {
+        if (!strcmp(argv[arg], "-c")) count = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-u")) updates = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-s")) sources = atoi(argv[arg + 1]);
+    }
+    if (count < 1 || updates < 1 || sources < 2) {
+        fprintf(stderr, "Usage: %s [-c clients] [-u updates] [-s sources]\n", argv[0]);
+        return 2;
+    }
+
+    printf("%-11s %8s %8s %8s %10s %16s %16s %16s %16s\n", "mode", "clients", "sources", "updates", "confirmed", "packets/update", "bytes/update", "wakeups/client", "clients right");
+    int result = run(false, count, updates, sources);
+    result |= run(true, count, updates, sources);
+    return result;
+}
@@ -33,7 +33,29 @@ you can keep a clear conscience: http://skaarhoj.com/about/licenses/
 /**
  * Constructor
  */
-ATEMbase::ATEMbase(){}
+ATEMbase::ATEMbase() : _Udp(&_defaultUdp) {
+	#if ATEM_wholeDatagram
+	_multicastUdp = &_defaultMulticastUdp;
+	_multicastPort = 0;
+	_multicastAckPending = false;
+	#endif
+	_hasTallyVersion = false;
+	_tallyVersionAckPending = false;
+	_tallyVersionStale = false;
+	_subscribedIndexCount = 0;
+	_subscriptionConfirmed = true;
+	_subscriptionAckPending = false;
+
+	// Session statistics run across begin(), which a sketch may call again to reconnect
+	_isConnected = false;
+	_connectTime = 0;
+	_reconnectBackoff = ATEM_reconnectBackoffMin;
+	_reconnectDelay = 0;
+	_sessionCount = 0;
+	_reconnectCount = 0;
+	_timeToReconnect = 0;
+	_sessionLostAt = 0;
+}
 
 /**
  * Setting up IP address for the switcher (and local port to send packets from)
@@ -50,21 +72,45 @@ void ATEMbase::begin(const IPAddress ip, const uint16_t localPort){
 		// Set up Udp communication object:
 	#if defined ESP8266 || defined ESP32
 	WiFiUDP Udp;
-	#else
+	#elif defined ARDUINO
 	EthernetUDP Udp;
+	#else
+	PosixUDP Udp;
 	#endif
 
-	_Udp = Udp;
+	_defaultUdp = Udp;
+	_stopMulticast();
 	
 	_switcherIP = ip;			// Set switcher IP address
 	_localPort = localPort;		// Set default local port
 
 	_lastContact = 0;
+	_packetReceivedTime = 0;
 	_serialOutput = 0;
+
+	_livenessTimeout = ATEM_livenessTimeout;
 	
 	resetCommandBundle();
 }
 
+/**
+ * Use another UDP transport than the built-in WiFi/Ethernet one, e.g. a socket on a host
+ * build or a recorded-traffic replay. Call before connect(); the object must outlive this one.
+ */
+void ATEMbase::setTransport(UDP *udp){
+	_Udp = udp;
+}
+
+/**
+ * Use another UDP transport for multicasts from a tally server than the built-in one. Needs ATEM_wholeDatagram.
+ * Call before connect(); the object must outlive this one.
+ */
+void ATEMbase::setMulticastTransport(UDP *udp){
+	#if ATEM_wholeDatagram
+	_multicastUdp = udp;
+	#endif
+}
+
 /**
  * Initiating connection handshake to the ATEM switcher
  */
@@ -84,11 +130,25 @@ void ATEMbase::connect(const boolean useFixedPortNumber) {
 	_isRejected = false;			// Will be true if the connection was rejected during hello-package handshakes.
 	_sessionID = 0x53AB;			// Temporary session ID - a new will be given back from ATEM.
 	_lastContact = millis();  		// Setting this, because even though we haven't had contact, it constitutes an attempt that should be responded to at least
-	memset(_missedInitializationPackages, 0xFF, (ATEM_maxInitPackageCount+7)/8);
-	_initPayloadSentAtPacketId = ATEM_maxInitPackageCount;	// The max value it can be
+	memset(_initWindow, 0, ATEM_initWindowPackages/8);
+	_initWindowBase = 1;			// The initialization packages start at Remote Packet ID 1
+	_initPayloadSentAtPacketId = 0;
+	waitingForIncoming = false;
+	_stopMulticast();				// The switcher tells the new session again if it multicasts
+	_hasTallyVersion = false;		// ...and the version of its tally data
+	_subscriptionConfirmed = _subscribedIndexCount == 0;	// A tally server sends all tally data until told otherwise
+	_subscriptionAckPending = false;
+	_tallyVersionAckPending = false;
+	_probesSent = 0;
+	_connectTime = millis();
+	_reconnectDelay = _reconnectBackoff/2 + random(_reconnectBackoff/2 + 1);
+	if (_sessionCount == 0)	{
+		_sessionLostAt = _connectTime;	// Connecting the first time counts as losing the session before it
+	}
+	_sessionCount++;
 	uint16_t portNumber = useFixedPortNumber ? _localPort : random(50100,65300);
 
-	_Udp.begin(portNumber);		
+	_Udp->begin(portNumber);		
 
 		
 	// Send connectString to ATEM:
@@ -127,27 +187,44 @@ void ATEMbase::runLoop(uint16_t delayTime) {
 
 	do {
 		while(true) {	// Iterate until UDP buffer is empty
-			uint16_t packetSize = _Udp.parsePacket();
-			if (_Udp.available())   {  	
-				_Udp.read(_packetBuffer,12);	// Read header
-				 _sessionID = word(_packetBuffer[2], _packetBuffer[3]);
-				 uint8_t headerBitmask = _packetBuffer[0]>>3;
-				 _lastRemotePacketID = word(_packetBuffer[10],_packetBuffer[11]);
-			 	 if (_lastRemotePacketID < ATEM_maxInitPackageCount)	{
-			 	 	_missedInitializationPackages[_lastRemotePacketID>>3] &= ~(B1<<(_lastRemotePacketID&0x07));
+			boolean ackRequested = false;
+			uint16_t packetSize = _Udp->parsePacket();
+			if (_Udp->available())   {  	
+				_packetReceivedTime = micros();
+				_probesSent = 0;
+				#if ATEM_wholeDatagram
+				_Udp->read(_datagramBuffer, ATEM_datagramBufferLength);	// Read the whole datagram at once
+				const uint8_t *header = _datagramBuffer;
+				#else
+				_Udp->read(_packetBuffer,12);	// Read header
+				const uint8_t *header = _packetBuffer;
+				#endif
+				 _sessionID = word(header[2], header[3]);
+				 uint8_t headerBitmask = header[0]>>3;
+				 _lastRemotePacketID = word(header[10],header[11]);
+			 	 if (!_hasInitialized)	{
+			 	 	_markInitPackageReceived(_lastRemotePacketID);
 			 	 }
 
-				 uint16_t packetLength = word(_packetBuffer[0] & B00000111, _packetBuffer[1]);
+				 uint16_t packetLength = word(header[0] & B00000111, header[1]);
 
 			    if (packetSize==packetLength) {  // Just to make sure these are equal, they should be!
 					_lastContact = millis();
-					waitingForIncoming = false;
 	
 					if (headerBitmask & ATEM_headerCmd_HelloPacket)	{	// Respond to "Hello" packages:
+						if (!_isConnected)	{
+							_timeToReconnect = _lastContact - _sessionLostAt;
+							_reconnectBackoff = ATEM_reconnectBackoffMin;
+						}
 						_isConnected = true;
 					
-						_Udp.read(_packetBuffer, 1); // Read 13th byte to get hello packet type.
-						_isRejected = _packetBuffer[0] == 3; // _packetBuffer[12]	The ATEM will return a "2" in this return package of same length. If the ATEM returns "3" it means "fully booked" (no more clients can connect) and a "4" seems to be a kind of reconnect (seen when you drop the connection and the ATEM desperately tries to figure out what happened...)
+						#if ATEM_wholeDatagram
+						uint8_t helloType = header[12];
+						#else
+						_Udp->read(_packetBuffer, 1); // Read 13th byte to get hello packet type.
+						uint8_t helloType = _packetBuffer[0];
+						#endif
+						_isRejected = helloType == 3; // _packetBuffer[12]	The ATEM will return a "2" in this return package of same length. If the ATEM returns "3" it means "fully booked" (no more clients can connect) and a "4" seems to be a kind of reconnect (seen when you drop the connection and the ATEM desperately tries to figure out what happened...)
 						// _packetBuffer[15]	This number seems to increment with about 3 each time a new client tries to connect to ATEM. It may be used to judge how many client connections has been made during the up-time of the switcher?
 						
 						_wipeCleanPacketBuffer();
@@ -180,9 +257,7 @@ void ATEMbase::runLoop(uint16_t delayTime) {
 					} 
 
 					if ((headerBitmask & ATEM_headerCmd_AckRequest) && !(headerBitmask & ATEM_headerCmd_Resend)) { 	// Respond to request for acknowledge	(and to resends also, whatever...  
-						_wipeCleanPacketBuffer();
-						_createCommandHeader(ATEM_headerCmd_Ack, 12, _lastRemotePacketID);
-						_sendPacketBuffer(12); 
+						ackRequested = true;	// Sent once the packet is parsed, so it can acknowledge the tally data in it too
 					
 						#if ATEM_debug 
 				        if (_serialOutput & 0x80) {
@@ -203,8 +278,8 @@ void ATEMbase::runLoop(uint16_t delayTime) {
 							Serial.println(F(" - ACK!"));
 						} 
 					} else if((headerBitmask & ATEM_headerCmd_RequestNextAfter)) {	// ATEM is requesting a previously sent package which must have dropped out of the order. We return an empty one so the ATEM doesnt' crash (which some models will, if it doesn't get an answer before another 63 commands gets sent from the controller.)
-						uint8_t b1 = _packetBuffer[6];
-						uint8_t b2 = _packetBuffer[7];
+						uint8_t b1 = header[6];
+						uint8_t b2 = header[7];
 						_wipeCleanPacketBuffer();
 						_createCommandHeader(ATEM_headerCmd_Ack, 12, 0);
 						_packetBuffer[0] = ATEM_headerCmd_AckRequest << 3;	// Overruling this. A small trick because createCommandHeader shouldn't increment local package ID counter
@@ -237,6 +312,9 @@ void ATEMbase::runLoop(uint16_t delayTime) {
 					if (!(headerBitmask & ATEM_headerCmd_HelloPacket) && packetLength>12)	{
 						_parsePacket(packetLength);
 					}
+					if (ackRequested)	{
+						_sendAck(_lastRemotePacketID);
+					}
 			    } else {
 					#if ATEM_debug
 					if (_serialOutput & 0x80) 	{
@@ -247,18 +325,52 @@ void ATEMbase::runLoop(uint16_t delayTime) {
 					}
 					#endif
 					// Flushing:
-			        while(_Udp.available()) {
-			        	_Udp.read(_packetBuffer, ATEM_packetBufferLength);
+			        while(_Udp->available()) {
+			        	_Udp->read(_packetBuffer, ATEM_packetBufferLength);
 			        }
 			    }
 			} else break;
 		}
 
+		#if ATEM_wholeDatagram
+		// Tally data a tally server multicasts to all its clients at once. It's outside of the session, so it has its own sequence number:
+		while (_multicastPort && _multicastUdp->parsePacket())	{
+			uint16_t packetSize = _multicastUdp->available();
+			_multicastUdp->read(_datagramBuffer, ATEM_datagramBufferLength);
+			uint16_t packetLength = word(_datagramBuffer[0] & B00000111, _datagramBuffer[1]);
+			uint16_t seq = word(_datagramBuffer[10], _datagramBuffer[11]);
+
+			if (packetSize == packetLength && packetLength > 12 && _multicastUdp->remoteIP() == _switcherIP && (int16_t)(seq - _multicastSeq) >= 0)	{	// Only from our own server, and not older than what we have
+				if (seq != _multicastSeq)	{	// The same tally data may have come in the session already
+					_packetReceivedTime = micros();
+					_multicastSeq = seq;
+					_parsePacket(packetLength);
+				}
+
+				// Acknowledge it in the session, so the server doesn't need to send it to us on its own
+				_multicastAckPending = true;
+				_sendAck(_lastRemotePacketID);
+			}
+		}
+		#endif
+
+		// A subscription changed in a session with a tally server goes out right away, in an ack of the last packet again
+		if (_subscriptionAckPending && _hasTallyVersion)	{
+			_sendAck(_lastRemotePacketID);
+		}
+
 		// After initialization, we check which packages were missed and ask for them:
-		if (!_hasInitialized && _initPayloadSent && !waitingForIncoming)	{
-			for(uint8_t i=1; i<_initPayloadSentAtPacketId; i++)	{
-				if(i <= ATEM_maxInitPackageCount) {
-					if (_missedInitializationPackages[i>>3] & (B1<<(i & 0x7)))	{
+		if (!_hasInitialized && _initPayloadSent)	{
+			if (_initWindowBase >= _initPayloadSentAtPacketId)	{	// Everything before the end of the initialization payload is here
+				_hasInitialized = true;
+				if (_serialOutput) {
+					Serial.println(F("ATEM _hasInitialized = TRUE"));
+				}
+			} else if (!waitingForIncoming || hasTimedOut(_resendRequestTime, ATEM_resendRequestInterval))	{
+				// Ask for all missing packages in one go, so they come back within one round trip instead of one round trip each
+				uint16_t windowEnd = _initWindowBase + ATEM_initWindowPackages;
+				for(uint16_t i=_initWindowBase; i<_initPayloadSentAtPacketId && i<windowEnd; i++)	{
+					if (!_isInitPackageReceived(i))	{
 
 						#if ATEM_debug
 						if (_serialOutput & 0x80) 	{
@@ -273,28 +385,88 @@ void ATEMbase::runLoop(uint16_t delayTime) {
 					    _packetBuffer[8] = 0x01;
 					
 						_sendPacketBuffer(12);  
-						waitingForIncoming = true;
-						break;
 					}
-				} else {
-					break;
-				}
-			}
-			if (!waitingForIncoming)	{
-				_hasInitialized = true;
-				if (_serialOutput) {
-					Serial.println(F("ATEM _hasInitialized = TRUE"));
 				}
+				waitingForIncoming = true;
+				_resendRequestTime = millis();
 			}
 		}
 	} while (delayTime>0 && !hasTimedOut(enterTime,delayTime));
 	
 
-    // If connection is gone anyway, try to reconnect:
-	if (hasTimedOut(_lastContact, 5000))	{
-      if (_serialOutput) Serial.println(F("Connection to ATEM Switcher has timed out - reconnecting!"));
-      connect();
-    }	
+	if (_isConnected)	{
+		// A quiet switcher is probed with empty packages it must acknowledge, so a dead session is found well before the liveness timeout:
+		if (hasTimedOut(_lastContact, _livenessTimeout) || (_probesSent >= ATEM_probeLimit && hasTimedOut(_lastProbe, _livenessTimeout/20)))	{
+			_sessionLost();
+		} else if (_probesSent < ATEM_probeLimit && hasTimedOut(_lastContact, _livenessTimeout/5*2) && (!_probesSent || hasTimedOut(_lastProbe, _livenessTimeout/20)))	{
+			_wipeCleanPacketBuffer();
+			_createCommandHeader(ATEM_headerCmd_AckRequest, 12);
+			_sendPacketBuffer(12);
+			_probesSent++;
+			_lastProbe = millis();
+		}
+	} else if (hasTimedOut(_connectTime, _reconnectDelay))	{
+		// No answer to the hello package; try again, waiting longer every time
+		_reconnectBackoff = _reconnectBackoff < ATEM_reconnectBackoffMax/2 ? _reconnectBackoff*2 : ATEM_reconnectBackoffMax;
+		connect();
+	}
+}
+
+/**
+ * Start receiving tally data multicast (or broadcast, if address isn't a multicast one) to port by a tally server.
+ * seq is the sequence number of its last multicast, which the tally data from the session is as new as.
+ */
+void ATEMbase::_beginMulticast(IPAddress address, uint16_t port, uint16_t seq)	{
+	#if ATEM_wholeDatagram
+	if (_subscribedIndexCount)	return;	// Multicasts have all tally data, and wake us up for every change. The tally server doesn't count on us taking them.
+	if (address != _multicastIP || port != _multicastPort)	{
+		_stopMulticast();
+		uint8_t result;
+		if (address[0] < 224 || address[0] > 239)	{
+			result = _multicastUdp->begin(port);	// Broadcast, just listen on the port
+		}
+		#if defined ESP8266
+		else if (_multicastUdp == &_defaultMulticastUdp)	{
+			result = _defaultMulticastUdp.beginMulticast(IPAddress(0,0,0,0), address, port);
+		}
+		#endif
+		else {
+			result = _multicastUdp->beginMulticast(address, port);
+		}
+		if (!result)	return;		// No multicasts then. They won't be acknowledged, so the tally server sends tally data in the session.
+
+		_multicastIP = address;
+		_multicastPort = port;
+		_multicastSeq = seq;
+		if (_serialOutput) 	{
+	  		Serial.print(F("Receiving tally data multicast to "));
+			Serial.print(address);
+			Serial.print(F(":"));
+			Serial.println(port);
+		}
+	} else if ((int16_t)(seq - _multicastSeq) > 0)	{
+		_multicastSeq = seq;
+	}
+	#endif
+}
+
+void ATEMbase::_stopMulticast()	{
+	#if ATEM_wholeDatagram
+	if (_multicastPort)	{
+		_multicastUdp->stop();
+		_multicastPort = 0;
+	}
+	#endif
+}
+
+/**
+ * The session is dead: set up a new one right away
+ */
+void ATEMbase::_sessionLost()	{
+	if (_serialOutput) Serial.println(F("Connection to ATEM Switcher has timed out - reconnecting!"));
+	_reconnectCount++;
+	_sessionLostAt = _lastContact;
+	connect();
 }
 
 /**
@@ -311,6 +483,37 @@ uint16_t ATEMbase::getSessionID() {
 	return _sessionID;
 }
 
+/**
+ * Returns the time (micros) the datagram being parsed, or else the last one, was read from the UDP transport.
+ * Meant for measuring latency from the change notifications of derived classes.
+ */
+unsigned long ATEMbase::getPacketReceivedTime() {
+	return _packetReceivedTime;
+}
+
+/**
+ * Sets the time (ms) without contact before the session is considered dead and a new one is set up.
+ * A session gone quiet is probed from 2/5 of this time on, so a dead one is usually found sooner.
+ */
+void ATEMbase::setLivenessTimeout(uint16_t timeout) {
+	_livenessTimeout = timeout;
+}
+
+/**
+ * Returns the number of times the session was found dead and a new one set up
+ */
+uint16_t ATEMbase::getReconnectCount() {
+	return _reconnectCount;
+}
+
+/**
+ * Returns the time (ms) it took to get the last session up: from the last contact in the session
+ * found dead (or connecting the first time) until the switcher answered the hello package.
+ */
+unsigned long ATEMbase::getTimeToReconnect() {
+	return _timeToReconnect;
+}
+
 /**
  * If true, we had a response from the switcher when trying to send a hello packet.
  */
@@ -332,6 +535,30 @@ bool ATEMbase::isRejected() {
 	return _isRejected;
 }
 
+/**
+ * Subscribe to only the given tally indexes (up to ATEM_maxSubscribedIndexes) at a tally server, so it only sends
+ * their tally flags, and only when they change. count 0 subscribes to all tally data again. The subscription goes
+ * in every ack package (TlSb) in a session with a tally server until it's confirmed; switchers are never sent it.
+ * While subscribed, the tally by source and the other tally indexes aren't kept up to date, and multicasts aren't taken.
+ */
+void ATEMbase::setTallySubscription(const uint16_t *indexes, uint8_t count)	{
+	if (count > ATEM_maxSubscribedIndexes)	count = 0;	// Too many to filter on
+	if (count == _subscribedIndexCount && !memcmp(indexes, _subscribedIndexes, count * sizeof(uint16_t)))	return;
+
+	memcpy(_subscribedIndexes, indexes, count * sizeof(uint16_t));
+	_subscribedIndexCount = count;
+	_subscriptionConfirmed = false;
+	_subscriptionAckPending = _hasTallyVersion;
+	if (count)	_stopMulticast();
+}
+
+/**
+ * If true, the tally server confirmed the subscription set with setTallySubscription() in this session
+ */
+bool ATEMbase::isTallySubscriptionConfirmed()	{
+	return _subscriptionConfirmed;
+}
+
 
 
 
@@ -367,9 +594,83 @@ void ATEMbase::_createCommandHeader(const uint8_t headerCmd, const uint16_t leng
     }
 }
 void ATEMbase::_sendPacketBuffer(uint8_t length)	{
-	_Udp.beginPacket(_switcherIP,  9910);
-	_Udp.write(_packetBuffer,length);
-	_Udp.endPacket(); 	// TODO: Figure out why this may hang!!
+	_Udp->beginPacket(_switcherIP,  9910);
+	_Udp->write(_packetBuffer,length);
+	_Udp->endPacket(); 	// TODO: Figure out why this may hang!!
+}
+
+/**
+ * Sends an ack package for remotePacketID, with the acknowledgements for a tally server that are pending:
+ * TlMa for the last multicast, and TlVa for the version of the tally data
+ */
+void ATEMbase::_sendAck(uint16_t remotePacketID)	{
+	_wipeCleanPacketBuffer();
+	uint8_t length = 12;
+	#if ATEM_wholeDatagram
+	if (_multicastAckPending)	{
+		_packetBuffer[length+1] = 10;	// Command length
+		_packetBuffer[length+4] = 'T';
+		_packetBuffer[length+5] = 'l';
+		_packetBuffer[length+6] = 'M';
+		_packetBuffer[length+7] = 'a';
+		_packetBuffer[length+8] = highByte(_multicastSeq);
+		_packetBuffer[length+9] = lowByte(_multicastSeq);
+		length += 10;
+		_multicastAckPending = false;
+	}
+	#endif
+	if (_tallyVersionAckPending)	{
+		_packetBuffer[length+1] = 10;
+		_packetBuffer[length+4] = 'T';
+		_packetBuffer[length+5] = 'l';
+		_packetBuffer[length+6] = 'V';
+		_packetBuffer[length+7] = 'a';
+		_packetBuffer[length+8] = highByte(_tallyVersion);
+		_packetBuffer[length+9] = lowByte(_tallyVersion);
+		length += 10;
+		_tallyVersionAckPending = false;
+	}
+	if (!_subscriptionConfirmed && _hasTallyVersion)	{	// Only a tally server sends a version of its tally data
+		_packetBuffer[length+1] = 10 + 2*_subscribedIndexCount;
+		_packetBuffer[length+4] = 'T';
+		_packetBuffer[length+5] = 'l';
+		_packetBuffer[length+6] = 'S';
+		_packetBuffer[length+7] = 'b';
+		_packetBuffer[length+9] = _subscribedIndexCount;
+		for (uint8_t a = 0; a < _subscribedIndexCount; a++)	{
+			_packetBuffer[length+10+a*2] = highByte(_subscribedIndexes[a]);
+			_packetBuffer[length+11+a*2] = lowByte(_subscribedIndexes[a]);
+		}
+		length += 10 + 2*_subscribedIndexCount;
+		_subscriptionAckPending = false;
+	}
+	_createCommandHeader(ATEM_headerCmd_Ack, length, remotePacketID);
+	_sendPacketBuffer(length);
+}
+
+/**
+ * A tally server sent a version of its tally data (TlVr, or a delta to it): keep the newest, and acknowledge it.
+ * Tally data older than what we have is marked stale for the rest of the packet.
+ */
+void ATEMbase::_receivedTallyVersion(uint16_t version)	{
+	if (!_hasTallyVersion || (int16_t)(version - _tallyVersion) >= 0)	{
+		_tallyVersion = version;
+	} else {
+		_tallyVersionStale = true;
+	}
+	_hasTallyVersion = true;
+	_tallyVersionAckPending = true;
+}
+
+/**
+ * A tally server confirmed a subscription (TlSb): count tally indexes, 2 bytes each. If it's the one we want, it isn't sent anymore.
+ */
+void ATEMbase::_receivedTallySubscription(const uint8_t *indexes, uint16_t count)	{
+	if (count != _subscribedIndexCount)	return;
+	for (uint8_t a = 0; a < count; a++)	{
+		if (word(indexes[a*2], indexes[1+a*2]) != _subscribedIndexes[a])	return;
+	}
+	_subscriptionConfirmed = true;
 }
 
 /**
@@ -379,6 +680,31 @@ void ATEMbase::_wipeCleanPacketBuffer() {
 	memset(_packetBuffer, 0, ATEM_packetBufferLength);
 }
 
+/**
+ * Registers an initialization package as received, and moves the window on past all packages received in sequence
+ */
+void ATEMbase::_markInitPackageReceived(uint16_t packetID)	{
+	if (packetID < _initWindowBase || packetID - _initWindowBase >= ATEM_initWindowPackages)	{
+		return;		// Received before, or too far ahead to track yet. In the latter case it will be asked for again.
+	}
+	uint16_t bit = packetID % ATEM_initWindowPackages;
+	_initWindow[bit>>3] |= B1<<(bit & 0x07);
+
+	while (_isInitPackageReceived(_initWindowBase))	{
+		bit = _initWindowBase % ATEM_initWindowPackages;
+		_initWindow[bit>>3] &= ~(B1<<(bit & 0x07));	// Frees the bit for the package ATEM_initWindowPackages IDs later
+		_initWindowBase++;
+	}
+}
+
+/**
+ * Returns true if the initialization package has been received. Valid for IDs inside the window only.
+ */
+bool ATEMbase::_isInitPackageReceived(uint16_t packetID)	{
+	uint16_t bit = packetID % ATEM_initWindowPackages;
+	return _initWindow[bit>>3] & (B1<<(bit & 0x07));
+}
+
 /**
  * Reads from UDP channel to buffer. Will fill the buffer to the max or to the size of the current segment being parsed
  * Returns false if there are no more bytes, otherwise true 
@@ -387,22 +713,27 @@ bool ATEMbase::_readToPacketBuffer() {
 	return _readToPacketBuffer(ATEM_packetBufferLength);
 }
 bool ATEMbase::_readToPacketBuffer(uint8_t maxBytes) {
+	#if ATEM_wholeDatagram
+	_cmdPointer = _cmdLength-8;	// The command is already in _datagramBuffer, so there is nothing to read.
+	return false;
+	#else
 	maxBytes = maxBytes<=ATEM_packetBufferLength ? maxBytes : ATEM_packetBufferLength;
 	int remainingBytes = _cmdLength-8-_cmdPointer;
 
 	if (remainingBytes>0)	{
 		if (remainingBytes <= maxBytes)	{
-			_Udp.read(_packetBuffer, remainingBytes);
+			_Udp->read(_packetBuffer, remainingBytes);
 			_cmdPointer+= remainingBytes;
 			return false;	// Returns false if finished.
 		} else {
-			_Udp.read(_packetBuffer, maxBytes);
+			_Udp->read(_packetBuffer, maxBytes);
 			_cmdPointer+= maxBytes;
 			return true;	// Returns true if there are still bytes to be read.
 		}
 	} else {
 		return false;
 	}
+	#endif
 }
 
 /**
@@ -411,19 +742,44 @@ bool ATEMbase::_readToPacketBuffer(uint8_t maxBytes) {
  * Selected information is extracted in this function and transferred to internal variables in this library.
  */
 void ATEMbase::_parsePacket(uint16_t packetLength)	{
-	
+	_tallyVersionStale = false;
+	#if ATEM_wholeDatagram
+		// The whole datagram is in _datagramBuffer - walk the commands in place:
+	uint16_t indexPointer = 12;
+	while (indexPointer+8 <= packetLength)	{
+		_cmdLength = word(_datagramBuffer[indexPointer], _datagramBuffer[indexPointer+1]);
+		_cmdPointer = 0;
+
+		if (_cmdLength<=8 || indexPointer+_cmdLength > packetLength)	{
+			#if ATEM_debug 
+			if (_serialOutput & 0x80) Serial.println(F("Bad CMD length, skipping rest of packet..."));
+			#endif
+			break;
+		}
+
+		char cmdStr[] = { 
+			(char)_datagramBuffer[indexPointer+4], (char)_datagramBuffer[indexPointer+5], (char)_datagramBuffer[indexPointer+6], (char)_datagramBuffer[indexPointer+7], '\0'};
+		_cmdKey = ATEM_cmdKey(cmdStr[0], cmdStr[1], cmdStr[2], cmdStr[3]);
+		_cmdData = _datagramBuffer+indexPointer+8;
+		_parseGetCommands(cmdStr);
+
+		indexPointer+=_cmdLength;
+	}
+	#else
  		// If packet is more than an ACK packet (= if its longer than 12 bytes header), lets parse it:
       uint16_t indexPointer = 12;	// 12 bytes has already been read from the packet...
       while (indexPointer < packetLength)  {
 
         // Read the length of segment (first word):
-        _Udp.read(_packetBuffer, 8);
+        _Udp->read(_packetBuffer, 8);
         _cmdLength = word(_packetBuffer[0], _packetBuffer[1]);
 		_cmdPointer = 0;
+		_cmdData = _packetBuffer;
         
 			// Get the "command string", basically this is the 4 char variable name in the ATEM memory holding the various state values of the system:
         char cmdStr[] = { 
           _packetBuffer[4], _packetBuffer[5], _packetBuffer[6], _packetBuffer[7], '\0'};
+		_cmdKey = ATEM_cmdKey(_packetBuffer[4], _packetBuffer[5], _packetBuffer[6], _packetBuffer[7]);
 
 			// If length of segment larger than 8 (should always be...!)
         if (_cmdLength>8)  {
@@ -438,11 +794,12 @@ void ATEMbase::_parsePacket(uint16_t packetLength)	{
 			#endif
 		  
 			// Flushing the buffer:
-	          while(_Udp.available()) {
-	              _Udp.read(_packetBuffer, ATEM_packetBufferLength);
+	          while(_Udp->available()) {
+	              _Udp->read(_packetBuffer, ATEM_packetBufferLength);
 	          }
         }
       }
+	#endif
 }
 
 /**
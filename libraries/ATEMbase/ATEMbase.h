@@ -34,8 +34,10 @@ you can keep a clear conscience: http://skaarhoj.com/about/licenses/
 
 #if defined ESP8266 || defined ESP32
 #include <WiFiUdp.h>
-#else
+#elif defined ARDUINO
 #include <EthernetUdp.h>
+#else
+#include <PosixUdp.h>		// Host (Linux) build, see /host
 #endif
 
 #include <SkaarhojPgmspace.h>
@@ -46,21 +48,59 @@ you can keep a clear conscience: http://skaarhoj.com/about/licenses/
 #define ATEM_headerCmd_RequestNextAfter 0x8	// I'm requesting you to resend something to me.
 #define ATEM_headerCmd_Ack 0x10		// This package is an acknowledge to package id (byte 4-5) ATEM_headerCmd_AckRequest
 
-#define ATEM_maxInitPackageCount 40		// The maximum number of initialization packages. By observation on a 2M/E 4K can be up to (not fixed!) 32. We allocate a f more then...
+#define ATEM_initWindowPackages 256		// Size of the sliding window which tracks the initialization packages received. Dumps of any size are tracked, as the window moves on with every package received in sequence; packages arriving more than this many IDs after the oldest missing one are simply asked for again. Must be a multiple of 8.
+#define ATEM_resendRequestInterval 100	// Time (ms) to wait for missing initialization packages asked for, before asking for those still missing again
+#define ATEM_livenessTimeout 5000		// Default time (ms) without contact before the session is considered dead and a new one is set up. Can be changed with setLivenessTimeout()
+#define ATEM_probeLimit 3				// Number of unanswered probes after which the session is considered dead, before the liveness timeout has passed. Probing starts after 2/5 of the liveness timeout without contact, one probe every 1/20 of it.
+#define ATEM_reconnectBackoffMin 500	// Time (ms) to wait for the answer to a hello package before trying again. Doubles with every attempt not answered...
+#define ATEM_reconnectBackoffMax 4000	// ... up to this. Every wait is randomized between half and all of it, so a rack of tally lights doesn't hit a rebooted switcher all at once.
 #define ATEM_packetBufferLength 96		// Size of packet buffer
+#define ATEM_maxSubscribedIndexes 8		// Max number of tally indexes to subscribe to at a tally server, as TALLY_SERVER_MAX_SUBSCRIBED_INDEXES. The TlSb goes in ack packages, so it has to fit in the packet buffer along with TlMa and TlVa.
+
+#ifndef ATEM_wholeDatagram
+#define ATEM_wholeDatagram 1			// If "1" (true), each datagram is received whole into _datagramBuffer and its commands are parsed in place. "0" streams every command through _packetBuffer instead, which uses less RAM but truncates commands longer than the packet buffer.
+#endif
+#define ATEM_datagramBufferLength 2048	// Size of datagram buffer. The packet length in the ATEM header is 11 bits.
 
 #define ATEM_debug 0				// If "1" (true), more debugging information may hit the serial monitor, in particular when _serialDebug = 0x80. Setting this to "0" is recommended for production environments since it saves on flash memory.
 
 #define ATEM_maxPacketId 1<<15	// ATEM wraps ID at bit 15, not 16
 
+#define ATEM_cmdKey(a,b,c,d) (((uint32_t)(a)<<24) | ((uint32_t)(b)<<16) | ((uint32_t)(c)<<8) | (uint32_t)(d))	// 4 char command name as a 32 bit integer, so commands can be dispatched with switch/case. Compile time constant for literal chars.
+
 class ATEMbase
 {
   protected:
   	#if defined ESP8266 || defined ESP32
-  	WiFiUDP _Udp;
-  	#else
-	EthernetUDP _Udp;					// UDP object for communication, see constructor.
+  	WiFiUDP _defaultUdp;
+  	#elif defined ARDUINO
+	EthernetUDP _defaultUdp;
+	#else
+	PosixUDP _defaultUdp;
+	#endif
+	UDP *_Udp;							// UDP object for communication. Points to _defaultUdp unless another transport is set with setTransport()
+	#if ATEM_wholeDatagram
+  	#if defined ESP8266 || defined ESP32
+  	WiFiUDP _defaultMulticastUdp;
+  	#elif defined ARDUINO
+	EthernetUDP _defaultMulticastUdp;
+	#else
+	PosixUDP _defaultMulticastUdp;
+	#endif
+	UDP *_multicastUdp;					// UDP object for tally data a tally server multicasts (or broadcasts) to all its clients at once. Points to _defaultMulticastUdp unless set with setMulticastTransport()
+	IPAddress _multicastIP;
+	uint16_t _multicastPort;			// Port multicasts are received on. 0 if the switcher doesn't multicast.
+	uint16_t _multicastSeq;				// Sequence number of the last multicast parsed
+	boolean _multicastAckPending;		// The last multicast is to be acknowledged (TlMa) in the next ack package
 	#endif
+	boolean _hasTallyVersion;			// A tally server has sent a version of its tally data in this session
+	uint16_t _tallyVersion;				// Newest version of the tally data from a tally server. Deltas against it can be applied
+	boolean _tallyVersionAckPending;	// _tallyVersion is to be acknowledged (TlVa) in the next ack package
+	boolean _tallyVersionStale;			// The packet being parsed has older tally data than _tallyVersion, resent or out of order, so it's not used
+	uint16_t _subscribedIndexes[ATEM_maxSubscribedIndexes];	// Tally indexes to subscribe to at a tally server (TlSb), so it only sends those...
+	uint8_t _subscribedIndexCount;		// ...0 for all tally data
+	boolean _subscriptionConfirmed;		// The tally server confirmed the subscription in this session, or it's for all tally data as every session starts with
+	boolean _subscriptionAckPending;	// The subscription changed in a session with a tally server, so an ack package with it is sent right away
 	uint16_t _localPort; 				// Default local port to send from. Preferably it's chosen randomly inside the class.
 	IPAddress _switcherIP;				// IP address of the switcher
 	uint8_t _serialOutput;				// If set, the library will print status/debug information to the Serial object
@@ -68,21 +108,40 @@ class ATEMbase
 	// ATEM Connection Basics
 	uint16_t _localPacketIdCounter;  	// This is our counter for the command packages we might like to send to ATEM
 	boolean _initPayloadSent;  			// If true, the initial reception of the ATEM memory has passed and we can begin to respond during the runLoop()
-	uint8_t _initPayloadSentAtPacketId;	// The Remote Package ID at which point the initialization payload was completed.
+	uint16_t _initPayloadSentAtPacketId;	// The Remote Package ID at which point the initialization payload was completed.
 	boolean _hasInitialized;  			// If true, all initial payload packets has been received during requests for resent - and we are completely ready to rock!
 	boolean _isConnected;				// Set true if we have received a hello package from the switcher.
 	boolean _isRejected;				// Set true if the conencteion was rejected in hello package (due to connection limit).
 	uint16_t _sessionID;				// Session id of session, given by ATEM switcher
 	unsigned long _lastContact;			// Last time (millis) the switcher sent a packet to us.
+	unsigned long _packetReceivedTime;	// Time (micros) the datagram being parsed was read from the UDP transport
 	uint16_t _lastRemotePacketID;		// The most recent Remote Packet Id from switcher
-	uint8_t _missedInitializationPackages[(ATEM_maxInitPackageCount+7)/8];	// Used to track which initialization packages have been missed
+	uint16_t _initWindowBase;			// Oldest initialization package not received yet. All packages before it have been.
+	uint8_t _initWindow[ATEM_initWindowPackages/8];	// Bit set for each initialization package received from _initWindowBase on, indexed by package ID modulo ATEM_initWindowPackages
+	unsigned long _resendRequestTime;	// Last time (millis) missing initialization packages were asked for
+	uint16_t _livenessTimeout;			// Time (ms) without contact before the session is considered dead
+	uint8_t _probesSent;				// Number of probes sent since the last contact
+	unsigned long _lastProbe;			// Last time (millis) a probe was sent
+	unsigned long _connectTime;			// Last time (millis) a hello package was sent
+	uint16_t _reconnectBackoff;			// Current backoff (ms) between hello packages not answered
+	uint16_t _reconnectDelay;			// Time (ms) to wait for an answer to the last hello package: the backoff with jitter
+	uint16_t _sessionCount;				// Number of sessions set up, i.e. calls to connect()
+	uint16_t _reconnectCount;			// Number of sessions found dead and reconnected
+	unsigned long _sessionLostAt;		// Time (millis) of the last contact in the session found dead, or when connecting the first time
+	unsigned long _timeToReconnect;		// Time (ms) from _sessionLostAt until the switcher answered a hello package again
 	uint8_t _returnPacketLength;	
 	
 	// ATEM Buffer:
 	uint8_t _packetBuffer[ATEM_packetBufferLength];   		// Buffer for storing segments of the packets from ATEM and creating answer packets.
 
+	#if ATEM_wholeDatagram
+	uint8_t _datagramBuffer[ATEM_datagramBufferLength];	// Buffer holding the whole datagram currently being parsed
+	#endif
+
 	uint16_t _cmdLength;				// Used when parsing packets
 	uint16_t _cmdPointer;				// Used when parsing packets
+	uint32_t _cmdKey;					// Name of the command being parsed, as ATEM_cmdKey()
+	const uint8_t *_cmdData;			// Payload of the command being parsed (after its 8 byte header). Points into _datagramBuffer, or to _packetBuffer when streaming.
 
 	bool _cBundle;				// If set, we are building a set-command bundle.
 	uint8_t _cBBO;		// Bundle Buffer Offset; This is an offset if you want to add more commands.
@@ -96,6 +155,8 @@ class ATEMbase
     ATEMbase();
 	void begin(const IPAddress ip);
 	void begin(const IPAddress ip, const uint16_t localPort);
+	void setTransport(UDP *udp);
+	void setMulticastTransport(UDP *udp);
     void connect();
     void connect(const boolean useFixedPortNumber);
     void runLoop();
@@ -103,11 +164,19 @@ class ATEMbase
 		
 	uint16_t getATEM_lastRemotePacketId();
 	uint16_t getSessionID();
+	unsigned long getPacketReceivedTime();
+
+	void setLivenessTimeout(uint16_t timeout);
+	uint16_t getReconnectCount();
+	unsigned long getTimeToReconnect();
 	
 	bool isConnected();
 	bool hasInitialized();
 	bool isRejected();
 
+	void setTallySubscription(const uint16_t *indexes, uint8_t count);
+	bool isTallySubscriptionConfirmed();
+
   	void serialOutput(uint8_t level);
 	bool hasTimedOut(unsigned long time, unsigned long timeout);
 
@@ -133,6 +202,18 @@ class ATEMbase
   	void _createCommandHeader(const uint8_t headerCmd, const uint16_t lengthOfData, const uint16_t remotePacketID);
   	void _sendPacketBuffer(uint8_t length);
 	void _wipeCleanPacketBuffer();
+	void _sendAck(uint16_t remotePacketID);
+
+	void _receivedTallyVersion(uint16_t version);
+	void _receivedTallySubscription(const uint8_t *indexes, uint16_t count);
+
+	void _sessionLost();
+
+	void _beginMulticast(IPAddress address, uint16_t port, uint16_t seq);
+	void _stopMulticast();
+
+	void _markInitPackageReceived(uint16_t packetID);
+	bool _isInitPackageReceived(uint16_t packetID);
 
 	void _parsePacket(uint16_t packetLength);
 	virtual void _parseGetCommands(const char *cmdString);
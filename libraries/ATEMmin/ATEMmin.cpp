@@ -33,7 +33,123 @@ you can keep a clear conscience: http://skaarhoj.com/about/licenses/
 /**
  * Constructor (using arguments is deprecated! Use begin() instead)
  */
-ATEMmin::ATEMmin(){}
+ATEMmin::ATEMmin() : _tallyChangeCallback(NULL), _tallySourcesChangeCallback(NULL), _tallyBySourceChangeCallback(NULL), _programInputChangeCallback(NULL), _previewInputChangeCallback(NULL), _streamingStatusChangeCallback(NULL), _transitionChangeCallback(NULL) {
+	// Change notifications compare against these, so they must start out defined
+	memset(atemProgramInputVideoSource, 0, sizeof(atemProgramInputVideoSource));
+	memset(atemPreviewInputVideoSource, 0, sizeof(atemPreviewInputVideoSource));
+	atemTallyByIndexSources = 0;
+	atemTallyByIndexTallyFlags = NULL;
+	_tallyByIndexCapacity = 0;
+	atemTallyBySourceSources = 0;
+	atemTallyBySourceVideoSource = NULL;
+	atemTallyBySourceTallyFlags = NULL;
+	_tallyBySourceCapacity = 0;
+	_tallyBySourceTable = NULL;
+	_tallyBySourceTableBits = 0;
+	streamingStatusFlags = 0;
+	_firstTallySession = 0;
+	_timeToFirstTally = 0;
+	_relayID = 0;
+	_relayPathSession = 0;
+	_relayHops = 0;
+	_relayLooped = false;
+}
+
+ATEMmin::~ATEMmin() {
+	free(atemTallyByIndexTallyFlags);
+	free(atemTallyBySourceVideoSource);
+	free(atemTallyBySourceTallyFlags);
+	free(_tallyBySourceTable);
+}
+
+/**
+ * Makes room for the tally flags of this many sources. Returns false if there is not enough memory,
+ * in which case the room there was is kept.
+ */
+bool ATEMmin::_reserveTallyByIndex(uint16_t sources) {
+	if (sources <= _tallyByIndexCapacity)	return true;
+
+	uint32_t capacity = (sources + 15UL) & ~15UL;	// Grow in steps, as sources are usually added a few at a time
+	if (capacity > 0xFFFF)	capacity = 0xFFFF;		// ...but never past what _tallyByIndexCapacity holds
+	if (capacity <= _tallyByIndexCapacity)	return false;	// Nothing to realloc() to, and realloc() to 0 would free it
+	uint8_t *tallyFlags = (uint8_t *)realloc(atemTallyByIndexTallyFlags, capacity);
+	if (tallyFlags == NULL)	return false;
+	memset(tallyFlags + _tallyByIndexCapacity, 0, capacity - _tallyByIndexCapacity);
+
+	atemTallyByIndexTallyFlags = tallyFlags;
+	_tallyByIndexCapacity = capacity;
+	return true;
+}
+
+/**
+ * Makes room for the tally flags of this many video sources, and for their lookup table.
+ * Returns false if there is not enough memory, in which case the room there was is kept.
+ */
+bool ATEMmin::_reserveTallyBySource(uint16_t sources) {
+	if (sources <= _tallyBySourceCapacity)	return true;
+
+	uint32_t capacity = (sources + 15UL) & ~15UL;
+	if (capacity > 0xFFFF)	capacity = 0xFFFF;
+	if (capacity <= _tallyBySourceCapacity)	return false;
+	uint8_t bits = 5;
+	while ((1UL << bits) < 2UL*capacity)	bits++;
+
+	uint16_t *videoSources = (uint16_t *)malloc(capacity * sizeof(uint16_t));
+	uint8_t *tallyFlags = (uint8_t *)malloc(capacity);
+	uint16_t *table = (uint16_t *)malloc((1UL << bits) * sizeof(uint16_t));
+	if (videoSources == NULL || tallyFlags == NULL || table == NULL)	{
+		free(videoSources);
+		free(tallyFlags);
+		free(table);
+		return false;
+	}
+	if (atemTallyBySourceSources)	{
+		memcpy(videoSources, atemTallyBySourceVideoSource, atemTallyBySourceSources * sizeof(uint16_t));
+		memcpy(tallyFlags, atemTallyBySourceTallyFlags, atemTallyBySourceSources);
+	}
+	free(atemTallyBySourceVideoSource);
+	free(atemTallyBySourceTallyFlags);
+	free(_tallyBySourceTable);
+
+	atemTallyBySourceVideoSource = videoSources;
+	atemTallyBySourceTallyFlags = tallyFlags;
+	_tallyBySourceTable = table;
+	_tallyBySourceTableBits = bits;
+	_tallyBySourceCapacity = capacity;
+	_indexTallyBySource();
+	return true;
+}
+
+/**
+ * Builds the lookup table from video source to position in the TlSr again
+ */
+void ATEMmin::_indexTallyBySource() {
+	if (_tallyBySourceTable == NULL)	return;
+
+	uint16_t mask = (1UL << _tallyBySourceTableBits) - 1;
+	memset(_tallyBySourceTable, 0, (mask + 1UL) * sizeof(uint16_t));
+	for (uint16_t a = 0; a < atemTallyBySourceSources; a++)	{
+		uint16_t slot = (uint32_t)(atemTallyBySourceVideoSource[a] * 2654435769UL) >> (32 - _tallyBySourceTableBits);	// Fibonacci hashing
+		while (_tallyBySourceTable[slot])	slot = (slot + 1) & mask;
+		_tallyBySourceTable[slot] = a + 1;
+	}
+}
+
+/**
+ * Returns the position of the video source in the TlSr, or -1 if it is not in it
+ */
+int16_t ATEMmin::_findTallyBySource(uint16_t videoSource) {
+	if (_tallyBySourceTable == NULL)	return -1;
+
+	uint16_t mask = (1UL << _tallyBySourceTableBits) - 1;
+	uint16_t slot = (uint32_t)(videoSource * 2654435769UL) >> (32 - _tallyBySourceTableBits);
+	while (_tallyBySourceTable[slot])	{	// The table is never more than half full, so this ends at an empty slot
+		uint16_t position = _tallyBySourceTable[slot] - 1;
+		if (atemTallyBySourceVideoSource[position] == videoSource)	return position;
+		slot = (slot + 1) & mask;
+	}
+	return -1;
+}
 
 
 
@@ -54,30 +170,45 @@ ATEMmin::ATEMmin(){}
 		void ATEMmin::_parseGetCommands(const char *cmdStr)	{
 			uint8_t mE,keyer,aUXChannel;
 			uint16_t sources;
+			#if ATEM_debug
 			long temp;
-			uint8_t readBytesForTlSr;
+			#endif
 
-			if (!strcmp_P(cmdStr, PSTR("AMLv")))	{
-				_readToPacketBuffer(36);
-			} else if (!strcmp_P(cmdStr, PSTR("TlSr")))	{
-				readBytesForTlSr = ((ATEM_packetBufferLength-2)/3)*3+2;
-				_readToPacketBuffer(readBytesForTlSr);
-			} else {
-				_readToPacketBuffer();	// Default
+			switch (_cmdKey)	{
+			case ATEM_cmdKey('_','p','i','n'):
+			case ATEM_cmdKey('P','r','g','I'):
+			case ATEM_cmdKey('P','r','v','I'):
+			case ATEM_cmdKey('T','r','P','s'):
+			case ATEM_cmdKey('K','e','O','n'):
+			case ATEM_cmdKey('D','s','k','S'):
+			case ATEM_cmdKey('F','t','b','S'):
+			case ATEM_cmdKey('A','u','x','S'):
+			case ATEM_cmdKey('T','l','I','n'):
+			case ATEM_cmdKey('T','l','S','r'):
+			case ATEM_cmdKey('T','l','M','c'):
+			case ATEM_cmdKey('T','l','V','r'):
+			case ATEM_cmdKey('T','l','D','l'):
+			case ATEM_cmdKey('T','l','H','p'):
+			case ATEM_cmdKey('T','l','S','b'):
+			case ATEM_cmdKey('S','t','R','S'):
+				_readToPacketBuffer();
+				break;
+			default:	// Not a command ATEMmin keeps track of. _parsePacket() skips it by its length.
+				return;
 			}
 
-
-			if (!strcmp_P(cmdStr, PSTR("_pin")))	{
-				if (_packetBuffer[5]=='T')	{
+			switch (_cmdKey)	{
+			case ATEM_cmdKey('_','p','i','n'):	{
+				if (_cmdData[5]=='T')	{
 						_ATEMmodel = 0;
 				} else
-				if (_packetBuffer[5]=='1')	{
-						_ATEMmodel = _packetBuffer[29]=='4' ? 4 : 1;
+				if (_cmdData[5]=='1')	{
+						_ATEMmodel = _cmdData[29]=='4' ? 4 : 1;
 				} else
-				if (_packetBuffer[5]=='2')	{
-					_ATEMmodel = _packetBuffer[29]=='4' ? 5 : 2;
+				if (_cmdData[5]=='2')	{
+					_ATEMmodel = _cmdData[29]=='4' ? 5 : 2;
 				} else
-				if (_packetBuffer[5]=='P')	{
+				if (_cmdData[5]=='P')	{
 						_ATEMmodel = 3;
 				}
 
@@ -107,55 +238,57 @@ ATEMmin::ATEMmin(){}
 					}
 				}
 				#endif
+				break;
 			}
-
-			
-
-
-
-			
-			if(!strcmp_P(cmdStr, PSTR("PrgI"))) {
+			case ATEM_cmdKey('P','r','g','I'):	{
 				
-				mE = _packetBuffer[0];
+				mE = _cmdData[0];
 				if (mE<=1) {
+					uint16_t previousVideoSource = atemProgramInputVideoSource[mE];
+					atemProgramInputVideoSource[mE] = word(_cmdData[2], _cmdData[3]);
 					#if ATEM_debug
-					temp = atemProgramInputVideoSource[mE];
-					#endif
-					atemProgramInputVideoSource[mE] = word(_packetBuffer[2], _packetBuffer[3]);
-					#if ATEM_debug
-					if ((_serialOutput==0x80 && atemProgramInputVideoSource[mE]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
+					if ((_serialOutput==0x80 && atemProgramInputVideoSource[mE]!=previousVideoSource) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemProgramInputVideoSource[mE=")); Serial.print(mE); Serial.print(F("] = "));
 						Serial.println(atemProgramInputVideoSource[mE]);
 					}
 					#endif
+					if (_programInputChangeCallback != NULL && atemProgramInputVideoSource[mE]!=previousVideoSource)	{
+						_programInputChangeCallback(mE, atemProgramInputVideoSource[mE]);
+					}
 					
 				}
-			} else 
-			if(!strcmp_P(cmdStr, PSTR("PrvI"))) {
+				break;
+			}
+			case ATEM_cmdKey('P','r','v','I'):	{
 				
-				mE = _packetBuffer[0];
+				mE = _cmdData[0];
 				if (mE<=1) {
+					uint16_t previousVideoSource = atemPreviewInputVideoSource[mE];
+					atemPreviewInputVideoSource[mE] = word(_cmdData[2], _cmdData[3]);
 					#if ATEM_debug
-					temp = atemPreviewInputVideoSource[mE];
-					#endif
-					atemPreviewInputVideoSource[mE] = word(_packetBuffer[2], _packetBuffer[3]);
-					#if ATEM_debug
-					if ((_serialOutput==0x80 && atemPreviewInputVideoSource[mE]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
+					if ((_serialOutput==0x80 && atemPreviewInputVideoSource[mE]!=previousVideoSource) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemPreviewInputVideoSource[mE=")); Serial.print(mE); Serial.print(F("] = "));
 						Serial.println(atemPreviewInputVideoSource[mE]);
 					}
 					#endif
+					if (_previewInputChangeCallback != NULL && atemPreviewInputVideoSource[mE]!=previousVideoSource)	{
+						_previewInputChangeCallback(mE, atemPreviewInputVideoSource[mE]);
+					}
 					
 				}
-			} else 
-			if(!strcmp_P(cmdStr, PSTR("TrPs"))) {
+				break;
+			}
+			case ATEM_cmdKey('T','r','P','s'):	{
 				
-				mE = _packetBuffer[0];
+				mE = _cmdData[0];
 				if (mE<=1) {
+					bool previousInTransition = atemTransitionInTransition[mE];
+					uint8_t previousFramesRemaining = atemTransitionFramesRemaining[mE];
+					uint16_t previousPosition = atemTransitionPosition[mE];
 					#if ATEM_debug
 					temp = atemTransitionInTransition[mE];
 					#endif
-					atemTransitionInTransition[mE] = _packetBuffer[1];
+					atemTransitionInTransition[mE] = _cmdData[1];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemTransitionInTransition[mE]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemTransitionInTransition[mE=")); Serial.print(mE); Serial.print(F("] = "));
@@ -166,7 +299,7 @@ ATEMmin::ATEMmin(){}
 					#if ATEM_debug
 					temp = atemTransitionFramesRemaining[mE];
 					#endif
-					atemTransitionFramesRemaining[mE] = _packetBuffer[2];
+					atemTransitionFramesRemaining[mE] = _cmdData[2];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemTransitionFramesRemaining[mE]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemTransitionFramesRemaining[mE=")); Serial.print(mE); Serial.print(F("] = "));
@@ -177,7 +310,7 @@ ATEMmin::ATEMmin(){}
 					#if ATEM_debug
 					temp = atemTransitionPosition[mE];
 					#endif
-					atemTransitionPosition[mE] = word(_packetBuffer[4], _packetBuffer[5]);
+					atemTransitionPosition[mE] = word(_cmdData[4], _cmdData[5]);
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemTransitionPosition[mE]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemTransitionPosition[mE=")); Serial.print(mE); Serial.print(F("] = "));
@@ -185,17 +318,21 @@ ATEMmin::ATEMmin(){}
 					}
 					#endif
 					
+					if (_transitionChangeCallback != NULL && (atemTransitionInTransition[mE]!=previousInTransition || atemTransitionFramesRemaining[mE]!=previousFramesRemaining || atemTransitionPosition[mE]!=previousPosition))	{
+						_transitionChangeCallback(mE, atemTransitionInTransition[mE], atemTransitionFramesRemaining[mE], atemTransitionPosition[mE]);
+					}
 				}
-			} else 
-			if(!strcmp_P(cmdStr, PSTR("KeOn"))) {
+				break;
+			}
+			case ATEM_cmdKey('K','e','O','n'):	{
 				
-				mE = _packetBuffer[0];
-				keyer = _packetBuffer[1];
+				mE = _cmdData[0];
+				keyer = _cmdData[1];
 				if (mE<=1 && keyer<=3) {
 					#if ATEM_debug
 					temp = atemKeyerOnAirEnabled[mE][keyer];
 					#endif
-					atemKeyerOnAirEnabled[mE][keyer] = _packetBuffer[2];
+					atemKeyerOnAirEnabled[mE][keyer] = _cmdData[2];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemKeyerOnAirEnabled[mE][keyer]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemKeyerOnAirEnabled[mE=")); Serial.print(mE); Serial.print(F("][keyer=")); Serial.print(keyer); Serial.print(F("] = "));
@@ -204,15 +341,16 @@ ATEMmin::ATEMmin(){}
 					#endif
 					
 				}
-			} else 
-			if(!strcmp_P(cmdStr, PSTR("DskS"))) {
+				break;
+			}
+			case ATEM_cmdKey('D','s','k','S'):	{
 				
-				keyer = _packetBuffer[0];
+				keyer = _cmdData[0];
 				if (keyer<=1) {
 					#if ATEM_debug
 					temp = atemDownstreamKeyerOnAir[keyer];
 					#endif
-					atemDownstreamKeyerOnAir[keyer] = _packetBuffer[1];
+					atemDownstreamKeyerOnAir[keyer] = _cmdData[1];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemDownstreamKeyerOnAir[keyer]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemDownstreamKeyerOnAir[keyer=")); Serial.print(keyer); Serial.print(F("] = "));
@@ -223,7 +361,7 @@ ATEMmin::ATEMmin(){}
 					#if ATEM_debug
 					temp = atemDownstreamKeyerInTransition[keyer];
 					#endif
-					atemDownstreamKeyerInTransition[keyer] = _packetBuffer[2];
+					atemDownstreamKeyerInTransition[keyer] = _cmdData[2];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemDownstreamKeyerInTransition[keyer]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemDownstreamKeyerInTransition[keyer=")); Serial.print(keyer); Serial.print(F("] = "));
@@ -234,7 +372,7 @@ ATEMmin::ATEMmin(){}
 					#if ATEM_debug
 					temp = atemDownstreamKeyerIsAutoTransitioning[keyer];
 					#endif
-					atemDownstreamKeyerIsAutoTransitioning[keyer] = _packetBuffer[3];
+					atemDownstreamKeyerIsAutoTransitioning[keyer] = _cmdData[3];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemDownstreamKeyerIsAutoTransitioning[keyer]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemDownstreamKeyerIsAutoTransitioning[keyer=")); Serial.print(keyer); Serial.print(F("] = "));
@@ -245,7 +383,7 @@ ATEMmin::ATEMmin(){}
 					#if ATEM_debug
 					temp = atemDownstreamKeyerFramesRemaining[keyer];
 					#endif
-					atemDownstreamKeyerFramesRemaining[keyer] = _packetBuffer[4];
+					atemDownstreamKeyerFramesRemaining[keyer] = _cmdData[4];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemDownstreamKeyerFramesRemaining[keyer]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemDownstreamKeyerFramesRemaining[keyer=")); Serial.print(keyer); Serial.print(F("] = "));
@@ -254,15 +392,16 @@ ATEMmin::ATEMmin(){}
 					#endif
 					
 				}
-			} else 
-			if(!strcmp_P(cmdStr, PSTR("FtbS"))) {
+				break;
+			}
+			case ATEM_cmdKey('F','t','b','S'):	{
 				
-				mE = _packetBuffer[0];
+				mE = _cmdData[0];
 				if (mE<=1) {
 					#if ATEM_debug
 					temp = atemFadeToBlackStateFullyBlack[mE];
 					#endif
-					atemFadeToBlackStateFullyBlack[mE] = _packetBuffer[1];
+					atemFadeToBlackStateFullyBlack[mE] = _cmdData[1];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemFadeToBlackStateFullyBlack[mE]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemFadeToBlackStateFullyBlack[mE=")); Serial.print(mE); Serial.print(F("] = "));
@@ -273,7 +412,7 @@ ATEMmin::ATEMmin(){}
 					#if ATEM_debug
 					temp = atemFadeToBlackStateInTransition[mE];
 					#endif
-					atemFadeToBlackStateInTransition[mE] = _packetBuffer[2];
+					atemFadeToBlackStateInTransition[mE] = _cmdData[2];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemFadeToBlackStateInTransition[mE]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemFadeToBlackStateInTransition[mE=")); Serial.print(mE); Serial.print(F("] = "));
@@ -284,7 +423,7 @@ ATEMmin::ATEMmin(){}
 					#if ATEM_debug
 					temp = atemFadeToBlackStateFramesRemaining[mE];
 					#endif
-					atemFadeToBlackStateFramesRemaining[mE] = _packetBuffer[3];
+					atemFadeToBlackStateFramesRemaining[mE] = _cmdData[3];
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemFadeToBlackStateFramesRemaining[mE]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemFadeToBlackStateFramesRemaining[mE=")); Serial.print(mE); Serial.print(F("] = "));
@@ -293,15 +432,16 @@ ATEMmin::ATEMmin(){}
 					#endif
 					
 				}
-			} else 
-			if(!strcmp_P(cmdStr, PSTR("AuxS"))) {
+				break;
+			}
+			case ATEM_cmdKey('A','u','x','S'):	{
 				
-				aUXChannel = _packetBuffer[0];
+				aUXChannel = _cmdData[0];
 				if (aUXChannel<=5) {
 					#if ATEM_debug
 					temp = atemAuxSourceInput[aUXChannel];
 					#endif
-					atemAuxSourceInput[aUXChannel] = word(_packetBuffer[2], _packetBuffer[3]);
+					atemAuxSourceInput[aUXChannel] = word(_cmdData[2], _cmdData[3]);
 					#if ATEM_debug
 					if ((_serialOutput==0x80 && atemAuxSourceInput[aUXChannel]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemAuxSourceInput[aUXChannel=")); Serial.print(aUXChannel); Serial.print(F("] = "));
@@ -310,53 +450,250 @@ ATEMmin::ATEMmin(){}
 					#endif
 					
 				}
-			} else 
-			if(!strcmp_P(cmdStr, PSTR("TlIn"))) {
-				
-				sources = word(_packetBuffer[0],_packetBuffer[1]);
-				if (sources<=40) {
-					#if ATEM_debug
-					temp = atemTallyByIndexSources;
-					#endif
-					atemTallyByIndexSources = word(_packetBuffer[0], _packetBuffer[1]);
+				break;
+			}
+			case ATEM_cmdKey('T','l','I','n'):	{
+				if (_tallyVersionStale)	{	// A tally server sent newer tally data already
+					break;
+				}
+				sources = word(_cmdData[0],_cmdData[1]);
+				if (_firstTallySession != _sessionCount)	{
+					_firstTallySession = _sessionCount;
+					_timeToFirstTally = millis() - _sessionLostAt;
+				}
+				if (_cmdPointer < 2)	{	// Not even the number of sources was read
+					sources = 0;
+				} else if (sources > _cmdPointer-2)	{	// Only part of the command was read
+					sources = _cmdPointer-2;
+				}
+				if (!_reserveTallyByIndex(sources))	{
+					sources = _tallyByIndexCapacity;
+				}
+				{
+					uint16_t previousSources = atemTallyByIndexSources;
+					atemTallyByIndexSources = sources;
 					#if ATEM_debug
-					if ((_serialOutput==0x80 && atemTallyByIndexSources!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
+					if ((_serialOutput==0x80 && atemTallyByIndexSources!=previousSources) || (_serialOutput==0x81 && !hasInitialized()))	{
 						Serial.print(F("atemTallyByIndexSources = "));
 						Serial.println(atemTallyByIndexSources);
 					}
 					#endif
+					if (_tallySourcesChangeCallback != NULL && atemTallyByIndexSources!=previousSources)	{
+						_tallySourcesChangeCallback(atemTallyByIndexSources);
+					}
 
-					for(uint8_t a=0;a<sources;a++)	{
+					// Sources no longer in the TlIn are cleared, so they are reported as changed if they had any tally
+					uint16_t lastSource = sources > previousSources ? sources : previousSources;
+					for(uint16_t a=0;a<lastSource;a++)	{
+						uint8_t previousTallyFlags = atemTallyByIndexTallyFlags[a];
+						atemTallyByIndexTallyFlags[a] = a<sources ? _cmdData[2+a] : 0;
 						#if ATEM_debug
-						temp = atemTallyByIndexTallyFlags[a];
-						#endif
-						atemTallyByIndexTallyFlags[a] = _packetBuffer[2+a];
-						#if ATEM_debug
-						if ((_serialOutput==0x80 && atemTallyByIndexTallyFlags[a]!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
+						if ((_serialOutput==0x80 && atemTallyByIndexTallyFlags[a]!=previousTallyFlags) || (_serialOutput==0x81 && !hasInitialized()))	{
 							Serial.print(F("atemTallyByIndexTallyFlags[a=")); Serial.print(a); Serial.print(F("] = "));
 							Serial.println(atemTallyByIndexTallyFlags[a]);
 						}
 						#endif
+						if (_tallyChangeCallback != NULL && atemTallyByIndexTallyFlags[a]!=previousTallyFlags)	{
+							_tallyChangeCallback(a, previousTallyFlags, atemTallyByIndexTallyFlags[a]);
+						}
+					}
+				}
+				break;
+			}
+			case ATEM_cmdKey('T','l','S','r'):	{
+				if (_tallyVersionStale)	{
+					break;
+				}
+				sources = word(_cmdData[0],_cmdData[1]);
+				if (_cmdPointer < 2)	{	// Not even the number of sources was read
+					sources = 0;
+				} else if (sources > (_cmdPointer-2)/3)	{	// Only part of the command was read
+					sources = (_cmdPointer-2)/3;
+				}
+				if (!_reserveTallyBySource(sources))	{
+					sources = _tallyBySourceCapacity;
+				}
+
+				// Usually the same sources in the same order every time. If not, the lookup table is built again
+				bool sourcesChanged = sources != atemTallyBySourceSources;
+				for(uint16_t a=0;a<sources && !sourcesChanged;a++)	{
+					sourcesChanged = atemTallyBySourceVideoSource[a] != word(_cmdData[2+a*3], _cmdData[3+a*3]);
+				}
+
+				if (sourcesChanged)	{	// Rare, so it's fine to compare the old and new source lists the slow way here
+					for(uint16_t a=0;a<sources;a++)	{
+						uint16_t videoSource = word(_cmdData[2+a*3], _cmdData[3+a*3]);
+						int16_t previous = _findTallyBySource(videoSource);
+						uint8_t previousTallyFlags = previous >= 0 ? atemTallyBySourceTallyFlags[previous] : 0;
+						if (_tallyBySourceChangeCallback != NULL && _cmdData[4+a*3]!=previousTallyFlags)	{
+							_tallyBySourceChangeCallback(videoSource, previousTallyFlags, _cmdData[4+a*3]);
+						}
+					}
+					// Sources no longer in the TlSr are cleared, so they are reported as changed if they had any tally
+					for(uint16_t a=0;a<atemTallyBySourceSources;a++)	{
+						bool found = false;
+						for(uint16_t b=0;b<sources && !found;b++)	{
+							found = atemTallyBySourceVideoSource[a] == word(_cmdData[2+b*3], _cmdData[3+b*3]);
+						}
+						if (_tallyBySourceChangeCallback != NULL && !found && atemTallyBySourceTallyFlags[a])	{
+							_tallyBySourceChangeCallback(atemTallyBySourceVideoSource[a], atemTallyBySourceTallyFlags[a], 0);
+						}
+					}
+
+					atemTallyBySourceSources = sources;
+					for(uint16_t a=0;a<sources;a++)	{
+						atemTallyBySourceVideoSource[a] = word(_cmdData[2+a*3], _cmdData[3+a*3]);
+						atemTallyBySourceTallyFlags[a] = _cmdData[4+a*3];
+					}
+					_indexTallyBySource();
+					#if ATEM_debug
+					if (_serialOutput==0x80 || (_serialOutput==0x81 && !hasInitialized()))	{
+						Serial.print(F("atemTallyBySourceSources = "));
+						Serial.println(atemTallyBySourceSources);
+					}
+					#endif
+				} else {
+					for(uint16_t a=0;a<sources;a++)	{
+						uint8_t previousTallyFlags = atemTallyBySourceTallyFlags[a];
+						atemTallyBySourceTallyFlags[a] = _cmdData[4+a*3];
+						#if ATEM_debug
+						if ((_serialOutput==0x80 && atemTallyBySourceTallyFlags[a]!=previousTallyFlags) || (_serialOutput==0x81 && !hasInitialized()))	{
+							Serial.print(F("atemTallyBySourceTallyFlags[videoSource=")); Serial.print(atemTallyBySourceVideoSource[a]); Serial.print(F("] = "));
+							Serial.println(atemTallyBySourceTallyFlags[a]);
+						}
+						#endif
+						if (_tallyBySourceChangeCallback != NULL && atemTallyBySourceTallyFlags[a]!=previousTallyFlags)	{
+							_tallyBySourceChangeCallback(atemTallyBySourceVideoSource[a], previousTallyFlags, atemTallyBySourceTallyFlags[a]);
+						}
 					}
-		
 				}
+				break;
 			}
 			/**
 			 * Added by Aron N. Het Lam
-			 * Functionality to parse and retrieve streaming status.
+			 * Sent by a tally server that multicasts tally data: where to, and the sequence number of the last multicast
+			 */
+			case ATEM_cmdKey('T','l','M','c'):	{
+				_beginMulticast(IPAddress(_cmdData[0], _cmdData[1], _cmdData[2], _cmdData[3]), word(_cmdData[4], _cmdData[5]), word(_cmdData[6], _cmdData[7]));
+				break;
+			}
+			/**
+			 * Added by Aron N. Het Lam
+			 * Sent by a tally server: the version of the tally data that follows, which is acknowledged so deltas (TlDl) can be sent against it
+			 */
+			case ATEM_cmdKey('T','l','V','r'):	{
+				_receivedTallyVersion(word(_cmdData[0], _cmdData[1]));
+				break;
+			}
+			/**
+			 * Added by Aron N. Het Lam
+			 * Sent by a tally server: the tally flags that changed since a version of the tally data we acknowledged.
+			 * TlIn changes are by tally index, TlSr changes by position in the TlSr.
+			 */
+			case ATEM_cmdKey('T','l','D','l'):	{
+				uint16_t baseVersion = word(_cmdData[0], _cmdData[1]);
+				uint16_t version = word(_cmdData[2], _cmdData[3]);
+				uint16_t changes = word(_cmdData[4], _cmdData[5]);
+				if (6+changes*3+2 > _cmdPointer)	{	// Only part of the command was read. It's not acknowledged, so all tally data is sent again
+					break;
+				}
+				uint16_t tallyBySourceChanges = word(_cmdData[6+changes*3], _cmdData[7+changes*3]);
+				const uint8_t *tallyBySourceData = _cmdData+8+changes*3;
+				if (8+changes*3+tallyBySourceChanges*3 > _cmdPointer || !_hasTallyVersion || (int16_t)(_tallyVersion - baseVersion) < 0)	{
+					break;	// Not a delta against anything we have
+				}
+
+				if ((int16_t)(version - _tallyVersion) > 0)	{	// Older deltas have been applied already
+					for(uint16_t a=0;a<changes;a++)	{
+						uint16_t index = word(_cmdData[6+a*3], _cmdData[7+a*3]);
+						if (index < atemTallyByIndexSources)	{
+							uint8_t previousTallyFlags = atemTallyByIndexTallyFlags[index];
+							atemTallyByIndexTallyFlags[index] = _cmdData[8+a*3];
+							#if ATEM_debug
+							if (_serialOutput==0x80 && atemTallyByIndexTallyFlags[index]!=previousTallyFlags)	{
+								Serial.print(F("atemTallyByIndexTallyFlags[a=")); Serial.print(index); Serial.print(F("] = "));
+								Serial.println(atemTallyByIndexTallyFlags[index]);
+							}
+							#endif
+							if (_tallyChangeCallback != NULL && atemTallyByIndexTallyFlags[index]!=previousTallyFlags)	{
+								_tallyChangeCallback(index, previousTallyFlags, atemTallyByIndexTallyFlags[index]);
+							}
+						}
+					}
+					for(uint16_t a=0;a<tallyBySourceChanges;a++)	{
+						uint16_t position = word(tallyBySourceData[a*3], tallyBySourceData[1+a*3]);
+						if (position < atemTallyBySourceSources)	{
+							uint8_t previousTallyFlags = atemTallyBySourceTallyFlags[position];
+							atemTallyBySourceTallyFlags[position] = tallyBySourceData[2+a*3];
+							#if ATEM_debug
+							if (_serialOutput==0x80 && atemTallyBySourceTallyFlags[position]!=previousTallyFlags)	{
+								Serial.print(F("atemTallyBySourceTallyFlags[videoSource=")); Serial.print(atemTallyBySourceVideoSource[position]); Serial.print(F("] = "));
+								Serial.println(atemTallyBySourceTallyFlags[position]);
+							}
+							#endif
+							if (_tallyBySourceChangeCallback != NULL && atemTallyBySourceTallyFlags[position]!=previousTallyFlags)	{
+								_tallyBySourceChangeCallback(atemTallyBySourceVideoSource[position], previousTallyFlags, atemTallyBySourceTallyFlags[position]);
+							}
+						}
+					}
+				}
+				_receivedTallyVersion(version);
+				break;
+			}
+			/**
+			 * Added by Aron N. Het Lam
+			 * Sent by a tally server: the relays the tally came through from the switcher, each with its relay ID and the time (us)
+			 * it took to pass the last change on. Our own relay ID in it means the tally is going around in a loop.
 			 */
-		else 
-			if(!strcmp_P(cmdStr, PSTR("StRS"))) {
+			case ATEM_cmdKey('T','l','H','p'):	{
+				uint8_t hops = _cmdData[0];
+				_relayPathSession = _sessionCount;
+				_relayLooped = hops > ATEM_relayMaxHops || 2+hops*8 > _cmdPointer;
+				_relayHops = _relayLooped ? 0 : hops;
+				for(uint8_t a=0;a<_relayHops;a++)	{
+					const uint8_t *hop = _cmdData+2+a*8;
+					_relayIDs[a] = (uint32_t)word(hop[0], hop[1]) << 16 | word(hop[2], hop[3]);
+					_relayDelays[a] = (uint32_t)word(hop[4], hop[5]) << 16 | word(hop[6], hop[7]);
+					if (_relayID && _relayIDs[a] == _relayID)	{
+						_relayLooped = true;
+					}
+				}
 				#if ATEM_debug
-				temp = streamingStatusFlags;
+				if (_serialOutput==0x80 && _relayLooped)	{
+					Serial.println(F("Relay path loops back to us"));
+				}
 				#endif
-				streamingStatusFlags = word(_packetBuffer[0], _packetBuffer[1]);
+				break;
+			}
+			/**
+			 * Added by Aron N. Het Lam
+			 * Sent by a tally server along with all tally data: the tally indexes it only sends us from now on, confirming setTallySubscription()
+			 */
+			case ATEM_cmdKey('T','l','S','b'):	{
+				uint16_t count = word(_cmdData[0], _cmdData[1]);
+				if (2+count*2 <= _cmdPointer)	{
+					_receivedTallySubscription(_cmdData+2, count);
+				}
+				break;
+			}
+			/**
+			 * Added by Aron N. Het Lam
+			 * Functionality to parse and retrieve streaming status.
+			 */
+			case ATEM_cmdKey('S','t','R','S'):	{
+				uint16_t previousStreamingStatusFlags = streamingStatusFlags;
+				streamingStatusFlags = word(_cmdData[0], _cmdData[1]);
 				#if ATEM_debug
-				if ((_serialOutput==0x80 && streamingStatusFlags!=temp) || (_serialOutput==0x81 && !hasInitialized()))	{
+				if ((_serialOutput==0x80 && streamingStatusFlags!=previousStreamingStatusFlags) || (_serialOutput==0x81 && !hasInitialized()))	{
 					Serial.print(F("streamingStatusFlags = "));
 					Serial.println(streamingStatusFlags);
 				}
 				#endif
+				if (_streamingStatusChangeCallback != NULL && streamingStatusFlags!=previousStreamingStatusFlags)	{
+					_streamingStatusChangeCallback(streamingStatusFlags);
+				}
+				break;
+			}
 			}
 		}
 
@@ -643,10 +980,34 @@ ATEMmin::ATEMmin(){}
 			
 			/**
 			 * Get Tally By Index; Tally Flags
-			 * sources 	0-40: Number of
+			 * sources 	0-: Index of the source. 0 if it is not in the TlIn.
 			 */
 			uint8_t ATEMmin::getTallyByIndexTallyFlags(uint16_t sources) {
-				return atemTallyByIndexTallyFlags[sources];
+				return sources < atemTallyByIndexSources ? atemTallyByIndexTallyFlags[sources] : 0;
+			}
+
+			/**
+			 * Get Tally By Source; Sources
+			 */
+			uint16_t ATEMmin::getTallyBySourceSources() {
+				return atemTallyBySourceSources;
+			}
+
+			/**
+			 * Get Tally By Source; Video Source
+			 * index 	0-: Position in the TlSr, up to getTallyBySourceSources()
+			 */
+			uint16_t ATEMmin::getTallyBySourceVideoSource(uint16_t index) {
+				return index < atemTallyBySourceSources ? atemTallyBySourceVideoSource[index] : 0;
+			}
+
+			/**
+			 * Get Tally By Source; Tally Flags
+			 * videoSource 	(See video source list). 0 if the source is not in the TlSr.
+			 */
+			uint8_t ATEMmin::getTallyBySourceTallyFlags(uint16_t videoSource) {
+				int16_t position = _findTallyBySource(videoSource);
+				return position >= 0 ? atemTallyBySourceTallyFlags[position] : 0;
 			}
 			
 			/**
@@ -697,3 +1058,99 @@ ATEMmin::ATEMmin(){}
 			bool ATEMmin::getStreamUnknownError() {
 				return streamingStatusFlags & 1 << 15;
 			}
+
+			/**
+			 * Set function to call when the tally flags of a source change.
+			 * Called for each source that changed, from runLoop() while the TlIn command is parsed,
+			 * so sources after it may not have been updated yet. NULL to stop.
+			 */
+			void ATEMmin::onTallyChange(ATEMmin_tallyChangeCallback callback) {
+				_tallyChangeCallback = callback;
+			}
+
+			/**
+			 * Set function to call when the number of tally sources changes. NULL to stop.
+			 */
+			void ATEMmin::onTallySourcesChange(ATEMmin_tallySourcesChangeCallback callback) {
+				_tallySourcesChangeCallback = callback;
+			}
+
+			/**
+			 * Set function to call for each video source whose tally flags in the TlSr changed. NULL to stop.
+			 */
+			void ATEMmin::onTallyBySourceChange(ATEMmin_tallyBySourceChangeCallback callback) {
+				_tallyBySourceChangeCallback = callback;
+			}
+
+			/**
+			 * Set function to call when the program input of an M/E changes. NULL to stop.
+			 */
+			void ATEMmin::onProgramInputChange(ATEMmin_videoSourceChangeCallback callback) {
+				_programInputChangeCallback = callback;
+			}
+
+			/**
+			 * Set function to call when the preview input of an M/E changes. NULL to stop.
+			 */
+			void ATEMmin::onPreviewInputChange(ATEMmin_videoSourceChangeCallback callback) {
+				_previewInputChangeCallback = callback;
+			}
+
+			/**
+			 * Set function to call when the streaming status flags change. NULL to stop.
+			 */
+			void ATEMmin::onStreamingStatusChange(ATEMmin_streamingStatusChangeCallback callback) {
+				_streamingStatusChangeCallback = callback;
+			}
+
+			/**
+			 * Set function to call when the transition of an M/E (TrPs) starts, moves on or ends. NULL to stop.
+			 * The position goes from 0 to 9999 over the transition.
+			 */
+			void ATEMmin::onTransitionChange(ATEMmin_transitionChangeCallback callback) {
+				_transitionChangeCallback = callback;
+			}
+
+			/**
+			 * Returns the time (ms) from the last contact in the previous session (or connecting the first time)
+			 * until the tally of the current session was received. Along with getTimeToReconnect(), this is how long a tally light was dark.
+			 */
+			unsigned long ATEMmin::getTimeToFirstTally() {
+				return _timeToFirstTally;
+			}
+
+			/**
+			 * Set our relay ID, when the tally is relayed on to other tally lights with it, so isRelayLooped() can tell if it comes back around
+			 */
+			void ATEMmin::setRelayID(uint32_t relayID) {
+				_relayID = relayID;
+			}
+
+			/**
+			 * Returns the number of tally servers the tally came through from the switcher. 0 when connected to the switcher itself.
+			 */
+			uint8_t ATEMmin::getRelayHops() {
+				return _relayPathSession == _sessionCount ? _relayHops : 0;
+			}
+
+			/**
+			 * Returns the relay ID of the tally server at position hop from the switcher, up to getRelayHops()
+			 */
+			uint32_t ATEMmin::getRelayID(uint8_t hop) {
+				return hop < getRelayHops() ? _relayIDs[hop] : 0;
+			}
+
+			/**
+			 * Returns the time (us) the tally server at position hop from the switcher took to pass the last change on
+			 */
+			uint32_t ATEMmin::getRelayDelay(uint8_t hop) {
+				return hop < getRelayHops() ? _relayDelays[hop] : 0;
+			}
+
+			/**
+			 * Returns true if the tally comes back around to us through the relays, or through more than ATEM_relayMaxHops of them.
+			 * Such tally doesn't come from a switcher, so it shouldn't be shown or passed on.
+			 */
+			bool ATEMmin::isRelayLooped() {
+				return _relayPathSession == _sessionCount && _relayLooped;
+			}
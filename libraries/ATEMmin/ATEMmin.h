@@ -35,15 +35,28 @@ you can keep a clear conscience: http://skaarhoj.com/about/licenses/
 
 #if defined ESP8266 || defined ESP32
 #include <WiFiUdp.h>
-#else
+#elif defined ARDUINO
 #include <EthernetUdp.h>
+#else
+#include <PosixUdp.h>
 #endif
 
+#define ATEM_relayMaxHops 8	// Longest relay path (TlHp) kept, as TALLY_SERVER_MAX_HOPS
+
+// Change notifications. They are called from runLoop(), while the command with the change is parsed.
+typedef void (*ATEMmin_tallyChangeCallback)(uint16_t tallyIndex, uint8_t previousTallyFlags, uint8_t tallyFlags);
+typedef void (*ATEMmin_tallySourcesChangeCallback)(uint16_t sources);
+typedef void (*ATEMmin_tallyBySourceChangeCallback)(uint16_t videoSource, uint8_t previousTallyFlags, uint8_t tallyFlags);
+typedef void (*ATEMmin_videoSourceChangeCallback)(uint8_t mE, uint16_t videoSource);
+typedef void (*ATEMmin_streamingStatusChangeCallback)(uint16_t streamingStatusFlags);
+typedef void (*ATEMmin_transitionChangeCallback)(uint8_t mE, bool inTransition, uint8_t framesRemaining, uint16_t position);
+
 
 class ATEMmin : public ATEMbase
 {
   public:
 	ATEMmin();  
+	~ATEMmin();
 	  
 // *********************************
 // **
@@ -66,6 +79,36 @@ class ATEMmin : public ATEMbase
 private:
 	void _parseGetCommands(const char *cmdStr);
 
+	bool _reserveTallyByIndex(uint16_t sources);
+	bool _reserveTallyBySource(uint16_t sources);
+	void _indexTallyBySource();
+	int16_t _findTallyBySource(uint16_t videoSource);
+
+	ATEMmin_tallyChangeCallback _tallyChangeCallback;
+	ATEMmin_tallySourcesChangeCallback _tallySourcesChangeCallback;
+	ATEMmin_tallyBySourceChangeCallback _tallyBySourceChangeCallback;
+	ATEMmin_videoSourceChangeCallback _programInputChangeCallback;
+	ATEMmin_videoSourceChangeCallback _previewInputChangeCallback;
+	ATEMmin_streamingStatusChangeCallback _streamingStatusChangeCallback;
+	ATEMmin_transitionChangeCallback _transitionChangeCallback;
+
+	uint16_t _firstTallySession;		// Session (ATEMbase::_sessionCount) the last tally was received in
+	unsigned long _timeToFirstTally;	// Time (ms) from losing the previous session until the first tally of the current one
+
+	// Relays the tally came through from the switcher (TlHp), when connected to a tally server
+	uint32_t _relayID;					// Ours, to recognize the tally coming back around a loop. 0 if not set.
+	uint16_t _relayPathSession;			// Session the relay path was received in. A switcher doesn't send it, so it's only valid in that session
+	uint8_t _relayHops;
+	bool _relayLooped;					// The path has our relay ID in it, or is longer than we can keep
+	uint32_t _relayIDs[ATEM_relayMaxHops];
+	uint32_t _relayDelays[ATEM_relayMaxHops];
+
+	// Tally storage is sized from the number of sources the switcher reports, and only ever grows
+	uint16_t _tallyByIndexCapacity;		// Number of sources atemTallyByIndexTallyFlags has room for
+	uint16_t _tallyBySourceCapacity;	// Number of sources atemTallyBySourceVideoSource and atemTallyBySourceTallyFlags have room for
+	uint16_t *_tallyBySourceTable;		// Open addressing hash table from video source to its position in the TlSr + 1. 0 is an empty slot.
+	uint8_t _tallyBySourceTableBits;	// The table has 1 << _tallyBySourceTableBits slots, at least twice the capacity
+
 			// Private Variables in ATEM.h:
 	
 			uint16_t atemProgramInputVideoSource[2];
@@ -83,7 +126,10 @@ private:
 			uint8_t atemFadeToBlackStateFramesRemaining[2];
 			uint16_t atemAuxSourceInput[6];
 			uint16_t atemTallyByIndexSources;
-			uint8_t atemTallyByIndexTallyFlags[41];
+			uint8_t *atemTallyByIndexTallyFlags;
+			uint16_t atemTallyBySourceSources;
+			uint16_t *atemTallyBySourceVideoSource;
+			uint8_t *atemTallyBySourceTallyFlags;
 			uint16_t streamingStatusFlags; //Added by Aron N. Het Lam
 
 public:
@@ -114,6 +160,9 @@ public:
 			void setAuxSourceInput(uint8_t aUXChannel, uint16_t input);
 			uint16_t getTallyByIndexSources();
 			uint8_t getTallyByIndexTallyFlags(uint16_t sources);
+			uint16_t getTallyBySourceSources();
+			uint16_t getTallyBySourceVideoSource(uint16_t index);
+			uint8_t getTallyBySourceTallyFlags(uint16_t videoSource);
 
 			//Added by Aron N. Het Lam
 			uint16_t getStreamingStatusFlags();
@@ -123,6 +172,22 @@ public:
 			bool getStreamInvalidState();
 			bool getStreamStopping();
 			bool getStreamUnknownError();
+
+			void onTallyChange(ATEMmin_tallyChangeCallback callback);
+			void onTallySourcesChange(ATEMmin_tallySourcesChangeCallback callback);
+			void onTallyBySourceChange(ATEMmin_tallyBySourceChangeCallback callback);
+			void onProgramInputChange(ATEMmin_videoSourceChangeCallback callback);
+			void onPreviewInputChange(ATEMmin_videoSourceChangeCallback callback);
+			void onStreamingStatusChange(ATEMmin_streamingStatusChangeCallback callback);
+			void onTransitionChange(ATEMmin_transitionChangeCallback callback);
+
+			unsigned long getTimeToFirstTally();
+
+			void setRelayID(uint32_t relayID);
+			uint8_t getRelayHops();
+			uint32_t getRelayID(uint8_t hop);
+			uint32_t getRelayDelay(uint8_t hop);
+			bool isRelayLooped();
 };
 
 #endif
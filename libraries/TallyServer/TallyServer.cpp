@@ -31,48 +31,245 @@ TallyServer::TallyServer() : TallyServer(TALLY_SERVER_DEFAULT_MAX_CLIENTS) { }
 TallyServer::TallyServer(int maxClients) {
     #if defined ESP8266 || defined ESP32
         WiFiUDP Udp;
-    #else
+    #elif defined ARDUINO
         EthernetUDP Udp;
+    #else
+        PosixUDP Udp;
     #endif
 
-    _udp = Udp;
+    _defaultUdp = Udp;
+    _udp = &_defaultUdp;
 
-    _clients = new TallyServer::TallyClient[maxClients];
-    _maxClients = maxClients;
+    //The clients are only made room for in begin(), so a capacity set there isn't allocated twice
+    _clientCapacity = maxClients;
+    _clients = NULL;
+    _clientTable = NULL;
+    _clientTableBits = 0;
+    _freeClients = NULL;
+    _freeClientCount = 0;
+    _timerHeap = NULL;
+    _timerHeapSize = 0;
+
+    _keepAliveInterval = TALLY_SERVER_KEEP_ALIVE_MSG_INTERVAL;
+    _resendTimeout = TALLY_SERVER_RESEND_TIMEOUT;
+    _minResendTimeout = TALLY_SERVER_MIN_RESEND_TIMEOUT;
+    _maxResendTimeout = TALLY_SERVER_MAX_RESEND_TIMEOUT;
+    _clientTimeout = TALLY_SERVER_CLIENT_TIMEOUT;
+
+    _buffer = (uint8_t *)malloc(TALLY_SERVER_MIN_BUFFER_LENGTH);
+    _tallyData = (uint8_t *)malloc(TALLY_SERVER_MIN_BUFFER_LENGTH);
+    _bufferLength = _buffer && _tallyData ? TALLY_SERVER_MIN_BUFFER_LENGTH : 0;
+    _tallyDataCmdLength = 0;
+    _tallyDataCached = false;
+
+    _atemTallySources = 0;
+    _atemTallyCapacity = 0;
+    _atemTallyFlags = NULL;
+    _atemTallyBySourceSources = 0;
+    _atemTallyBySourceCapacity = 0;
+    _atemTallyBySourceVideoSources = NULL;
+    _atemTallyBySourceFlags = NULL;
+    _tallyFlagsChanged = false;
+
+    _multicastPort = 0;
+    _multicastSeq = 0;
+    _multicastSentAt = 0;
+    _multicastAckCheckPending = false;
+
+    _relayID = 0;
+    _upstreamHops = 0;
+    memset(_relayIDs, 0, sizeof(_relayIDs));
+    memset(_relayDelays, 0, sizeof(_relayDelays));
+    _relayDelay = 0;
+    _tallyChangedAt = 0;
+
+    _tallyVersion = 0;
+    _tallyLayoutVersion = 0;
+    _atemTallyChangedVersion = NULL;
+    _atemTallyBySourceChangedVersion = NULL;
 }
 
 /**
- * Begin tally server, letting other tally lights connect to it in runLoop()
+ * Begin tally server, letting other tally lights connect to it in runLoop(). This is where the
+ * clients are made room for: from here on, clients connecting, leaving and being turned away
+ * take no heap memory. Only tally sources beyond those reserved with reserveTallySources() do.
  */
 void TallyServer::begin() {
-    for(int i = 0; i < _maxClients; i++) _resetClient(&_clients[i]);
+    if (_maxClients != _clientCapacity) _allocateClients(_clientCapacity);
+    else _clearClients();
+
+    _udp->begin(9910);
+}
+
+/**
+ * Begin tally server with a new client capacity of maxClients
+ */
+void TallyServer::begin(int maxClients) {
+    _clientCapacity = maxClients;
+    begin();
+}
+
+/**
+ * Use another UDP transport than the built-in WiFi/Ethernet one, e.g. a socket on a host
+ * build or a simulated network. Call before begin(); the object must outlive this one.
+ */
+void TallyServer::setTransport(UDP *udp) {
+    _udp = udp;
+}
+
+/**
+ * Send tally data to clients as one multicast (or broadcast) datagram to address and port, instead of
+ * one packet per client. Clients are told about it when they connect, and once they acknowledge a
+ * multicast, they only get tally data on their own if they miss one. Port 0 goes back to unicast only.
+ */
+void TallyServer::setMulticast(IPAddress address, uint16_t port) {
+    if (port && !_reserveBuffer(_tallyDataLength(_atemTallySources, _atemTallyBySourceSources))) return; //No room for the TlMc, stay as is
+    _multicastIP = address;
+    _multicastPort = port;
+    _tallyDataCached = false; //The TlMc in it
+
+    for (int i = 0; i < _maxClients; i++) _clients[i]._isMulticast = false;
+}
+
+/**
+ * Set the time (ms) without packets in either direction after which a client is asked for an ack, at least 1 ms
+ */
+void TallyServer::setKeepAliveInterval(uint16_t interval) {
+    _keepAliveInterval = interval ? interval : 1; //0 would have the client due again in the same pass, over and over
+    _scheduleClients();
+}
+
+/**
+ * Set the time (ms) to wait for a client to acknowledge a packet, before the tally data is sent again, until
+ * the round trip time to the client is known, at least 1 ms. From then on it's derived from that, see _updateResendTimeout()
+ */
+void TallyServer::setResendTimeout(uint16_t timeout) {
+    _resendTimeout = timeout ? timeout : 1; //As for the keep alive interval
+    for (int i = 0; i < _maxClients; i++) _updateResendTimeout(&_clients[i]);
+    _scheduleClients();
+}
+
+/**
+ * Set the floor and ceiling (ms) of the resend timeout of each client, at least 1 ms. The same for both makes it fixed.
+ */
+void TallyServer::setResendTimeoutLimits(uint16_t minTimeout, uint16_t maxTimeout) {
+    _minResendTimeout = minTimeout ? minTimeout : 1; //As for the keep alive interval
+    _maxResendTimeout = maxTimeout > _minResendTimeout ? maxTimeout : _minResendTimeout;
+    for (int i = 0; i < _maxClients; i++) _updateResendTimeout(&_clients[i]);
+    _scheduleClients();
+}
+
+/**
+ * Set the time (ms) without packets from a client after which it's disconnected
+ */
+void TallyServer::setClientTimeout(uint16_t timeout) {
+    _clientTimeout = timeout;
+    _scheduleClients();
+}
 
-    _udp.begin(9910);
+/**
+ * Send clients the relays the tally came through (TlHp command), ending with this one as relayID,
+ * so a tally light that relays it on can tell a loop from a tree. 0 stops sending it.
+ */
+void TallyServer::setRelayID(uint32_t relayID) {
+    if (relayID && !_reserveBuffer(_tallyDataLength(_atemTallySources, _atemTallyBySourceSources))) return; //No room for the TlHp, stay as is
+    _relayID = relayID;
+    _tallyFlagsChanged = true;
+}
+
+/**
+ * Set the number of relays the tally came through before it got here, see setUpstreamRelay(). 0 when
+ * it comes from the switcher itself. At TALLY_SERVER_MAX_HOPS there's no room for this one in the path,
+ * so all clients are disconnected and new ones turned away.
+ */
+void TallyServer::setUpstreamHops(uint8_t hops) {
+    if (hops > TALLY_SERVER_MAX_HOPS) hops = TALLY_SERVER_MAX_HOPS;
+    if (hops == _upstreamHops) return;
+
+    _upstreamHops = hops;
+    if (_upstreamHops >= TALLY_SERVER_MAX_HOPS) _clearClients();
+    _tallyFlagsChanged = true; //Clients further down learn about the new path
+}
+
+/**
+ * Set the relay the tally came through at position hop from the switcher, and the time (us) it took
+ * that relay to pass the last change on
+ */
+void TallyServer::setUpstreamRelay(uint8_t hop, uint32_t relayID, uint32_t delay) {
+    if (hop >= TALLY_SERVER_MAX_HOPS) return;
+    if (_relayIDs[hop] != relayID && hop < _upstreamHops) _tallyFlagsChanged = true;
+    _relayIDs[hop] = relayID;
+    _relayDelays[hop] = delay; //Changes with every change of tally, so it goes out with the next one
+}
+
+/**
+ * Get the time (us) from the last change of tally being set until it was sent to clients
+ */
+uint32_t TallyServer::getRelayDelay() {
+    return _relayDelay;
+}
+
+/**
+ * Get the number of clients connected, whether they finished connecting or not
+ */
+uint16_t TallyServer::getClientCount() {
+    return _maxClients - _freeClientCount;
+}
+
+/**
+ * Get the number of clients there is room for, the indexes getClientStats() takes
+ */
+int TallyServer::getMaxClients() {
+    return _maxClients;
+}
+
+/**
+ * Get how the link to the client at index is doing. Returns false if no client is connected there.
+ */
+bool TallyServer::getClientStats(int index, TallyClientStats *stats) {
+    if (index < 0 || index >= _maxClients || !_clients[index]._isConnected) return false;
+
+    TallyClient *client = &_clients[index];
+    stats->ip = client->_tallyIP;
+    stats->port = client->_tallyPort;
+    stats->initialized = client->_isInitialized;
+    stats->multicast = client->_isMulticast;
+    stats->subscribedIndexes = client->_subscribedIndexCount;
+    stats->rtt = client->_srtt;
+    stats->rttVariation = client->_rttVar;
+    stats->resendTimeout = client->_resendTimeout;
+    stats->loss = (uint32_t)client->_loss * 1000 / 0xFFFF;
+    stats->packetsSent = client->_packetsSent;
+    stats->resends = client->_resends;
+    stats->resendRequests = client->_resendRequests;
+    return true;
 }
 
 /**
  * Disable tally server, disconnecting all tally lights currently connected.
  */
 void TallyServer::end() {
-    _udp.stop();
+    _udp->stop();
 
-    for (int i = 0; i < _maxClients; i++) _resetClient(&_clients[i]);
+    _clearClients();
 }
 
 /** 
  * Handle data transmission and connections to clients
  */
 void TallyServer::runLoop() {
+    if (!_clients) return; //Not begun
+
     // Handle incoming data    
     uint16_t packetSize = 0;
-    while ((packetSize = _udp.parsePacket()) > 0) {
-        if (_udp.available()) {
-            IPAddress remoteIP = _udp.remoteIP();
-            uint16_t remotePort = _udp.remotePort();
+    while ((packetSize = _udp->parsePacket()) > 0) {
+        if (_udp->available()) {
+            IPAddress remoteIP = _udp->remoteIP();
+            uint16_t remotePort = _udp->remotePort();
 
-            _udp.read(_buffer, 12);
+            _udp->read(_buffer, 12);
             uint8_t flags = _buffer[0] & 0b11111000;
-            uint16_t packetLen = (_buffer[0] & 0b00000111) + _buffer[1];
+            uint16_t packetLen = ((_buffer[0] & 0b00000111) << 8) + _buffer[1];
             #if TALLY_SERVER_DEBUG >= 2
             Serial.print(remoteIP);
             Serial.print(':');
@@ -93,8 +290,14 @@ void TallyServer::runLoop() {
                     client->_lastRecv = millis();
 
                     if (client->_isInitialized) { //Handle initialized client
+                        if(packetLen > 12) _readClientCmds(client, packetLen);
+
+                        uint16_t resendPacketID = ((_buffer[6] << 8) + _buffer[7] + 1) % TALLY_SERVER_MAX_PACKET_ID; //The client asks for the packet after this ID, as with the ATEM
+
                         if(flags & TALLY_SERVER_FLAG_ACK) {
-                            client->_lastAckedID = (_buffer[4] << 8) + _buffer[5];
+                            uint16_t ackedID = (_buffer[4] << 8) + _buffer[5];
+                            if(_isNewerPacketID(ackedID, client->_lastAckedID)) client->_lastAckedID = ackedID; //Acks may come late, and out of order
+                            _ackReceived(client, ackedID);
                             #if TALLY_SERVER_DEBUG > 1
                             Serial.print(client->_tallyIP);
                             Serial.print(':');
@@ -113,18 +316,23 @@ void TallyServer::runLoop() {
                             Serial.println(" - Ack resquest recieved - responded");
                             #endif
 
-                        } if(flags & TALLY_SERVER_FLAG_RESEND_REQUEST) { //All we ever send is tally data... So let's just do that again.
-                            uint16_t resendPacketID = (_buffer[6] << 8) + _buffer[7] + 1; //For some reason ATEMbase library subtracts one when requesting a resend - we add one back for it to work...
+                        } if(flags & TALLY_SERVER_FLAG_RESEND_REQUEST) {
+                            _resendPacket(client, resendPacketID);
+                        }
+
+                        if(client->_subscriptionReceived) { //All tally data, as the client may have missed changes it now subscribed to, and the subscription to confirm it
+                            client->_subscriptionReceived = false;
                             _resetBuffer();
-                            uint16_t cmdLen = 12 + _createTallyDataCmd();
-                            _createHeader(client, TALLY_SERVER_FLAG_RESENT_PACKAGE | TALLY_SERVER_FLAG_ACK | TALLY_SERVER_FLAG_ACK_REQUEST, cmdLen, 0, resendPacketID);
+                            uint16_t cmdLen = 12 + _createTallyDataCmd(false);
+                            cmdLen += _createSubscriptionCmd(client, _buffer + cmdLen);
+                            _createHeader(client, TALLY_SERVER_FLAG_ACK_REQUEST, cmdLen);
                             _sendBuffer(client, cmdLen);
                             #if TALLY_SERVER_DEBUG
                             Serial.print(client->_tallyIP);
                             Serial.print(':');
                             Serial.print(client->_tallyPort);
-                            Serial.print(" - Resend resquest recieved - sent tally data with wanted packageID: ");
-                            Serial.println(resendPacketID);
+                            Serial.print(" - Subscribed to tally indexes: ");
+                            Serial.println(client->_subscribedIndexCount);
                             #endif
                         }
 
@@ -145,10 +353,7 @@ void TallyServer::runLoop() {
 
                     } else if (client->_isConnected) { // Initialize new connection
                         if(flags & TALLY_SERVER_FLAG_ACK) {
-                            _resetBuffer();
-                            uint16_t cmdLen = 12 + _createTallyDataCmd();
-                            _createHeader(client, TALLY_SERVER_FLAG_ACK_REQUEST, cmdLen);
-                            _sendBuffer(client, cmdLen);
+                            _sendTallyData(client, TALLY_SERVER_FLAG_ACK_REQUEST);
 
                             _resetBuffer();
                             _createHeader(client, TALLY_SERVER_FLAG_ACK_REQUEST, 12);
@@ -173,12 +378,24 @@ void TallyServer::runLoop() {
                         #endif
 
                     } else { //New connection
-                        if (flags & TALLY_SERVER_FLAG_HELLO) {//Respond to first hello packet.
+                        if ((flags & TALLY_SERVER_FLAG_HELLO) && _upstreamHops >= TALLY_SERVER_MAX_HOPS) { //Too far from the switcher to pass the tally on
+                            _resetBuffer();
+                            _createHeader(client, TALLY_SERVER_FLAG_HELLO, 20);
+                            _buffer[12] = TALLY_SERVER_CONNECTION_REJECTED;
+                            _sendBuffer(client, 20);
+                            #if TALLY_SERVER_DEBUG
+                            Serial.print(client->_tallyIP);
+                            Serial.print(':');
+                            Serial.print(client->_tallyPort);
+                            Serial.println(" - Connection rejected - too many hops from the switcher");
+                            #endif
+
+                        } else if (flags & TALLY_SERVER_FLAG_HELLO) {//Respond to first hello packet.
                             _resetBuffer();
                             _createHeader(client, TALLY_SERVER_FLAG_HELLO, 20);
                             _buffer[12] = TALLY_SERVER_CONNECTION_ACCEPTED;
                             _sendBuffer(client, 20);
-                            client->_isConnected = true;
+                            _registerClient(client);
                             #if TALLY_SERVER_DEBUG
                             Serial.print(client->_tallyIP);
                             Serial.print(':');
@@ -197,18 +414,19 @@ void TallyServer::runLoop() {
                         }
                     }
                 } else { //No client means no empty spot
-                    if (flags & TALLY_SERVER_FLAG_HELLO) { //Reject connection
+                    if (flags & TALLY_SERVER_FLAG_HELLO) { //Reject connection. There's no client to build the header from, so it's built here
+                        uint16_t sessionID = (_buffer[2] << 8) + _buffer[3];
                         _resetBuffer();
-                        client = new TallyServer::TallyClient();
-                        client->_tallyIP = remoteIP;
-                        client->_tallyPort = remotePort;
-                        _createHeader(client, TALLY_SERVER_FLAG_HELLO, 20);
+                        _buffer[0] = TALLY_SERVER_FLAG_HELLO;
+                        _buffer[1] = 20;
+                        _buffer[2] = sessionID >> 8;
+                        _buffer[3] = sessionID;
                         _buffer[12] = TALLY_SERVER_CONNECTION_REJECTED;
-                        _sendBuffer(client, 20);
+                        _sendBuffer(remoteIP, remotePort, 20);
                         #if TALLY_SERVER_DEBUG
-                        Serial.print(client->_tallyIP);
+                        Serial.print(remoteIP);
                         Serial.print(':');
-                        Serial.print(client->_tallyPort);
+                        Serial.print(remotePort);
                         Serial.println(" - Connection rejected - no empty spot");
                         #endif
                     } //Else we ignore what came in..
@@ -227,21 +445,42 @@ void TallyServer::runLoop() {
             }
             #endif
         }
-        _udp.flush();
+        _udp->flush();
     }
 
     if(_tallyFlagsChanged) { //Send new tally data to clients
-        //Reset buffer and construct tally data cmd. The cmd is the same for all clients
         #if TALLY_SERVER_DEBUG
         Serial.println("Sending new tally data to connected clients");
         #endif
-        _resetBuffer();
-        uint16_t cmdLen = 12 + _createTallyDataCmd();
+        _tallyVersion++;
+        _relayDelay = micros() - _tallyChangedAt;
+        _tallyDataCached = false;
+        if(_multicastPort) _sendMulticast();
 
-        //We build a client specific header and send the packet, if it's initialized
+        //Clients that acknowledged a version get what changed since, the others all tally data, built once. Clients
+        //mostly acknowledged the same version, so the delta is only built again for a client with another one
+        uint16_t cmdLen = 0;
+        int32_t cmdBaseVersion = -1; //-1 when no delta is built yet
         for(int i = 0; i < _maxClients; i++) {
             TallyClient *client = &_clients[i];
-            if(client->_isInitialized) {
+            if(client->_isInitialized && client->_subscribedIndexCount) { //Only sent the indexes it subscribed to, and nothing if none of them changed
+                _resetBuffer();
+                cmdBaseVersion = -1;
+                uint16_t subscriptionLen = client->_hasTallyVersion ? _createTallyDeltaCmd(client->_ackedTallyVersion, client->_subscribedIndexes, client->_subscribedIndexCount) : _createTallyDataCmd(false);
+                if(subscriptionLen) {
+                    _createHeader(client, TALLY_SERVER_FLAG_ACK_REQUEST, 12 + subscriptionLen);
+                    _sendBuffer(client, 12 + subscriptionLen);
+                }
+            } else if(client->_isInitialized && !client->_isMulticast && !client->_hasTallyVersion) {
+                _sendTallyData(client, TALLY_SERVER_FLAG_ACK_REQUEST);
+            } else if(client->_isInitialized && !client->_isMulticast) {
+                if(client->_ackedTallyVersion != cmdBaseVersion) {
+                    _resetBuffer();
+                    cmdLen = 12 + _createTallyDeltaCmd(client->_ackedTallyVersion);
+                    cmdBaseVersion = client->_ackedTallyVersion;
+                }
+
+                //We build a client specific header and send the packet
                 _createHeader(client, TALLY_SERVER_FLAG_ACK_REQUEST, cmdLen);
                 _sendBuffer(client, cmdLen);
             }
@@ -250,17 +489,40 @@ void TallyServer::runLoop() {
         _tallyFlagsChanged = false;
     }
 
+    //Clients that missed a multicast are sent the tally data on their own, and keep getting it that way until they acknowledge a multicast again
+    if(_multicastAckCheckPending && _hasTimePassed(_multicastSentAt, TALLY_SERVER_MULTICAST_ACK_TIMEOUT)) {
+        _multicastAckCheckPending = false;
+        for(int i = 0; i < _maxClients; i++) {
+            TallyClient *client = &_clients[i];
+            if(client->_isInitialized && client->_isMulticast && client->_multicastAckedSeq != _multicastSeq) {
+                _sendTallyData(client, TALLY_SERVER_FLAG_ACK_REQUEST);
+                client->_isMulticast = false;
+                #if TALLY_SERVER_DEBUG
+                Serial.print(client->_tallyIP);
+                Serial.print(':');
+                Serial.print(client->_tallyPort);
+                Serial.println(" - Multicast not acknowledged - Sent tally data");
+                #endif
+            }
+        }
+    }
+
     /**
-     * Keep connections alive by requesting ACK packages form them wtih a given interval
+     * Keep connections alive by requesting ACK packages form them wtih a given interval.
+     * Only clients with a deadline that has passed are looked at, see _scheduleClient()
      */
-    for(int i = 0; i < _maxClients; i++) {
-        TallyClient *client = &_clients[i];
+    unsigned long now = millis();
+    while(_timerHeapSize && (long)(now - _clients[_timerHeap[0]]._dueAt) >= 0) {
+        TallyClient *client = &_clients[_timerHeap[0]];
         if(client->_isInitialized) {
-            if(client->_lastAckedID < client->_localPacketIdCounter && _hasTimePassed(client->_lastSend, 250)) {
-                _resetBuffer();
-                uint16_t cmdLen = 12 + _createTallyDataCmd();
-                _createHeader(client, TALLY_SERVER_FLAG_ACK_REQUEST, cmdLen);
-                _sendBuffer(client, cmdLen);
+            if(_isNewerPacketID(client->_localPacketIdCounter, client->_lastAckedID) && _hasTimePassed(client->_lastSend, client->_resendTimeout)) {
+                //Waiting longer for the next ack, so a bad link isn't flooded
+                _packetLost(client);
+                client->_resends++;
+                if ((client->_resendTimeout << 1) <= _maxResendTimeout) client->_backoff++;
+                _updateResendTimeout(client);
+
+                _sendTallyData(client, TALLY_SERVER_FLAG_ACK_REQUEST);
                 #if TALLY_SERVER_DEBUG
                 Serial.print(client->_tallyIP);
                 Serial.print(':');
@@ -268,7 +530,7 @@ void TallyServer::runLoop() {
                 Serial.println(" - Ack not recieved - Resent tally data");
                 #endif
 
-            } else if(_hasTimePassed(client->_lastRecv, TALLY_SERVER_KEEP_ALIVE_MSG_INTERVAL) && _hasTimePassed(client->_lastSend, TALLY_SERVER_KEEP_ALIVE_MSG_INTERVAL)) {
+            } else if(_hasTimePassed(client->_lastRecv, _keepAliveInterval) && _hasTimePassed(client->_lastSend, _keepAliveInterval)) {
                 _resetBuffer();
                 _createHeader(client, TALLY_SERVER_FLAG_ACK_REQUEST, 12);
                 _sendBuffer(client, 12);
@@ -279,7 +541,7 @@ void TallyServer::runLoop() {
                 Serial.println(" - Ack request sent");
                 #endif
 
-            } else if(_hasTimePassed(client->_lastRecv, 5000)) {
+            } else if(_hasTimePassed(client->_lastRecv, _clientTimeout)) {
                 _resetClient(client);
                 #if TALLY_SERVER_DEBUG
                 Serial.print(client->_tallyIP);
@@ -289,8 +551,8 @@ void TallyServer::runLoop() {
                 #endif
             }
 
-        } else if(client->_isConnected) {
-            if(_hasTimePassed(client->_lastSend, TALLY_SERVER_KEEP_ALIVE_MSG_INTERVAL)) {
+        } else {
+            if(_hasTimePassed(client->_lastSend, _keepAliveInterval)) {
                 _resetBuffer();
                 _createHeader(client, TALLY_SERVER_FLAG_HELLO, 20);
                 _buffer[12] = TALLY_SERVER_CONNECTION_ACCEPTED;
@@ -302,7 +564,7 @@ void TallyServer::runLoop() {
                 Serial.println(" - Resent hello packet to client");
                 #endif
 
-            } else if(_hasTimePassed(client->_lastRecv, 5000)) {
+            } else if(_hasTimePassed(client->_lastRecv, _clientTimeout)) {
                 _resetClient(client);
                 #if TALLY_SERVER_DEBUG
                 Serial.print(client->_tallyIP);
@@ -312,80 +574,646 @@ void TallyServer::runLoop() {
                 #endif
             }
         }
+
+        //Its deadline may not have moved if packets came in since it was set, so it's set again either way
+        if(client->_isConnected) _scheduleClient(client);
+    }
+}
+
+/**
+ * Make room for the given number of sources in the TlIn and TlSr up front, e.g. the most a switcher
+ * may have, so setting up to that many later takes no heap memory. Capped to what fits in a packet.
+ */
+void TallyServer::reserveTallySources(uint16_t tallySources, uint16_t tallyBySourceSources) {
+    while (_tallyDataLength(tallySources, tallyBySourceSources) > TALLY_SERVER_MAX_PACKET_LENGTH) {
+        if (tallyBySourceSources > tallySources) tallyBySourceSources--;
+        else tallySources--;
     }
+
+    _reserveTallySources(tallySources);
+    _reserveTallyBySourceSources(tallyBySourceSources);
+    _reserveBuffer(_tallyDataLength(tallySources, tallyBySourceSources));
 }
 
 /** 
- * Set the number of tally sources to send to clients. Must be less than TALLY_SERVER_MAX_TALLY_FLAGS.
+ * Set the number of tally sources to send to clients in the TlIn. Capped to what fits in a packet
+ * along with the TlSr. The tally flags of new sources are 0.
  */
-void TallyServer::setTallySources(uint8_t tallySources) {
-    if(tallySources < TALLY_SERVER_MAX_TALLY_FLAGS)
+void TallyServer::setTallySources(uint16_t tallySources) {
+    while (_tallyDataLength(tallySources, _atemTallyBySourceSources) > TALLY_SERVER_MAX_PACKET_LENGTH) tallySources--;
+
+    if (!_reserveTallySources(tallySources)) return;
+    if (!_reserveBuffer(_tallyDataLength(tallySources, _atemTallyBySourceSources))) return;
+
+    if (_atemTallySources != tallySources) {
         _atemTallySources = tallySources;
+        _tallyLayoutVersion = _tallyVersion + 1;
+        _tallyChanged();
+    }
 }
 
 /**
- * Set tally flag to send to clients
+ * Set tally flag to send to clients in the TlIn
  */
-void TallyServer::setTallyFlag(uint8_t tallyIndex, uint8_t tallyFlag) {
-    if (tallyIndex < TALLY_SERVER_MAX_TALLY_FLAGS && _atemTallyFlags[tallyIndex] != tallyFlag) {
+void TallyServer::setTallyFlag(uint16_t tallyIndex, uint8_t tallyFlag) {
+    if (tallyIndex < _atemTallyCapacity && _atemTallyFlags[tallyIndex] != tallyFlag) {
         _atemTallyFlags[tallyIndex] = tallyFlag;
-        _tallyFlagsChanged = true;
+        _atemTallyChangedVersion[tallyIndex] = _tallyVersion + 1; //The version it's sent in
+        _tallyChanged();
+    }
+}
+
+/** 
+ * Set the number of video sources to send to clients in the TlSr. 0 leaves the TlSr out.
+ * Capped to what fits in a packet along with the TlIn.
+ */
+void TallyServer::setTallyBySourceSources(uint16_t tallySources) {
+    while (_tallyDataLength(_atemTallySources, tallySources) > TALLY_SERVER_MAX_PACKET_LENGTH) tallySources--;
+
+    if (!_reserveTallyBySourceSources(tallySources)) return;
+    if (!_reserveBuffer(_tallyDataLength(_atemTallySources, tallySources))) return;
+
+    if (_atemTallyBySourceSources != tallySources) {
+        _atemTallyBySourceSources = tallySources;
+        _tallyLayoutVersion = _tallyVersion + 1;
+        _tallyChanged();
+    }
+}
+
+/**
+ * Set the video source and its tally flag at the given position in the TlSr sent to clients
+ */
+void TallyServer::setTallyBySourceFlag(uint16_t index, uint16_t videoSource, uint8_t tallyFlag) {
+    if (index < _atemTallyBySourceCapacity && (_atemTallyBySourceVideoSources[index] != videoSource || _atemTallyBySourceFlags[index] != tallyFlag)) {
+        if (_atemTallyBySourceVideoSources[index] != videoSource) _tallyLayoutVersion = _tallyVersion + 1; //Deltas only carry tally flags
+        _atemTallyBySourceVideoSources[index] = videoSource;
+        _atemTallyBySourceFlags[index] = tallyFlag;
+        _atemTallyBySourceChangedVersion[index] = _tallyVersion + 1;
+        _tallyChanged();
     }
 }
 
 /**
- * Build tally by index commant in the command buffer
- * based on _atemTallySources and _atemTallyFlags, and
- * return the commands length.
+ * Build the tally data commands, followed by the multicast command if multicast is on
  */
 uint16_t TallyServer::_createTallyDataCmd() {
-    uint16_t cmdLen = 10 + _atemTallySources; //header = 8 + 2 (num sources) + *num sources*
+    return _createTallyDataCmd(_multicastPort != 0);
+}
+
+/**
+ * Build tally by index command, followed by the tally by source command if
+ * there are any sources for it, in the command buffer based on _atemTallySources,
+ * _atemTallyFlags and _atemTallyBySource*, and return the commands length.
+ */
+uint16_t TallyServer::_createTallyDataCmd(bool multicastCmd) {
+    return _createTallyDataCmd(_buffer + 12, multicastCmd);
+}
+
+/**
+ * Build the tally data commands at cmds, which has to be zeroed, and return their length
+ */
+uint16_t TallyServer::_createTallyDataCmd(uint8_t *cmds, bool multicastCmd) {
+    uint16_t pathLen = _createRelayPathCmd(cmds);
+
+    //Version of the tally data, which the client acknowledges, so it can be sent deltas against it
+    uint8_t *cmd = cmds + pathLen;
+    cmd[0] = 0;
+    cmd[1] = TALLY_SERVER_VERSION_CMD_LENGTH;
+    cmd[4] = 'T';
+    cmd[5] = 'l';
+    cmd[6] = 'V';
+    cmd[7] = 'r';
+    cmd[8] = _tallyVersion >> 8;
+    cmd[9] = _tallyVersion;
+
+    cmd += TALLY_SERVER_VERSION_CMD_LENGTH;
+    uint16_t tallyLen = 10 + _atemTallySources; //header = 8 + 2 (num sources) + *num sources*
 
     //Cmd Length
-    _buffer[12] = cmdLen >> 8;
-    _buffer[13] = cmdLen;
+    cmd[0] = tallyLen >> 8;
+    cmd[1] = tallyLen;
 
     //Cmd header byte 3 and 4's use is unknown, and aren't needed by the ATEM library...
 
     //Cmd name
-    _buffer[16] = 'T';
-    _buffer[17] = 'l';
-    _buffer[18] = 'I';
-    _buffer[19] = 'n';
+    cmd[4] = 'T';
+    cmd[5] = 'l';
+    cmd[6] = 'I';
+    cmd[7] = 'n';
     
     //Number of tally sources
-    _buffer[20] = _atemTallySources >> 8;
-    _buffer[21] = _atemTallySources;
+    cmd[8] = _atemTallySources >> 8;
+    cmd[9] = _atemTallySources;
 
     //Tally flag for each source
-    for(int i = 0; i < _atemTallySources; i++) {
-        _buffer[22 + i] = _atemTallyFlags[i];
+    if (_atemTallySources) memcpy(cmd + 10, _atemTallyFlags, _atemTallySources);
+
+    uint16_t cmdLen = pathLen + TALLY_SERVER_VERSION_CMD_LENGTH + tallyLen;
+
+    if (_atemTallyBySourceSources) {
+        cmdLen += _createTallyBySourceCmd(cmds + cmdLen);
+    }
+
+    if (multicastCmd) {
+        //Where multicasts go, and the sequence number of the last one, so the client can tell older multicasts from newer ones
+        uint8_t *cmd = cmds + cmdLen;
+        cmd[0] = 0;
+        cmd[1] = TALLY_SERVER_MULTICAST_CMD_LENGTH;
+        cmd[4] = 'T';
+        cmd[5] = 'l';
+        cmd[6] = 'M';
+        cmd[7] = 'c';
+        cmd[8] = _multicastIP[0];
+        cmd[9] = _multicastIP[1];
+        cmd[10] = _multicastIP[2];
+        cmd[11] = _multicastIP[3];
+        cmd[12] = _multicastPort >> 8;
+        cmd[13] = _multicastPort;
+        cmd[14] = _multicastSeq >> 8;
+        cmd[15] = _multicastSeq;
+        cmdLen += TALLY_SERVER_MULTICAST_CMD_LENGTH;
     }
 
     return cmdLen;
 }
 
+/**
+ * Build the tally data commands of the current tally version in _tallyData, if they aren't yet, and return their
+ * length. They only change with the version (or the multicast settings), however many clients they're sent to.
+ */
+uint16_t TallyServer::_cacheTallyData() {
+    if (!_tallyDataCached) {
+        memset(_tallyData, 0, _bufferLength);
+        _tallyDataCmdLength = _createTallyDataCmd(_tallyData + 12, _multicastPort != 0);
+        _tallyDataCached = true;
+    }
+    return _tallyDataCmdLength;
+}
+
+/**
+ * Build the relay path command at cmd: the relays the tally came through, this one last, with the time
+ * each took to pass the last change on. Returns its length, 0 if it isn't sent.
+ */
+uint16_t TallyServer::_createRelayPathCmd(uint8_t *cmd) {
+    if (!_relayID || _upstreamHops >= TALLY_SERVER_MAX_HOPS) return 0;
+
+    uint8_t hops = _upstreamHops + 1;
+    uint16_t pathLen = 10 + TALLY_SERVER_HOP_LENGTH * hops; //header = 8 + 1 (num hops) + 1 (unused) + 8 * *num hops*
+    cmd[0] = pathLen >> 8;
+    cmd[1] = pathLen;
+    cmd[4] = 'T';
+    cmd[5] = 'l';
+    cmd[6] = 'H';
+    cmd[7] = 'p';
+    cmd[8] = hops;
+    cmd[9] = 0;
+
+    //Relay ID and delay (us) of each hop, from the switcher on
+    for (uint8_t i = 0; i < hops; i++) {
+        uint32_t relayID = i < _upstreamHops ? _relayIDs[i] : _relayID;
+        uint32_t delay = i < _upstreamHops ? _relayDelays[i] : _relayDelay;
+        uint8_t *hop = cmd + 10 + TALLY_SERVER_HOP_LENGTH * i;
+        hop[0] = relayID >> 24;
+        hop[1] = relayID >> 16;
+        hop[2] = relayID >> 8;
+        hop[3] = relayID;
+        hop[4] = delay >> 24;
+        hop[5] = delay >> 16;
+        hop[6] = delay >> 8;
+        hop[7] = delay;
+    }
+
+    return pathLen;
+}
+
+/**
+ * Build the tally by source command at cmd, and return its length
+ */
+uint16_t TallyServer::_createTallyBySourceCmd(uint8_t *cmd) {
+    uint16_t tallyBySourceLen = 10 + 3 * _atemTallyBySourceSources; //header = 8 + 2 (num sources) + 3 * *num sources*
+
+    cmd[0] = tallyBySourceLen >> 8;
+    cmd[1] = tallyBySourceLen;
+    cmd[4] = 'T';
+    cmd[5] = 'l';
+    cmd[6] = 'S';
+    cmd[7] = 'r';
+    cmd[8] = _atemTallyBySourceSources >> 8;
+    cmd[9] = _atemTallyBySourceSources;
+
+    //Video source and tally flag for each source
+    for (uint16_t i = 0; i < _atemTallyBySourceSources; i++) {
+        cmd[10 + 3 * i] = _atemTallyBySourceVideoSources[i] >> 8;
+        cmd[11 + 3 * i] = _atemTallyBySourceVideoSources[i];
+        cmd[12 + 3 * i] = _atemTallyBySourceFlags[i];
+    }
+
+    return tallyBySourceLen;
+}
+
+/**
+ * Build a delta command with the TlIn and TlSr tally flags that changed since baseVersion, a version the
+ * client has acknowledged, and return its length. All tally data is built instead if the client is too far
+ * behind, if the sources or the number of them changed since, or if it wouldn't be any shorter.
+ */
+uint16_t TallyServer::_createTallyDeltaCmd(uint16_t baseVersion) {
+    return _createTallyDeltaCmd(baseVersion, NULL, 0);
+}
+
+/**
+ * Build a delta command against baseVersion with only the TlIn tally flags at the given indexes that changed
+ * since, for a client that subscribed to them, and return its length. 0 if none of them changed: there's nothing
+ * to send. NULL indexes are all of them, TlSr included. All tally data is built instead where it would be above.
+ */
+uint16_t TallyServer::_createTallyDeltaCmd(uint16_t baseVersion, const uint16_t *indexes, uint8_t indexCount) {
+    if ((uint16_t)(_tallyVersion - baseVersion) > TALLY_SERVER_DELTA_MAX_AGE || (int16_t)(_tallyLayoutVersion - baseVersion) > 0) {
+        return _createTallyDataCmd(indexes ? false : _multicastPort != 0);
+    }
+
+    //header = 8 + 2 (base version) + 2 (version) + 2 (num TlIn changes) + 3 * *num TlIn changes* + 2 (num TlSr changes) + 3 * *num TlSr changes*
+    //TlIn changes are by index, TlSr changes by position in the TlSr. The relay path goes before it, as with all tally data
+    uint16_t pathLen = _createRelayPathCmd(_buffer + 12);
+    uint8_t *cmd = _buffer + 12 + pathLen;
+    uint16_t fullLen = _tallyDataLength(_atemTallySources, _atemTallyBySourceSources) - 12 - TALLY_SERVER_RELAY_PATH_CMD_MAX_LENGTH - TALLY_SERVER_SUBSCRIPTION_CMD_MAX_LENGTH;
+    uint16_t cmdLen = 14;
+    uint16_t changes = 0;
+    for (uint16_t n = 0; n < (indexes ? indexCount : _atemTallySources); n++) {
+        uint16_t i = indexes ? indexes[n] : n;
+        if (i >= _atemTallySources || (int16_t)(_atemTallyChangedVersion[i] - baseVersion) <= 0) continue;
+        if (cmdLen + 3 + 2 >= fullLen) break;
+        cmd[cmdLen] = i >> 8;
+        cmd[cmdLen + 1] = i;
+        cmd[cmdLen + 2] = _atemTallyFlags[i];
+        cmdLen += 3;
+        changes++;
+    }
+    if (indexes && !changes) return 0;
+
+    uint16_t tallyBySourceChangesPointer = cmdLen;
+    uint16_t tallyBySourceChanges = 0;
+    cmdLen += 2;
+    for (uint16_t i = 0; i < (indexes ? 0 : _atemTallyBySourceSources); i++) {
+        if ((int16_t)(_atemTallyBySourceChangedVersion[i] - baseVersion) <= 0) continue;
+        if (cmdLen + 3 >= fullLen) break;
+        cmd[cmdLen] = i >> 8;
+        cmd[cmdLen + 1] = i;
+        cmd[cmdLen + 2] = _atemTallyBySourceFlags[i];
+        cmdLen += 3;
+        tallyBySourceChanges++;
+    }
+
+    if (cmdLen + 3 >= fullLen) { //Not shorter
+        _resetBuffer();
+        return _createTallyDataCmd(indexes ? false : _multicastPort != 0);
+    }
+
+    cmd[0] = cmdLen >> 8;
+    cmd[1] = cmdLen;
+    cmd[4] = 'T';
+    cmd[5] = 'l';
+    cmd[6] = 'D';
+    cmd[7] = 'l';
+    cmd[8] = baseVersion >> 8;
+    cmd[9] = baseVersion;
+    cmd[10] = _tallyVersion >> 8;
+    cmd[11] = _tallyVersion;
+    cmd[12] = changes >> 8;
+    cmd[13] = changes;
+    cmd[tallyBySourceChangesPointer] = tallyBySourceChanges >> 8;
+    cmd[tallyBySourceChangesPointer + 1] = tallyBySourceChanges;
+    return pathLen + cmdLen;
+}
+
+/**
+ * Build the subscription command at cmd, confirming to a client the TlIn indexes it subscribed to, and return its length
+ */
+uint16_t TallyServer::_createSubscriptionCmd(TallyClient *client, uint8_t *cmd) {
+    uint16_t subscriptionLen = 10 + 2 * client->_subscribedIndexCount; //header = 8 + 2 (num indexes) + 2 * *num indexes*
+    cmd[0] = subscriptionLen >> 8;
+    cmd[1] = subscriptionLen;
+    cmd[4] = 'T';
+    cmd[5] = 'l';
+    cmd[6] = 'S';
+    cmd[7] = 'b';
+    cmd[8] = 0;
+    cmd[9] = client->_subscribedIndexCount;
+    for (uint8_t i = 0; i < client->_subscribedIndexCount; i++) {
+        cmd[10 + 2 * i] = client->_subscribedIndexes[i] >> 8;
+        cmd[11 + 2 * i] = client->_subscribedIndexes[i];
+    }
+
+    return subscriptionLen;
+}
+
+/**
+ * Send the tally data to all multicast clients at once, with the next multicast sequence number as packet ID.
+ * No ack is requested, as clients acknowledge it with a TlMa command in their session, see _readClientCmds().
+ */
+void TallyServer::_sendMulticast() {
+    _multicastSeq++;
+    _multicastSentAt = millis();
+    _multicastAckCheckPending = true;
+
+    _resetBuffer();
+    uint16_t cmdLen = 12 + _createTallyDataCmd(false);
+    _buffer[0] = (cmdLen >> 8) & 0b00000111;
+    _buffer[1] = cmdLen;
+    _buffer[10] = _multicastSeq >> 8;
+    _buffer[11] = _multicastSeq;
+    _sendBuffer(_multicastIP, _multicastPort, cmdLen);
+}
+
+/**
+ * Read the commands after the header of a packet from a client, looking for the acknowledgements of a
+ * multicast (TlMa) and of a version of the tally data (TlVa), and for a subscription (TlSb). A client that sends
+ * TlMa receives multicasts, so it gets tally data that way from now on. A client that sends TlVa can be sent deltas
+ * against that version. A client that sends TlSb with TlIn indexes is only sent those, and only when they change,
+ * never by multicast. It sends TlSb with every ack until it's confirmed, see runLoop().
+ */
+void TallyServer::_readClientCmds(TallyClient *client, uint16_t packetLen) {
+    if (packetLen > _bufferLength) return;
+    _udp->read(_buffer + 12, packetLen - 12);
+
+    for (uint16_t pointer = 12; pointer + 8 <= packetLen; ) {
+        uint16_t cmdLen = (_buffer[pointer] << 8) | _buffer[pointer + 1];
+        if (cmdLen < 8 || pointer + cmdLen > packetLen) break;
+
+        if (cmdLen >= 10 && _buffer[pointer + 4] == 'T' && _buffer[pointer + 5] == 'l' && _buffer[pointer + 6] == 'M' && _buffer[pointer + 7] == 'a') {
+            uint16_t seq = (_buffer[pointer + 8] << 8) | _buffer[pointer + 9];
+            if (!client->_isMulticast || (int16_t)(seq - client->_multicastAckedSeq) > 0) client->_multicastAckedSeq = seq;
+            client->_isMulticast = _multicastPort != 0 && !client->_subscribedIndexCount;
+        } else if (cmdLen >= 10 && _buffer[pointer + 4] == 'T' && _buffer[pointer + 5] == 'l' && _buffer[pointer + 6] == 'V' && _buffer[pointer + 7] == 'a') {
+            uint16_t version = (_buffer[pointer + 8] << 8) | _buffer[pointer + 9];
+            if (!client->_hasTallyVersion || (int16_t)(version - client->_ackedTallyVersion) > 0) client->_ackedTallyVersion = version;
+            client->_hasTallyVersion = true;
+        } else if (cmdLen >= 10 && _buffer[pointer + 4] == 'T' && _buffer[pointer + 5] == 'l' && _buffer[pointer + 6] == 'S' && _buffer[pointer + 7] == 'b') {
+            uint16_t count = (_buffer[pointer + 8] << 8) | _buffer[pointer + 9];
+            if (count > TALLY_SERVER_MAX_SUBSCRIBED_INDEXES || 10 + 2 * count > cmdLen) count = 0; //Too many to filter on: all tally data
+            client->_subscribedIndexCount = count;
+            for (uint16_t i = 0; i < count; i++) client->_subscribedIndexes[i] = (_buffer[pointer + 10 + 2 * i] << 8) | _buffer[pointer + 11 + 2 * i];
+            client->_subscriptionReceived = true;
+            if (count) client->_isMulticast = false;
+        }
+        pointer += cmdLen;
+    }
+}
+
+/**
+ * Length of a packet with the tally data for the given number of sources, header included
+ */
+uint16_t TallyServer::_tallyDataLength(uint16_t tallySources, uint16_t tallyBySourceSources) {
+    return 12 + TALLY_SERVER_RELAY_PATH_CMD_MAX_LENGTH + TALLY_SERVER_VERSION_CMD_LENGTH + 10 + tallySources + (tallyBySourceSources ? 10 + 3 * tallyBySourceSources : 0) + TALLY_SERVER_MULTICAST_CMD_LENGTH + TALLY_SERVER_SUBSCRIPTION_CMD_MAX_LENGTH;
+}
+
+/**
+ * Make room for the tally flags of tallySources sources in the TlIn. Returns false if there is not enough memory for it.
+ */
+bool TallyServer::_reserveTallySources(uint16_t tallySources) {
+    if (tallySources <= _atemTallyCapacity) return true;
+
+    uint8_t *tallyFlags = (uint8_t *)realloc(_atemTallyFlags, tallySources);
+    if (!tallyFlags) return false;
+    memset(tallyFlags + _atemTallyCapacity, 0, tallySources - _atemTallyCapacity);
+    _atemTallyFlags = tallyFlags;
+    uint16_t *changedVersions = (uint16_t *)realloc(_atemTallyChangedVersion, tallySources * sizeof(uint16_t));
+    if (!changedVersions) return false;
+    memset(changedVersions + _atemTallyCapacity, 0, (tallySources - _atemTallyCapacity) * sizeof(uint16_t));
+    _atemTallyChangedVersion = changedVersions;
+    _atemTallyCapacity = tallySources;
+    return true;
+}
+
+/**
+ * Make room for the video sources and tally flags of tallySources sources in the TlSr. Returns false if there is not enough memory for it.
+ */
+bool TallyServer::_reserveTallyBySourceSources(uint16_t tallySources) {
+    if (tallySources <= _atemTallyBySourceCapacity) return true;
+
+    uint16_t *videoSources = (uint16_t *)realloc(_atemTallyBySourceVideoSources, tallySources * sizeof(uint16_t));
+    if (!videoSources) return false;
+    _atemTallyBySourceVideoSources = videoSources;
+    uint8_t *tallyFlags = (uint8_t *)realloc(_atemTallyBySourceFlags, tallySources);
+    if (!tallyFlags) return false;
+    _atemTallyBySourceFlags = tallyFlags;
+    uint16_t *changedVersions = (uint16_t *)realloc(_atemTallyBySourceChangedVersion, tallySources * sizeof(uint16_t));
+    if (!changedVersions) return false;
+    _atemTallyBySourceChangedVersion = changedVersions;
+
+    memset(_atemTallyBySourceVideoSources + _atemTallyBySourceCapacity, 0, (tallySources - _atemTallyBySourceCapacity) * sizeof(uint16_t));
+    memset(_atemTallyBySourceFlags + _atemTallyBySourceCapacity, 0, tallySources - _atemTallyBySourceCapacity);
+    memset(_atemTallyBySourceChangedVersion + _atemTallyBySourceCapacity, 0, (tallySources - _atemTallyBySourceCapacity) * sizeof(uint16_t));
+    _atemTallyBySourceCapacity = tallySources;
+    return true;
+}
+
+/**
+ * Make the buffer at least length bytes. Returns false if there is not enough memory for it.
+ */
+bool TallyServer::_reserveBuffer(uint16_t length) {
+    if (length <= _bufferLength) return true;
+
+    uint8_t *buffer = (uint8_t *)realloc(_buffer, length);
+    if (!buffer) return false;
+    _buffer = buffer;
+    uint8_t *tallyData = (uint8_t *)realloc(_tallyData, length);
+    if (!tallyData) return false;
+    _tallyData = tallyData;
+    _bufferLength = length;
+    return true;
+}
+
 /**
  * Get the client struct with the given IP and Port. If no match, a disconnected spot is
  * returned with the given IP and Port. If no disconnected spots are availabel, NULL is returned.
  */
 TallyServer::TallyClient *TallyServer::_getTallyClient(IPAddress clientIP, uint16_t clientPort) {
-    int8_t emptySpot = -1;
+    uint16_t mask = (1 << _clientTableBits) - 1;
+    for (uint16_t slot = _clientSlot(clientIP, clientPort); _clientTable[slot]; slot = (slot + 1) & mask) {
+        TallyClient *client = &_clients[_clientTable[slot] - 1];
+        if (client->_tallyIP == clientIP && client->_tallyPort == clientPort) return client;
+    }
+
+    if (_freeClientCount) {
+        TallyClient *client = &_clients[_freeClients[_freeClientCount - 1]]; //Only taken off the stack once it's connected, see _registerClient()
+        client->_tallyIP = clientIP;
+        client->_tallyPort = clientPort;
+        return client;
+    }
+
+    return NULL;
+}
+
+/**
+ * Make room for maxClients clients and their registry, dropping all clients there were
+ */
+void TallyServer::_allocateClients(int maxClients) {
+    delete[] _clients;
+    delete[] _clientTable;
+    delete[] _freeClients;
+    delete[] _timerHeap;
+
+    _clientTableBits = 3;
+    while ((1 << _clientTableBits) < 2 * maxClients) _clientTableBits++;
+
+    _clients = new TallyServer::TallyClient[maxClients];
+    _clientTable = new uint16_t[1 << _clientTableBits];
+    _freeClients = new uint16_t[maxClients];
+    _timerHeap = new uint16_t[maxClients];
+    _maxClients = maxClients;
+
+    _clearClients();
+}
+
+/**
+ * Reset all clients and empty the registry
+ */
+void TallyServer::_clearClients() {
+    if (!_clients) return; //Not begun
+    memset(_clientTable, 0, (1 << _clientTableBits) * sizeof(uint16_t));
+    _timerHeapSize = 0;
     for (int i = 0; i < _maxClients; i++) {
-        if (_clients[i]._isConnected && _clients[i]._tallyIP == clientIP && _clients[i]._tallyPort == clientPort) {
-            return &_clients[i];
-        } else if (emptySpot < 0 && !_clients[i]._isConnected) {
-            emptySpot = i;
+        _clients[i]._isConnected = false;
+        _clients[i]._timerIndex = TALLY_SERVER_NOT_SCHEDULED;
+        _resetClient(&_clients[i]);
+        _freeClients[i] = _maxClients - 1 - i; //Hand out the first clients first
+    }
+    _freeClientCount = _maxClients;
+}
+
+/**
+ * Home slot in the registry of the client with the given IP and Port
+ */
+uint16_t TallyServer::_clientSlot(IPAddress clientIP, uint16_t clientPort) {
+    uint32_t key = (uint32_t)clientIP ^ ((uint32_t)clientPort << 16 | clientPort);
+    return (uint32_t)(key * 2654435769UL) >> (32 - _clientTableBits); //Fibonacci hashing
+}
+
+/**
+ * Mark the client returned by _getTallyClient() as connected, and add it to the registry
+ */
+void TallyServer::_registerClient(TallyClient *client) {
+    uint16_t index = client - _clients;
+    uint16_t mask = (1 << _clientTableBits) - 1;
+    uint16_t slot = _clientSlot(client->_tallyIP, client->_tallyPort);
+    while (_clientTable[slot]) slot = (slot + 1) & mask;
+    _clientTable[slot] = index + 1;
+
+    _freeClientCount--; //The client is the one on top of the stack, as _getTallyClient() handed it out
+    client->_isConnected = true;
+    _scheduleClient(client);
+}
+
+/**
+ * Remove a connected client from the registry and free its spot
+ */
+void TallyServer::_unregisterClient(TallyClient *client) {
+    uint16_t index = client - _clients;
+    uint16_t mask = (1 << _clientTableBits) - 1;
+    uint16_t slot = _clientSlot(client->_tallyIP, client->_tallyPort);
+    while (_clientTable[slot] != index + 1) slot = (slot + 1) & mask;
+    _clientTable[slot] = 0;
+
+    //Move clients after it up into the hole, if it's between them and their home slot, so lookups don't stop at it
+    for (uint16_t next = (slot + 1) & mask; _clientTable[next]; next = (next + 1) & mask) {
+        TallyClient *moved = &_clients[_clientTable[next] - 1];
+        uint16_t home = _clientSlot(moved->_tallyIP, moved->_tallyPort);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            _clientTable[slot] = _clientTable[next];
+            _clientTable[next] = 0;
+            slot = next;
         }
     }
 
-    if (emptySpot >= 0) {
-        _clients[emptySpot]._tallyIP = clientIP;
-        _clients[emptySpot]._tallyPort = clientPort;
-        return &_clients[emptySpot];
+    _freeClients[_freeClientCount++] = index;
+    client->_isConnected = false;
+    _unscheduleClient(client);
+}
+
+/**
+ * Set the deadline of a connected client: the first time one of the checks at the end of runLoop() may
+ * have something to do for it. It's kept in a min-heap by deadline, so runLoop() only looks at clients
+ * that are due. Receiving packets only moves deadlines on, so they're set again when the client is due,
+ * but sending packets may move them forward, so this is called for every packet sent.
+ */
+void TallyServer::_scheduleClient(TallyClient *client) {
+    unsigned long dueAt = client->_lastRecv + _clientTimeout;
+    unsigned long keepAliveAt = client->_lastSend + _keepAliveInterval;
+    if (client->_isInitialized) {
+        if ((long)(client->_lastRecv + _keepAliveInterval - keepAliveAt) > 0) keepAliveAt = client->_lastRecv + _keepAliveInterval; //Both have to pass
+        if (_isNewerPacketID(client->_localPacketIdCounter, client->_lastAckedID) && (long)(client->_lastSend + client->_resendTimeout - dueAt) < 0) dueAt = client->_lastSend + client->_resendTimeout;
     }
+    if ((long)(keepAliveAt - dueAt) < 0) dueAt = keepAliveAt;
 
-    return NULL;
+    uint16_t index = client->_timerIndex;
+    if (index == TALLY_SERVER_NOT_SCHEDULED) {
+        index = _timerHeapSize++;
+        _timerHeap[index] = client - _clients;
+    }
+    bool earlier = (long)(dueAt - client->_dueAt) < 0;
+    client->_dueAt = dueAt;
+    client->_timerIndex = index;
+    if (earlier || index == _timerHeapSize - 1) _siftUp(index);
+    else _siftDown(index);
+}
+
+/**
+ * Take a client out of the deadline heap
+ */
+void TallyServer::_unscheduleClient(TallyClient *client) {
+    uint16_t index = client->_timerIndex;
+    if (index == TALLY_SERVER_NOT_SCHEDULED) return;
+    client->_timerIndex = TALLY_SERVER_NOT_SCHEDULED;
+
+    _timerHeapSize--;
+    if (index == _timerHeapSize) return;
+    _timerHeap[index] = _timerHeap[_timerHeapSize]; //The last one takes its place, and moves up or down from there
+    _clients[_timerHeap[index]]._timerIndex = index;
+    _siftUp(index);
+    _siftDown(_clients[_timerHeap[index]]._timerIndex);
+}
+
+/**
+ * Set the deadlines of all connected clients again, after an interval changed
+ */
+void TallyServer::_scheduleClients() {
+    for (int i = 0; i < _maxClients; i++) {
+        if (_clients[i]._isConnected) _scheduleClient(&_clients[i]);
+    }
+}
+
+/**
+ * Move the client at index in the deadline heap up, until its parent is due before it
+ */
+void TallyServer::_siftUp(uint16_t index) {
+    uint16_t clientIndex = _timerHeap[index];
+    unsigned long dueAt = _clients[clientIndex]._dueAt;
+    while (index > 0) {
+        uint16_t parent = (index - 1) / 2;
+        if ((long)(_clients[_timerHeap[parent]]._dueAt - dueAt) <= 0) break;
+        _timerHeap[index] = _timerHeap[parent];
+        _clients[_timerHeap[index]]._timerIndex = index;
+        index = parent;
+    }
+    _timerHeap[index] = clientIndex;
+    _clients[clientIndex]._timerIndex = index;
+}
+
+/**
+ * Move the client at index in the deadline heap down, until its children are due after it
+ */
+void TallyServer::_siftDown(uint16_t index) {
+    uint16_t clientIndex = _timerHeap[index];
+    unsigned long dueAt = _clients[clientIndex]._dueAt;
+    while (2 * index + 1 < _timerHeapSize) {
+        uint16_t child = 2 * index + 1;
+        if (child + 1 < _timerHeapSize && (long)(_clients[_timerHeap[child + 1]]._dueAt - _clients[_timerHeap[child]]._dueAt) < 0) child++;
+        if ((long)(_clients[_timerHeap[child]]._dueAt - dueAt) >= 0) break;
+        _timerHeap[index] = _timerHeap[child];
+        _clients[_timerHeap[index]]._timerIndex = index;
+        index = child;
+    }
+    _timerHeap[index] = clientIndex;
+    _clients[clientIndex]._timerIndex = index;
 }
 
 /**
@@ -399,7 +1227,7 @@ void TallyServer::_createHeader(TallyClient *client, uint8_t flags, uint16_t len
  * Main _createHeader method, which builds a header to send for the ATEM protocol.
  */
 void TallyServer::_createHeader(TallyClient *client, uint8_t flags, uint16_t lengthOfData, uint16_t remotePacketID) {
-    _buffer[0] = (flags) | (lengthOfData >> 8) & 0b00000111;    //Flags + length
+    _buffer[0] = flags | ((lengthOfData >> 8) & 0b00000111);    //Flags + length
     _buffer[1] = lengthOfData;                                  //Length
 
     _buffer[2] = client->_sessionID >> 8;   //Session ID
@@ -409,7 +1237,7 @@ void TallyServer::_createHeader(TallyClient *client, uint8_t flags, uint16_t len
     _buffer[5] = remotePacketID;            //Remote Packet ID
 
     if(flags & TALLY_SERVER_FLAG_ACK_REQUEST && !(flags & (TALLY_SERVER_FLAG_RESENT_PACKAGE | TALLY_SERVER_FLAG_RESEND_REQUEST | TALLY_SERVER_FLAG_HELLO ))) {
-        client->_localPacketIdCounter++;    //Increase local packet ID on new Ack request
+        client->_localPacketIdCounter = (client->_localPacketIdCounter + 1) % TALLY_SERVER_MAX_PACKET_ID;    //Increase local packet ID on new Ack request
 
         _buffer[10] = client->_localPacketIdCounter >> 8;   //Local Packet ID
         _buffer[11] = client->_localPacketIdCounter;        //Local Packet ID
@@ -427,39 +1255,186 @@ void TallyServer::_createHeader(TallyClient *client, uint8_t flags, uint16_t len
 }
 
 /**
- * Send length of what's in the buffer to the given client.
+ * Send length of what's in the buffer to the given client. Packets with a new packet ID are kept
+ * in the client's resend history, if they fit, so they can be resent as they were.
+ */
+void TallyServer::_sendBuffer(TallyClient *client, uint16_t length) {
+    _sendPacket(client, _buffer + 12, length);
+}
+
+/**
+ * Send all tally data to a client, with flags. Only the header is built for the client: the commands
+ * after it are those of _cacheTallyData(), and go out as they are.
+ */
+void TallyServer::_sendTallyData(TallyClient *client, uint8_t flags) {
+    uint16_t length = 12 + _cacheTallyData();
+    memset(_buffer, 0, 12);
+    _createHeader(client, flags, length);
+    _sendPacket(client, _tallyData + 12, length);
+}
+
+/**
+ * _sendTallyData with remotePacketID and resendPacketID, for when immitating a resent packet
+ */
+void TallyServer::_sendTallyData(TallyClient *client, uint8_t flags, uint16_t remotePacketID, uint16_t resendPacketID) {
+    uint16_t length = 12 + _cacheTallyData();
+    memset(_buffer, 0, 12);
+    _createHeader(client, flags, length, remotePacketID, resendPacketID);
+    _sendPacket(client, _tallyData + 12, length);
+}
+
+/**
+ * Send the header in the buffer followed by cmds, length in all, to the given client. Header and commands go to
+ * the transport as they are, without being copied together first. Packets built in the buffer are kept in the
+ * resend history if they fit. Those from _tallyData aren't: what's sent when they're asked for is the current
+ * tally data anyway, see _resendPacket().
  */
-void TallyServer::_sendBuffer(TallyClient *client, uint8_t length) {
-    _sendBuffer(client->_tallyIP, client->_tallyPort, length);
+void TallyServer::_sendPacket(TallyClient *client, const uint8_t *cmds, uint16_t length) {
+    uint8_t flags = _buffer[0] & 0b11111000;
+    if(flags & TALLY_SERVER_FLAG_ACK_REQUEST && !(flags & (TALLY_SERVER_FLAG_RESENT_PACKAGE | TALLY_SERVER_FLAG_RESEND_REQUEST | TALLY_SERVER_FLAG_HELLO))) {
+        uint16_t packetID = (_buffer[10] << 8) | _buffer[11];
+        uint8_t slot = packetID % TALLY_SERVER_RESEND_HISTORY;
+        client->_sentPacketIDs[slot] = packetID;
+        client->_sentPacketLengths[slot] = cmds == _buffer + 12 && length <= TALLY_SERVER_RESEND_HISTORY_PACKET_LENGTH ? length : 0;
+        if (client->_sentPacketLengths[slot]) memcpy(client->_sentPackets[slot], _buffer, length);
+        client->_sentPacketTimes[slot] = micros() | 1;
+        client->_packetsSent++;
+    }
+
+    _udp->beginPacket(client->_tallyIP, client->_tallyPort);
+    _udp->write(_buffer, 12);
+    if (length > 12) _udp->write(cmds, length - 12);
+    _udp->endPacket();
     client->_lastSend = millis();
+    if (client->_isConnected) _scheduleClient(client);
+}
+
+/**
+ * Resend the packet with the given ID to a client that asked for it. If it's not in the resend history
+ * anymore, or was too long for it, the tally data is sent with that ID instead: it's never older than what it had.
+ */
+void TallyServer::_resendPacket(TallyClient *client, uint16_t packetID) {
+    if(_isNewerPacketID(packetID, client->_localPacketIdCounter)) return; //Not sent yet
+
+    client->_resendRequests++;
+    _packetLost(client);
+
+    uint8_t slot = packetID % TALLY_SERVER_RESEND_HISTORY;
+    uint16_t length = client->_sentPacketLengths[slot];
+    if(client->_sentPacketIDs[slot] == packetID) client->_sentPacketTimes[slot] = 0; //Its ack may be for either send
+    if(client->_sentPacketIDs[slot] == packetID && length) {
+        memcpy(_buffer, client->_sentPackets[slot], length);
+        _buffer[0] |= TALLY_SERVER_FLAG_RESENT_PACKAGE;
+        _sendBuffer(client, length);
+    } else {
+        _sendTallyData(client, TALLY_SERVER_FLAG_RESENT_PACKAGE | TALLY_SERVER_FLAG_ACK | TALLY_SERVER_FLAG_ACK_REQUEST, 0, packetID);
+    }
+
+    #if TALLY_SERVER_DEBUG
+    Serial.print(client->_tallyIP);
+    Serial.print(':');
+    Serial.print(client->_tallyPort);
+    Serial.print(" - Resend resquest recieved - resent packageID: ");
+    Serial.println(packetID);
+    #endif
+}
+
+/**
+ * A client acknowledged the packet with the given ID. If it's the first ack of a packet sent once, the time it
+ * took is a round trip time sample, smoothed as TCP does (RFC 6298). An ack ends the backoff, or halves it on a
+ * link that loses a lot, as one ack getting through there says little about the next.
+ */
+void TallyServer::_ackReceived(TallyClient *client, uint16_t packetID) {
+    uint8_t slot = packetID % TALLY_SERVER_RESEND_HISTORY;
+    if (client->_sentPacketIDs[slot] != packetID || !client->_sentPacketTimes[slot]) return;
+
+    uint32_t rtt = micros() - client->_sentPacketTimes[slot];
+    client->_sentPacketTimes[slot] = 0;
+    if (!client->_srtt) {
+        client->_srtt = rtt ? rtt : 1;
+        client->_rttVar = rtt / 2;
+    } else {
+        uint32_t deviation = rtt > client->_srtt ? rtt - client->_srtt : client->_srtt - rtt;
+        client->_rttVar = client->_rttVar - client->_rttVar / 4 + deviation / 4;
+        client->_srtt = client->_srtt - client->_srtt / 8 + rtt / 8;
+    }
+
+    client->_loss -= client->_loss >> 3;
+    if (client->_loss < TALLY_SERVER_HIGH_LOSS) client->_backoff = 0;
+    else if (client->_backoff) client->_backoff--;
+    _updateResendTimeout(client);
+}
+
+/**
+ * A packet to the client got lost: update the loss estimate, a moving average over about 8 packets
+ */
+void TallyServer::_packetLost(TallyClient *client) {
+    client->_loss = client->_loss - (client->_loss >> 3) + (0xFFFF >> 3);
+}
+
+/**
+ * Derive the resend timeout of a client from its round trip time, or take the one set with setResendTimeout() while
+ * that isn't known, and double it for every step of backoff. Kept within the limits set with setResendTimeoutLimits().
+ */
+void TallyServer::_updateResendTimeout(TallyClient *client) {
+    uint32_t timeout = client->_srtt ? (client->_srtt + 4 * client->_rttVar + 999) / 1000 : _resendTimeout;
+    if (timeout < _minResendTimeout) timeout = _minResendTimeout;
+    timeout <<= client->_backoff;
+    client->_resendTimeout = timeout < _maxResendTimeout ? timeout : _maxResendTimeout;
+}
+
+/**
+ * Whether packet ID a comes after b, taking wrapping at TALLY_SERVER_MAX_PACKET_ID into account
+ */
+bool TallyServer::_isNewerPacketID(uint16_t a, uint16_t b) {
+    uint16_t distance = (uint16_t)(a - b) & (TALLY_SERVER_MAX_PACKET_ID - 1);
+    return distance != 0 && distance < TALLY_SERVER_MAX_PACKET_ID / 2;
 }
 
 /**
  * Send length of what's in the buffer to the given IP and Port
  */
-void TallyServer::_sendBuffer(IPAddress ip, uint16_t port, uint8_t length) {
-    _udp.beginPacket(ip, port);
-    _udp.write(_buffer, length);
-    _udp.endPacket();
+void TallyServer::_sendBuffer(IPAddress ip, uint16_t port, uint16_t length) {
+    _udp->beginPacket(ip, port);
+    _udp->write(_buffer, length);
+    _udp->endPacket();
 }
 
 /**
  * Reset buffer - set all bytes to 0
  */
 void TallyServer::_resetBuffer() {
-    memset(_buffer, 0, TALLY_SERVER_BUFFER_LENGTH);
+    memset(_buffer, 0, _bufferLength);
 }
 
 /**
  * Reset given client struct, so that it's ready for a new client connecting
  */
 void TallyServer::_resetClient(TallyClient *client) {
-    client->_isConnected = false;
+    if (client->_isConnected) _unregisterClient(client);
     client->_isInitialized = false;
     client->_lastRecv = 0;
     client->_localPacketIdCounter = 0;
+    client->_lastAckedID = 0;
     client->_lastRemotePacketID = 0;
+    memset(client->_sentPacketIDs, 0, sizeof(client->_sentPacketIDs));
+    memset(client->_sentPacketLengths, 0, sizeof(client->_sentPacketLengths));
+    memset(client->_sentPacketTimes, 0, sizeof(client->_sentPacketTimes));
+    client->_srtt = 0;
+    client->_rttVar = 0;
+    client->_backoff = 0;
+    client->_loss = 0;
+    client->_packetsSent = 0;
+    client->_resends = 0;
+    client->_resendRequests = 0;
+    _updateResendTimeout(client);
     client->_sessionID = 0;
+    client->_isMulticast = false;
+    client->_multicastAckedSeq = 0;
+    client->_hasTallyVersion = false;
+    client->_ackedTallyVersion = 0;
+    client->_subscribedIndexCount = 0;
+    client->_subscriptionReceived = false;
 }
 
 /**
@@ -471,8 +1446,19 @@ bool TallyServer::_hasTimePassed(unsigned long timestamp, uint16_t interval) {
 }
 
 /**
- * Set all _atemTallyFlags to 0
+ * Set all tally flags to 0
  */
 void TallyServer::resetTallyFlags() {
-    memset(_atemTallyFlags, 0, TALLY_SERVER_MAX_TALLY_FLAGS);
+    if (_atemTallyCapacity) memset(_atemTallyFlags, 0, _atemTallyCapacity);
+    if (_atemTallyBySourceCapacity) memset(_atemTallyBySourceFlags, 0, _atemTallyBySourceCapacity);
+    _tallyLayoutVersion = _tallyVersion + 1; //Clients get all tally data next, as they can't be sent deltas against flags cleared here
+    _tallyChanged();
+}
+
+/**
+ * Mark the tally data to be sent to clients in runLoop(), noting when it first changed to tell how long it took
+ */
+void TallyServer::_tallyChanged() {
+    if (!_tallyFlagsChanged) _tallyChangedAt = micros();
+    _tallyFlagsChanged = true;
 }
@@ -24,8 +24,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #if defined ESP8266 || defined ESP32
 #include <WiFiUdp.h>
-#else
+#elif defined ARDUINO
 #include <EthernetUdp.h>
+#else
+#include <PosixUdp.h>
 #endif
 
 #define TALLY_SERVER_FLAG_ACK               0b10000000
@@ -39,21 +41,61 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define TALLY_SERVER_CONNECTION_REJECTED    3
 #define TALLY_SERVER_CONNECTION_LOST        4
 
-#define TALLY_SERVER_MAX_TALLY_FLAGS    41
+#define TALLY_SERVER_MAX_PACKET_LENGTH   2047    //The packet length in the ATEM header is 11 bits. TlIn and TlSr are sent together, so they have to fit in one packet
+#define TALLY_SERVER_MIN_BUFFER_LENGTH   32      //Hello packet, and the packets clients send
+#define TALLY_SERVER_MULTICAST_CMD_LENGTH 16     //TlMc command, see setMulticast()
+#define TALLY_SERVER_MULTICAST_ACK_TIMEOUT 250   //Time (ms) to wait for a client to acknowledge a multicast, before it's sent the tally data on its own
+#define TALLY_SERVER_VERSION_CMD_LENGTH   10     //TlVr command, the version of the tally data in a packet
+#define TALLY_SERVER_DELTA_MAX_AGE        0x4000 //Max number of versions a client may be behind to be sent a delta (TlDl command) instead of all tally data
+#define TALLY_SERVER_MAX_HOPS             8      //Max number of tally servers relaying the tally between the switcher and a tally light, see setRelayID()
+#define TALLY_SERVER_HOP_LENGTH           8      //Relay ID and delay of one hop in the TlHp command
+#define TALLY_SERVER_RELAY_PATH_CMD_MAX_LENGTH (10 + TALLY_SERVER_MAX_HOPS * TALLY_SERVER_HOP_LENGTH)
+#define TALLY_SERVER_MAX_SUBSCRIBED_INDEXES 8 //Max number of TlIn indexes a client can subscribe to with a TlSb command
+#define TALLY_SERVER_SUBSCRIPTION_CMD_MAX_LENGTH (10 + 2 * TALLY_SERVER_MAX_SUBSCRIBED_INDEXES)
 
-#define TALLY_SERVER_BUFFER_LENGTH  62 //Max 42: Header = 12 + cmdHeader = 8 + tallySources = 2 + max 40 tally flags
+#define TALLY_SERVER_MAX_PACKET_ID       0x8000  //Packet IDs wrap at bit 15, as the ATEM's do
+#define TALLY_SERVER_RESEND_HISTORY      4       //Number of packets sent to a client that are kept, to resend them when asked
+#define TALLY_SERVER_RESEND_HISTORY_PACKET_LENGTH 64 //Longest packet kept. Deltas and acks fit, longer tally data is built again when asked for
 
 #define TALLY_SERVER_DEFAULT_MAX_CLIENTS    5
 
-#define TALLY_SERVER_KEEP_ALIVE_MSG_INTERVAL 1500
+#define TALLY_SERVER_KEEP_ALIVE_MSG_INTERVAL 1500  //Default for setKeepAliveInterval()
+#define TALLY_SERVER_RESEND_TIMEOUT          250   //Default for setResendTimeout(), the resend timeout until a client's round trip time is known
+#define TALLY_SERVER_MIN_RESEND_TIMEOUT      10    //Default floor of the resend timeout, see setResendTimeoutLimits()
+#define TALLY_SERVER_MAX_RESEND_TIMEOUT      2000  //Default ceiling of the resend timeout, backoff included
+#define TALLY_SERVER_HIGH_LOSS               0x4000 //Loss estimate (of 0xFFFF) from which an ack only halves the backoff, instead of ending it
+#define TALLY_SERVER_CLIENT_TIMEOUT          5000  //Default for setClientTimeout()
+
+#define TALLY_SERVER_NOT_SCHEDULED           0xFFFF //TallyClient::_timerIndex of a client not in the deadline heap
+
+/**
+ * How the link to a connected client is doing, see TallyServer::getClientStats()
+ */
+struct TallyClientStats {
+    IPAddress ip;
+    uint16_t port;
+    bool initialized;               //Finished connecting
+    bool multicast;                 //Gets tally data by multicast
+    uint8_t subscribedIndexes;      //Number of TlIn indexes it subscribed to, 0 for all tally data
+    uint32_t rtt;                   //Smoothed round trip time (us), 0 before the first ack was timed
+    uint32_t rttVariation;          //Mean deviation of the round trip time (us)
+    uint16_t resendTimeout;         //Time (ms) the server waits for an ack before sending the tally data again
+    uint16_t loss;                  //Share of packets that had to be sent again, smoothed, in per mille
+    uint32_t packetsSent;           //Packets asking for an ack
+    uint32_t resends;               //Tally data sent again as an ack didn't come in time
+    uint32_t resendRequests;        //Packets the client asked for again
+};
 
 class TallyServer {
 private:
 #if defined ESP8266 || defined ESP32
-    WiFiUDP _udp;
+    WiFiUDP _defaultUdp;
+#elif defined ARDUINO
+    EthernetUDP _defaultUdp;
 #else
-    EthernetUDP _udp;
+    PosixUDP _defaultUdp;
 #endif
+    UDP *_udp; //Points to _defaultUdp unless another transport is set with setTransport()
 
     struct TallyClient {
         IPAddress _tallyIP;
@@ -66,27 +108,129 @@ private:
         unsigned long _lastSend;
         uint16_t _lastAckedID;
         uint16_t _lastRemotePacketID;
+        bool _isMulticast;                  //Client has acknowledged a multicast, so it gets tally data by multicast
+        uint16_t _multicastAckedSeq;        //Last multicast sequence number the client acknowledged
+        bool _hasTallyVersion;              //Client has acknowledged a version of the tally data, so it can be sent deltas
+        uint16_t _ackedTallyVersion;        //Last version of the tally data the client acknowledged
+        uint16_t _sentPacketIDs[TALLY_SERVER_RESEND_HISTORY];       //Resend history, indexed by packet ID modulo its size
+        uint16_t _sentPacketLengths[TALLY_SERVER_RESEND_HISTORY];   //0 if the packet wasn't kept
+        uint8_t _sentPackets[TALLY_SERVER_RESEND_HISTORY][TALLY_SERVER_RESEND_HISTORY_PACKET_LENGTH];
+        uint32_t _sentPacketTimes[TALLY_SERVER_RESEND_HISTORY];    //micros() the packet was sent, 0 once it's acked or sent again, so an ack is only timed against the one send it can be for
+        uint32_t _srtt;                     //Smoothed round trip time (us), 0 before the first ack was timed
+        uint32_t _rttVar;                   //Mean deviation of the round trip time (us)
+        uint16_t _resendTimeout;            //Time (ms) to wait for an ack: _srtt + 4 * _rttVar within the limits, doubled for every step of backoff
+        uint8_t _backoff;                   //Resend timeouts in a row, less the acks since
+        uint16_t _loss;                     //Share of packets that had to be sent again, of 0xFFFF, smoothed
+        uint32_t _packetsSent;
+        uint32_t _resends;
+        uint32_t _resendRequests;
+        uint8_t _subscribedIndexCount;      //Number of TlIn indexes the client subscribed to, 0 for all tally data
+        uint16_t _subscribedIndexes[TALLY_SERVER_MAX_SUBSCRIBED_INDEXES];
+        bool _subscriptionReceived;         //A TlSb came in, to be answered with all tally data and the subscription
+        unsigned long _dueAt;               //Deadline (millis) of the next check in runLoop(), see _scheduleClient()
+        uint16_t _timerIndex;               //Position in _timerHeap, or TALLY_SERVER_NOT_SCHEDULED
     };
 
-    uint8_t _buffer[TALLY_SERVER_BUFFER_LENGTH];
+    uint8_t *_buffer;
+    uint16_t _bufferLength;
+
+    //The tally data packet of the current tally version, built once and sent to every client that needs all of it with
+    //its own header, see _sendTallyData(). As long as _buffer, so anything built in that fits
+    uint8_t *_tallyData;
+    uint16_t _tallyDataCmdLength;
+    bool _tallyDataCached;            //False when something in the tally data changed since it was built
 
     TallyClient* _clients;
     int _maxClients = 0; 
+    int _clientCapacity;      //Number of clients to make room for in begin(). Nothing is allocated after that
 
+    //Registry of the connected clients by IP and port: an open addressing hash table of client index + 1, 0 being an empty slot
+    uint16_t *_clientTable;
+    uint8_t _clientTableBits; //The table has 1 << _clientTableBits slots, at least twice _maxClients, so it's never more than half full
+    uint16_t *_freeClients;   //Stack of the indexes of the clients not connected
+    uint16_t _freeClientCount;
+
+    //Connected clients by deadline: a binary min-heap of client indexes, ordered by TallyClient::_dueAt
+    uint16_t *_timerHeap;
+    uint16_t _timerHeapSize;
+    uint16_t _keepAliveInterval;
+    uint16_t _resendTimeout;                //Until a client's round trip time is known
+    uint16_t _minResendTimeout;
+    uint16_t _maxResendTimeout;
+    uint16_t _clientTimeout;
+
+    //Tally storage grows with the number of sources set, and is never shrunk
     uint16_t _atemTallySources;
-    uint8_t _atemTallyFlags[TALLY_SERVER_MAX_TALLY_FLAGS];
+    uint16_t _atemTallyCapacity;
+    uint8_t *_atemTallyFlags;
+    uint16_t _atemTallyBySourceSources;
+    uint16_t _atemTallyBySourceCapacity;
+    uint16_t *_atemTallyBySourceVideoSources;
+    uint8_t *_atemTallyBySourceFlags;
     bool _tallyFlagsChanged;
 
+    uint16_t _tallyVersion;                 //Version of the tally data, increased every time changes are sent
+    uint16_t *_atemTallyChangedVersion;     //Version each TlIn tally flag last changed in, sized as _atemTallyFlags
+    uint16_t *_atemTallyBySourceChangedVersion; //Version each TlSr tally flag last changed in, sized as _atemTallyBySourceFlags
+    uint16_t _tallyLayoutVersion;           //Version the number of sources or the TlSr video sources last changed in, as deltas only carry tally flags
+
+    IPAddress _multicastIP;
+    uint16_t _multicastPort;                //0 when tally data is only sent by unicast
+    uint16_t _multicastSeq;                 //Sequence number of the last multicast, of its own as all clients get the same packet
+    unsigned long _multicastSentAt;
+    bool _multicastAckCheckPending;         //Clients haven't been checked for acknowledging the last multicast yet
+
+    //Relays the tally came through from the switcher, this one last, sent to clients in the TlHp command
+    uint32_t _relayID;                      //0 when no TlHp is sent
+    uint8_t _upstreamHops;                  //Relays before this one. At TALLY_SERVER_MAX_HOPS clients are turned away
+    uint32_t _relayIDs[TALLY_SERVER_MAX_HOPS];
+    uint32_t _relayDelays[TALLY_SERVER_MAX_HOPS]; //Time (us) from each relay receiving the last change to passing it on
+    uint32_t _relayDelay;                   //The same for this one
+    unsigned long _tallyChangedAt;          //micros() of the first change since tally data was last sent
+
     TallyClient *_getTallyClient(IPAddress clientIP, uint16_t clientPort);
+    void _allocateClients(int maxClients);
+    void _clearClients();
+    uint16_t _clientSlot(IPAddress clientIP, uint16_t clientPort);
+    void _registerClient(TallyClient *client);
+    void _unregisterClient(TallyClient *client);
+    void _scheduleClient(TallyClient *client);
+    void _unscheduleClient(TallyClient *client);
+    void _scheduleClients();
+    void _siftUp(uint16_t index);
+    void _siftDown(uint16_t index);
 
     uint16_t _createTallyDataCmd();
+    uint16_t _createRelayPathCmd(uint8_t *cmd);
+    uint16_t _createTallyDataCmd(bool multicastCmd);
+    uint16_t _createTallyDataCmd(uint8_t *cmd, bool multicastCmd);
+    uint16_t _cacheTallyData();
+    void _sendMulticast();
+    void _tallyChanged();
+    void _readClientCmds(TallyClient *client, uint16_t packetLen);
+    uint16_t _createTallyBySourceCmd(uint8_t *cmd);
+    uint16_t _createTallyDeltaCmd(uint16_t baseVersion);
+    uint16_t _createTallyDeltaCmd(uint16_t baseVersion, const uint16_t *indexes, uint8_t indexCount);
+    uint16_t _createSubscriptionCmd(TallyClient *client, uint8_t *cmd);
+    uint16_t _tallyDataLength(uint16_t tallySources, uint16_t tallyBySourceSources);
+    bool _reserveBuffer(uint16_t length);
+    bool _reserveTallySources(uint16_t tallySources);
+    bool _reserveTallyBySourceSources(uint16_t tallySources);
     
     void _createHeader(TallyClient *client, uint8_t falgs, uint16_t lengthOfData);
     void _createHeader(TallyClient *client, uint8_t falgs, uint16_t lengthOfData, uint16_t remotePacketID);
     void _createHeader(TallyClient *client, uint8_t falgs, uint16_t lengthOfData, uint16_t remotePacketID,  uint16_t resendPacketID);
     
-    void _sendBuffer(TallyClient *client, uint8_t length);
-    void _sendBuffer(IPAddress ip, uint16_t port, uint8_t length);
+    void _sendBuffer(TallyClient *client, uint16_t length);
+    void _sendTallyData(TallyClient *client, uint8_t flags);
+    void _sendTallyData(TallyClient *client, uint8_t flags, uint16_t remotePacketID, uint16_t resendPacketID);
+    void _sendPacket(TallyClient *client, const uint8_t *cmds, uint16_t length);
+    void _sendBuffer(IPAddress ip, uint16_t port, uint16_t length);
+    void _resendPacket(TallyClient *client, uint16_t packetID);
+    void _ackReceived(TallyClient *client, uint16_t packetID);
+    void _packetLost(TallyClient *client);
+    void _updateResendTimeout(TallyClient *client);
+    bool _isNewerPacketID(uint16_t a, uint16_t b);
 
     void _resetBuffer();
 
@@ -98,9 +242,26 @@ public:
     TallyServer();
     TallyServer(int maxClients);
     void begin();
+    void begin(int maxClients);
+    void setTransport(UDP *udp);
+    void setMulticast(IPAddress address, uint16_t port);
+    void setKeepAliveInterval(uint16_t interval);
+    void setResendTimeout(uint16_t timeout);
+    void setResendTimeoutLimits(uint16_t minTimeout, uint16_t maxTimeout);
+    void setClientTimeout(uint16_t timeout);
+    void setRelayID(uint32_t relayID);
+    void setUpstreamHops(uint8_t hops);
+    void setUpstreamRelay(uint8_t hop, uint32_t relayID, uint32_t delay);
+    uint32_t getRelayDelay();
+    uint16_t getClientCount();
+    int getMaxClients();
+    bool getClientStats(int index, TallyClientStats *stats);
     void end();
     void runLoop();
-    void setTallySources(uint8_t tallySources);
-    void setTallyFlag(uint8_t tallyIndex, uint8_t tallyFlag);
+    void reserveTallySources(uint16_t tallySources, uint16_t tallyBySourceSources);
+    void setTallySources(uint16_t tallySources);
+    void setTallyFlag(uint16_t tallyIndex, uint8_t tallyFlag);
+    void setTallyBySourceSources(uint16_t tallySources);
+    void setTallyBySourceFlag(uint16_t index, uint16_t videoSource, uint8_t tallyFlag);
     void resetTallyFlags();
 };